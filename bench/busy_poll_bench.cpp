@@ -0,0 +1,101 @@
+#include "../busy_poll.hpp"
+#include "../net/udp.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Compares the one-way loopback latency and the CPU time of the receiving thread between a blocking recvfrom, the
+ * adaptive user-space spin and SO_BUSY_POLL, for several message rates.
+ *
+ * Usage: busy_poll_bench [messages per run] [max spin budget in us]
+ */
+enum class mode { blocking, spin, kernel };
+
+struct result {
+    double p50_us;
+    double p99_us;
+    double cpu;             // CPU time of the receiver over the wall time of the run
+    double spin_hit_rate;
+    uint64_t kernel_updates;    // SO_BUSY_POLL calls
+};
+
+static nanoseconds thread_cpu_time() {
+    timespec ts = {};
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+}
+
+result run(mode m, size_t count, microseconds gap, microseconds max_budget) {
+    net::udp::socket receiver(net::address_v4("127.0.0.1", 0));
+    net::udp::socket sender(net::address_v4("127.0.0.1", 0));
+    const net::address_v4 receiver_addr = { "127.0.0.1", receiver.address().port() };
+
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    result ret = {};
+    std::thread consumer([&] {
+        spin_options opts;
+        opts.max_budget = max_budget;
+        opts.kernel = m == mode::kernel;
+        adaptive_receiver adaptive(opts);
+        char data[64];
+        net::address_v4 from;
+        const auto cpu_start = thread_cpu_time();
+        const auto wall_start = steady_clock::now();
+        while(latencies.size() < count) {
+            const auto len = m == mode::blocking ? receiver.recv_from(net::buffer(data), 0, &from)
+                                                 : adaptive.recv_from(receiver, net::buffer(data), &from);
+            const auto now = steady_clock::now().time_since_epoch().count();
+            if(len != sizeof(int64_t)) continue;
+            int64_t sent;
+            std::memcpy(&sent, data, sizeof(sent));
+            latencies.push_back(double(now - sent) / 1000.0);
+        }
+        ret.cpu = duration<double>(thread_cpu_time() - cpu_start).count() / duration<double>(steady_clock::now() - wall_start).count();
+        if(m != mode::blocking)
+            ret.spin_hit_rate = double(adaptive.stats().spin_hits) / double(count);
+        ret.kernel_updates = adaptive.stats().kernel_updates;
+    });
+
+    std::this_thread::sleep_for(milliseconds(10));
+    for(size_t i = 0; i < count; i++) {
+        const int64_t now = steady_clock::now().time_since_epoch().count();
+        sender.send_to(net::buffer(&now, sizeof(now)), receiver_addr);
+        std::this_thread::sleep_for(gap);
+    }
+    consumer.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    ret.p50_us = latencies[latencies.size() / 2];
+    ret.p99_us = latencies[latencies.size() * 99 / 100];
+    return ret;
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 2000;
+    const microseconds max_budget(argc > 2 ? std::stoul(argv[2]) : 200);
+
+    std::printf("%u hardware threads, %zu messages per run, max budget %lld us\n",
+                std::thread::hardware_concurrency(), count, static_cast<long long>(max_budget.count()));
+    std::printf("%10s %10s %10s %10s %8s %10s %11s\n", "gap (us)", "mode", "p50 (us)", "p99 (us)", "cpu", "spin hits", "setsockopt");
+    for(const auto gap : { microseconds(10), microseconds(50), microseconds(200), microseconds(1000) }) {
+        for(const auto& [m, name] : { std::make_pair(mode::blocking, "blocking"),
+                                      std::make_pair(mode::spin, "spin"),
+                                      std::make_pair(mode::kernel, "kernel") }) {
+            const auto r = run(m, count, gap, max_budget);
+            std::printf("%10lld %10s %10.1f %10.1f %7.0f%% %9.0f%% %11lu\n", static_cast<long long>(gap.count()), name,
+                        r.p50_us, r.p99_us, 100 * r.cpu, 100 * r.spin_hit_rate, static_cast<unsigned long>(r.kernel_updates));
+        }
+    }
+    return 0;
+}
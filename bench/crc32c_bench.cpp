@@ -0,0 +1,58 @@
+#include "../crc32c.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Measures the throughput of each CRC32C implementation in GB/s over buffers of typical datagram sizes, and checks
+ * that they agree with each other and with the standard check value.
+ *
+ * Usage: crc32c_bench [megabytes per measurement]
+ */
+template<typename Fn>
+double throughput(Fn&& fn, const std::vector<char>& buffer, size_t size, size_t total) {
+    const size_t rounds = std::max<size_t>(total / size, 1);
+    volatile uint32_t sink = 0;
+    const auto start = steady_clock::now();
+    for(size_t i = 0; i < rounds; i++)
+        sink = sink + fn(buffer.data() + (i * 64) % (buffer.size() - size + 1), size);
+    const auto elapsed = duration<double>(steady_clock::now() - start).count();
+    return double(rounds * size) / elapsed / 1e9;
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t total = (argc > 1 ? std::stoul(argv[1]) : 256) << 20;
+    std::vector<char> buffer(1 << 17);
+    std::mt19937 rng(42);
+    for(auto& c : buffer)
+        c = static_cast<char>(rng());
+
+    const char check[] = "123456789";
+    std::printf("check value: software %08x, hardware %08x (expected e3069283)\n",
+                crc32c::software(check, 9), crc32c::has_hardware() ? crc32c::hardware(check, 9) : crc32c::software(check, 9));
+    for(size_t size = 1; size < 4096; size = size * 3 + 1) {
+        if(crc32c::has_hardware() && crc32c::hardware(buffer.data() + 3, size) != crc32c::software(buffer.data() + 3, size)) {
+            std::printf("mismatch at size %zu\n", size);
+            return 1;
+        }
+    }
+
+    std::printf("SSE4.2 %s\n", crc32c::has_hardware() ? "available" : "not available");
+    std::printf("%10s %16s %16s %16s\n", "bytes", "slicing-by-8", "sse4.2", "seal+open");
+    for(const size_t size : { 64, 256, 1472, 65536 }) {
+        const double soft = throughput([](const char* p, size_t n) { return crc32c::software(p, n); }, buffer, size, total);
+        const double hard = crc32c::has_hardware() ? throughput([](const char* p, size_t n) { return crc32c::hardware(p, n); }, buffer, size, total) : 0;
+        const double sealed = throughput([](const char* p, size_t n) {
+            std::string datagram = crc32c::seal(std::string(p, n));
+            size_t len = datagram.size();
+            return static_cast<uint32_t>(crc32c::open(datagram.data(), len)) + uint32_t(len);
+        }, buffer, size, total / 4);
+        std::printf("%10zu %13.2f GB/s %13.2f GB/s %13.2f GB/s\n", size, soft, hard, sealed);
+    }
+    return 0;
+}
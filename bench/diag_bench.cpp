@@ -0,0 +1,124 @@
+#include "../shared_state.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Measures how a slow stderr (a terminal that cannot keep up, a pipe nobody drains quickly) affects threads that
+ * update the peer table. Several threads refresh and replace peers of a shared_state while std::cerr goes to a
+ * stream that takes a fixed time per write. The synchronous variant writes the join and leave notices to std::cerr
+ * while holding the table lock, as shared_state used to; the asynchronous one is the current shared_state, which
+ * hands them to the diag writer.
+ *
+ * Usage: diag_bench [operations per thread] [threads] [write delay in us]
+ */
+class slow_sink : public std::streambuf {
+public:
+    explicit slow_sink(microseconds delay) : m_delay(delay) {}
+
+protected:
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        std::this_thread::sleep_for(m_delay);
+        return n;
+    }
+
+    int_type overflow(int_type ch) override {
+        return ch;
+    }
+
+private:
+    const microseconds m_delay;
+};
+
+/**
+ * The peer table as it was: notices written to std::cerr with the lock held.
+ */
+class synchronous_table {
+public:
+    void update(const net::address_v4& peer) {
+        std::scoped_lock lock(m_mutex);
+        if(m_peers.find(peer) == m_peers.end())
+            std::cerr << peer << " has joined." << std::endl;
+        m_peers[peer] = clocks::get_current_time();
+    }
+
+    void leave(const net::address_v4& peer) {
+        std::scoped_lock lock(m_mutex);
+        std::cerr << peer << " has left." << std::endl;
+        m_peers.erase(peer);
+    }
+
+private:
+    std::unordered_map<net::address_v4, clocks::time_type> m_peers;
+    std::mutex m_mutex;
+};
+
+struct result {
+    double seconds;
+    std::vector<long> latencies;        // Nanoseconds per operation
+};
+
+template<typename Table>
+result run(Table& table, size_t operations, size_t threads) {
+    std::vector<std::vector<long>> latencies(threads);
+    std::vector<std::thread> workers;
+    const auto start = steady_clock::now();
+    for(size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for(size_t i = 0; i < operations; i++) {
+                // Mostly refreshes of known peers, as heartbeats are, with a join and a leave every 16 operations
+                const net::address_v4 peer("127.0." + std::to_string(t) + '.' + std::to_string(i % 16 == 0 ? 100 + i / 16 % 100 : i % 8), 4000);
+                const auto before = steady_clock::now();
+                table.update(peer);
+                if(i % 16 == 0) table.leave(peer);
+                latencies[t].push_back(duration_cast<nanoseconds>(steady_clock::now() - before).count());
+            }
+        });
+    }
+    for(auto& worker : workers)
+        worker.join();
+    result ret = { duration<double>(steady_clock::now() - start).count(), {} };
+    for(const auto& l : latencies)
+        ret.latencies.insert(ret.latencies.end(), l.begin(), l.end());
+    std::sort(ret.latencies.begin(), ret.latencies.end());
+    return ret;
+}
+
+long percentile(const std::vector<long>& sorted, double q) {
+    if(sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * double(sorted.size())))];
+}
+
+void print(const char* name, const result& r) {
+    std::printf("%-12s %12.0f %10.1f %10.1f %12.1f\n", name, double(r.latencies.size()) / r.seconds,
+                double(percentile(r.latencies, 0.5)) / 1e3, double(percentile(r.latencies, 0.99)) / 1e3,
+                double(r.latencies.empty() ? 0 : r.latencies.back()) / 1e3);
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t operations = argc > 1 ? std::stoul(argv[1]) : 2000;
+    const size_t threads = argc > 2 ? std::stoul(argv[2]) : 4;
+    const auto delay = microseconds(argc > 3 ? std::stoul(argv[3]) : 200);
+
+    slow_sink sink(delay);
+    auto* const original = std::cerr.rdbuf(&sink);
+    std::printf("%-12s %12s %10s %10s %12s\n", "notices", "ops/s", "p50 us", "p99 us", "max us");
+    synchronous_table before;
+    print("synchronous", run(before, operations, threads));
+    shared_state after(net::address_v4("127.0.0.1", 0));
+    print("diag", run(after, operations, threads));
+    diag::flush();
+    std::cerr.rdbuf(original);
+    const auto stats = diag::stats();
+    std::printf("diag: %lu written, %lu dropped, %lu rate-limited\n", static_cast<unsigned long>(stats.written),
+                static_cast<unsigned long>(stats.dropped), static_cast<unsigned long>(stats.suppressed));
+    return 0;
+}
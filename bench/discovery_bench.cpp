@@ -0,0 +1,107 @@
+#include "../peer_manager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Measures how fast nodes bootstrap with discovery beacons instead of the registry: nodes join a loopback mesh one
+ * at a time, with no initial peers, and each newcomer is timed from run() until it knows its first peer and until
+ * it knows every node already running. Prints JSON, with times in microseconds.
+ *
+ * Usage: discovery_bench [mesh sizes, e.g. 2,4,8,16] [multicast group, e.g. 239.255.80.80 or 127.255.255.255]
+ */
+struct sample {
+    long first_peer;
+    long all_peers;
+};
+
+long wait_for(const shared_state& state, size_t peers, steady_clock::time_point start) {
+    const auto deadline = start + seconds(3);
+    while(steady_clock::now() < deadline) {
+        if(state.copy_peers().size() >= peers)
+            return duration_cast<microseconds>(steady_clock::now() - start).count();
+        std::this_thread::sleep_for(microseconds(100));
+    }
+    return -1;
+}
+
+std::vector<sample> run(size_t nodes, const std::string& group, in_port_t base_port) {
+    discovery::options opts;
+    opts.group = { group, static_cast<in_port_t>(base_port + 1000) };
+    std::vector<std::unique_ptr<net::io_context>> contexts;
+    std::vector<std::shared_ptr<shared_state>> states;
+    std::vector<std::shared_ptr<peer_manager>> managers;
+    std::vector<std::thread> threads;
+    std::vector<sample> ret;
+    for(size_t i = 0; i < nodes; i++) {
+        const net::address_v4 address("127.0.0.1", static_cast<in_port_t>(base_port + i));
+        contexts.push_back(std::make_unique<net::io_context>());
+        states.push_back(std::make_shared<shared_state>(address));
+        managers.push_back(std::make_shared<peer_manager>(*contexts.back(), address, std::unordered_set<net::address_v4>{}, states.back()));
+        managers.back()->enable_discovery(opts);
+        const auto start = steady_clock::now();
+        threads.emplace_back([manager = managers.back()] { manager->run(); });
+        if(i > 0)
+            ret.push_back({ wait_for(*states.back(), 1, start), wait_for(*states.back(), i, start) });
+        std::this_thread::sleep_for(milliseconds(20));
+    }
+
+    net::udp::socket control(net::address_v4("127.0.0.1", 0));
+    const std::string stop = "stop";
+    for(size_t i = 0; i < nodes; i++)
+        control.send_to(net::buffer(stop), net::address_v4("127.0.0.1", static_cast<in_port_t>(base_port + i)));
+    for(auto& thread : threads)
+        thread.join();
+    std::this_thread::sleep_for(milliseconds(150));     // Let the discovery threads see the shutdown
+    return ret;
+}
+
+std::vector<size_t> parse_list(const std::string& list) {
+    std::vector<size_t> ret;
+    std::stringstream in(list);
+    for(std::string item; std::getline(in, item, ',');)
+        ret.push_back(std::stoul(item));
+    return ret;
+}
+
+long percentile(std::vector<long> values, double q) {
+    if(values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, static_cast<size_t>(q * double(values.size())))];
+}
+
+int main(int argc, const char* argv[]) {
+    const auto sizes = parse_list(argc > 1 ? argv[1] : "2,4,8,16");
+    const std::string group = argc > 2 ? argv[2] : "239.255.80.80";
+    std::cerr.setstate(std::ios::failbit);      // Silence the join notices
+
+    in_port_t port = 47700;
+    std::printf("{\n  \"benchmark\": \"discovery_bootstrap\",\n  \"group\": \"%s\",\n  \"unit\": \"us\",\n  \"results\": [", group.c_str());
+    const char* separator = "\n";
+    for(const auto nodes : sizes) {
+        const auto samples = run(nodes, group, port);
+        port += static_cast<in_port_t>(nodes);
+        std::vector<long> first, all;
+        size_t failed = 0;
+        for(const auto& s : samples) {
+            if(s.first_peer < 0 || s.all_peers < 0) { failed++; continue; }
+            first.push_back(s.first_peer);
+            all.push_back(s.all_peers);
+        }
+        std::printf("%s    { \"nodes\": %zu, \"joins\": %zu, \"failed\": %zu, \"first_peer_p50\": %ld, \"first_peer_max\": %ld, "
+                    "\"all_peers_p50\": %ld, \"all_peers_max\": %ld }",
+                    separator, nodes, samples.size(), failed, percentile(first, 0.5), percentile(first, 1.0),
+                    percentile(all, 0.5), percentile(all, 1.0));
+        std::fflush(stdout);
+        separator = ",\n";
+    }
+    std::printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "../net/fault_injection.hpp"
+#include "../net/udp.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Characterizes the behaviour of the peer protocol under injected faults on plain loopback.
+ *
+ *  - Failure detection: heartbeats are sent every interval through a lossy socket, and a peer is suspected once no
+ *    heartbeat arrived for 4 intervals (the ratio of peer_manager's keep-alive and timeout). Reports the false
+ *    suspicions while the sender is alive and the time to detect it once it stops.
+ *  - Delivery: timestamped datagrams go through loss, duplication, reordering and delay, injected either on the
+ *    sending or on the receiving side. Reports the delivery ratio, duplicates, reordering and latency percentiles.
+ *
+ * Usage: fault_injection_bench [seed]
+ */
+using clock_type = steady_clock;
+
+struct detection_result {
+    size_t heartbeats;
+    size_t false_suspicions;
+    double detection_ms;
+};
+
+detection_result run_detection(double loss, milliseconds interval, size_t heartbeats, uint64_t seed) {
+    net::udp::socket receiver(net::address_v4("127.0.0.1", 0));
+    net::udp::socket sender(net::address_v4("127.0.0.1", 0));
+    const net::address_v4 receiver_addr = { "127.0.0.1", receiver.address().port() };
+    receiver.set_option(SOL_SOCKET, SO_RCVTIMEO, net::to_timeval(interval * 10));
+    const auto timeout = 4 * interval;
+
+    std::vector<clock_type::time_point> arrivals;
+    std::thread detector([&] {
+        char data[16];
+        net::address_v4 from;
+        while(receiver.recv_from(net::buffer(data), &from) > 0)
+            arrivals.push_back(clock_type::now());
+    });
+
+    net::fault_options opts;
+    opts.loss = loss;
+    net::fault_injector injector(opts, seed);
+    const net::faulty_socket faulty(sender, injector);
+    auto next = clock_type::now();
+    for(size_t i = 0; i < heartbeats; i++) {
+        faulty.send_to(net::buffer("peer", 4), receiver_addr);
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    const auto stopped = next - interval;
+    detector.join();
+
+    detection_result ret = { heartbeats, 0, 0 };
+    auto last = arrivals.empty() ? stopped : arrivals.front();
+    for(const auto& arrival : arrivals) {
+        if(arrival - last > timeout)
+            ret.false_suspicions++;
+        last = arrival;
+    }
+    ret.detection_ms = duration<double, std::milli>(last + timeout - stopped).count();
+    return ret;
+}
+
+struct delivery_result {
+    size_t delivered;
+    size_t duplicates;
+    size_t reordered;
+    double p50_ms;
+    double p99_ms;
+    double max_ms;
+};
+
+delivery_result run_delivery(const net::fault_options& opts, bool on_receive, size_t count, microseconds gap, uint64_t seed) {
+    net::udp::socket receiver(net::address_v4("127.0.0.1", 0));
+    net::udp::socket sender(net::address_v4("127.0.0.1", 0));
+    const net::address_v4 receiver_addr = { "127.0.0.1", receiver.address().port() };
+    receiver.set_option(SOL_SOCKET, SO_RCVBUF, 1 << 20);
+    net::fault_injector injector(opts, seed);
+
+    delivery_result ret = {};
+    std::vector<double> latencies;
+    std::thread consumer([&] {
+        net::faulty_socket faulty(receiver, injector);
+        net::fault_injector passthrough;
+        net::faulty_socket plain(receiver, passthrough);
+        std::set<uint64_t> seen;
+        uint64_t highest = 0;
+        struct { uint64_t seq; int64_t sent; } msg = {};
+        const auto deadline = clock_type::now() + gap * count + milliseconds(200);
+        while(clock_type::now() < deadline) {
+            const auto len = on_receive ? faulty.recv_from(net::buffer(&msg, sizeof(msg)), MSG_DONTWAIT)
+                                        : plain.recv_from(net::buffer(&msg, sizeof(msg)), MSG_DONTWAIT);
+            if(len != sizeof(msg)) {
+                std::this_thread::sleep_for(microseconds(50));
+                continue;
+            }
+            latencies.push_back(double(clock_type::now().time_since_epoch().count() - msg.sent) / 1e6);
+            if(!seen.insert(msg.seq).second) {
+                ret.duplicates++;
+                continue;
+            }
+            if(msg.seq < highest) ret.reordered++;
+            highest = std::max(highest, msg.seq);
+        }
+        ret.delivered = seen.size();
+    });
+
+    const net::faulty_socket faulty(sender, injector);
+    auto next = clock_type::now();
+    for(uint64_t seq = 1; seq <= count; seq++) {
+        struct { uint64_t seq; int64_t sent; } msg = { seq, clock_type::now().time_since_epoch().count() };
+        const net::const_buffer payload(&msg, sizeof(msg));
+        if(on_receive) sender.send_to(payload, receiver_addr);
+        else           faulty.send_to(payload, receiver_addr);
+        next += gap;
+        std::this_thread::sleep_until(next);
+    }
+    consumer.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    if(!latencies.empty()) {
+        ret.p50_ms = latencies[latencies.size() / 2];
+        ret.p99_ms = latencies[latencies.size() * 99 / 100];
+        ret.max_ms = latencies.back();
+    }
+    return ret;
+}
+
+int main(int argc, const char* argv[]) {
+    const uint64_t seed = argc > 1 ? std::stoull(argv[1]) : 1;
+
+    std::printf("Failure detection (heartbeat every 5 ms, timeout 20 ms, 400 heartbeats)\n");
+    std::printf("%8s %18s %16s\n", "loss", "false suspicions", "detection (ms)");
+    for(const double loss : { 0.0, 0.1, 0.3, 0.5 }) {
+        const auto r = run_detection(loss, milliseconds(5), 400, seed);
+        std::printf("%7.0f%% %18zu %16.1f\n", 100 * loss, r.false_suspicions, r.detection_ms);
+    }
+
+    net::fault_options opts;
+    opts.loss = 0.05;
+    opts.duplicate = 0.05;
+    opts.reorder = 0.05;
+    opts.delay = milliseconds(1);
+    opts.jitter = milliseconds(1);
+    const size_t count = 2000;
+    std::printf("\nDelivery (%zu datagrams every 500 us; 5%% loss, 5%% duplicates, 5%% reordered, 1 ms + 0-1 ms delay)\n", count);
+    std::printf("%8s %10s %11s %10s %9s %9s %9s\n", "side", "delivered", "duplicates", "reordered", "p50 (ms)", "p99 (ms)", "max (ms)");
+    for(const bool on_receive : { false, true }) {
+        const auto r = run_delivery(opts, on_receive, count, microseconds(500), seed);
+        std::printf("%8s %9.1f%% %11zu %10zu %9.2f %9.2f %9.2f\n", on_receive ? "recv" : "send",
+                    100.0 * double(r.delivered) / double(count), r.duplicates, r.reordered, r.p50_ms, r.p99_ms, r.max_ms);
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "../fec.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Measures the throughput of the FEC encoder and decoder, and the delivery ratio of snippets with and without FEC
+ * under independent (Bernoulli) and bursty (Gilbert-Elliott) loss, parity datagrams included.
+ *
+ * Usage: fec_bench [snippets] [snippet size in bytes]
+ */
+struct loss_model {
+    const char* name;
+    double p_good_to_bad;       // Probability of entering the lossy state
+    double p_bad_to_good;       // Probability of leaving it; every datagram sent in the lossy state is lost
+};
+
+/**
+ * Encodes the snippets, tagging each one with the frame id handed out by the encoder.
+ * @return the datagrams in send order, each with a flag telling whether it is a parity datagram.
+ */
+std::vector<std::pair<std::string, bool>> encode(fec_encoder& encoder, size_t count, size_t size) {
+    std::vector<std::pair<std::string, bool>> ret;
+    for(size_t i = 0; i < count; i++) {
+        std::string snippet = "snip" + std::to_string(i + 1) + fec::tag(encoder.next("")) + " ";
+        snippet.resize(size, static_cast<char>('a' + i % 26));
+        auto parities = encoder.add("", snippet);
+        ret.emplace_back(std::move(snippet), false);
+        for(auto& parity : parities)
+            ret.emplace_back(std::move(parity), true);
+    }
+    for(auto& [channel, parity] : encoder.flush())
+        ret.emplace_back(std::move(parity), true);
+    return ret;
+}
+
+/**
+ * Feeds the datagrams that survive the loss model to a decoder.
+ * @return the number of distinct snippets delivered without and with recovery.
+ */
+std::pair<size_t, size_t> deliver(const std::vector<std::pair<std::string, bool>>& datagrams, const loss_model& model, uint64_t seed) {
+    const net::address_v4 sender("127.0.0.1", 5000);
+    std::mt19937_64 rng(seed);
+    std::bernoulli_distribution enter(model.p_good_to_bad), leave(model.p_bad_to_good);
+    bool bad = false;
+    fec_decoder decoder;
+    size_t raw = 0, total = 0;
+    std::vector<std::string> recovered;
+    for(const auto& [datagram, is_parity] : datagrams) {
+        bad = bad ? !leave(rng) : enter(rng);
+        if(bad) continue;
+        if(is_parity) {
+            total += decoder.on_parity(sender, datagram.data() + 4, datagram.size() - 4).size();
+            continue;
+        }
+        const auto token = datagram.substr(4, datagram.find(' ') - 4);
+        const auto frame = fec::untag(token).second;
+        raw++;
+        recovered.clear();
+        if(decoder.on_data(sender, *frame, datagram, recovered))
+            total++;
+        total += recovered.size();
+    }
+    return { raw, total };
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 100000;
+    const size_t size = argc > 2 ? std::stoul(argv[2]) : 512;
+
+    std::printf("Throughput (%zu snippets of %zu bytes, one loss per parity class)\n", count, size);
+    std::printf("%6s %6s %14s %14s\n", "k", "r", "encode MB/s", "decode MB/s");
+    for(const auto& [k, r] : { std::make_pair(8, 1), std::make_pair(8, 2), std::make_pair(16, 4) }) {
+        fec_encoder encoder(k, r);
+        const auto start = steady_clock::now();
+        const auto datagrams = encode(encoder, count, size);
+        const auto encoded = steady_clock::now();
+
+        // Drop the first datagram of every parity class, so every block needs r recoveries
+        const net::address_v4 sender("127.0.0.1", 5000);
+        fec_decoder decoder;
+        std::vector<std::string> recovered;
+        size_t index = 0, delivered = 0;
+        const auto decode_start = steady_clock::now();
+        for(const auto& [datagram, is_parity] : datagrams) {
+            if(is_parity) {
+                delivered += decoder.on_parity(sender, datagram.data() + 4, datagram.size() - 4).size();
+                index = 0;
+                continue;
+            }
+            if(index++ < size_t(r)) continue;
+            const auto frame = fec::untag(datagram.substr(4, datagram.find(' ') - 4)).second;
+            recovered.clear();
+            delivered += decoder.on_data(sender, *frame, datagram, recovered) + recovered.size();
+        }
+        const auto decoded = steady_clock::now();
+        const double megabytes = double(count * size) / 1e6;
+        std::printf("%6d %6d %14.0f %14.0f   (%zu/%zu delivered)\n", k, r,
+                    megabytes / duration<double>(encoded - start).count(),
+                    megabytes / duration<double>(decoded - decode_start).count(), delivered, count);
+    }
+
+    const loss_model models[] = {
+            { "random 1%",  0.01, 1.0 },
+            { "random 5%",  0.05, 1.0 },
+            { "random 10%", 0.10, 1.0 },
+            { "burst 5%",   0.0175, 0.333 },        // Mean burst of 3 datagrams, 5% loss overall
+            { "burst 10%",  0.037, 0.333 },
+    };
+    std::printf("\nDelivery ratio (%zu snippets)\n", count);
+    std::printf("%12s %6s %6s %10s %10s %10s\n", "loss", "k", "r", "overhead", "no FEC", "FEC");
+    for(const auto& model : models) {
+        for(const auto& [k, r] : { std::make_pair(8, 1), std::make_pair(8, 2), std::make_pair(16, 4) }) {
+            fec_encoder encoder(k, r);
+            const auto datagrams = encode(encoder, count, size);
+            const auto [raw, total] = deliver(datagrams, model, 42);
+            std::printf("%12s %6d %6d %9.1f%% %9.2f%% %9.2f%%\n", model.name, k, r, 100.0 * r / k,
+                        100.0 * double(raw) / double(count), 100.0 * double(total) / double(count));
+        }
+    }
+    return 0;
+}
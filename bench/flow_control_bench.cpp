@@ -0,0 +1,106 @@
+#include "../flow_control.hpp"
+#include "../net/udp.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace std::chrono;
+
+/**
+ * Compares unpaced snippet sending with AIMD flow control through a loopback bottleneck: a receiver with a small
+ * socket buffer that spends a fixed amount of time on every message and acknowledges it.
+ *
+ * Usage: flow_control_bench [messages] [receiver cost in us] [receiver buffer in bytes]
+ */
+struct result {
+    size_t delivered;
+    double seconds;
+};
+
+result run(bool paced, size_t count, microseconds cost, int rcvbuf) {
+    net::udp::socket receiver(net::address_v4("127.0.0.1", 0));
+    net::udp::socket sender(net::address_v4("127.0.0.1", 0));
+    receiver.set_option(SOL_SOCKET, SO_RCVBUF, rcvbuf);
+    receiver.set_option(SOL_SOCKET, SO_RCVTIMEO, net::to_timeval(milliseconds(300)));
+    sender.set_option(SOL_SOCKET, SO_RCVTIMEO, net::to_timeval(milliseconds(50)));
+    const net::address_v4 receiver_addr = { "127.0.0.1", receiver.address().port() };
+
+    std::atomic<size_t> delivered = 0;
+    std::atomic<bool> done = false;
+    auto last_delivery = steady_clock::now();
+    std::thread consumer([&] {
+        char data[2048];
+        net::address_v4 from;
+        while(true) {
+            const auto len = receiver.recv_from(net::buffer(data), &from);
+            if(len <= 0) {
+                if(done) break;
+                continue;
+            }
+            const auto until = steady_clock::now() + cost;
+            while(steady_clock::now() < until) {}
+            const std::string message(data, size_t(len));
+            receiver.send_to(net::buffer("sack" + message.substr(4, message.find(' ') - 4)), from);
+            last_delivery = steady_clock::now();
+            delivered++;
+        }
+    });
+
+    const std::string padding(512, 'x');
+    const auto start = steady_clock::now();
+    if(!paced) {
+        for(size_t seq = 0; seq < count; seq++)
+            sender.send_to(net::buffer("snip" + std::to_string(seq) + " " + padding), receiver_addr);
+    } else {
+        flow_options opts;
+        opts.max_queue = count;
+        flow_control flow(opts);
+        std::thread acks([&] {
+            char data[64];
+            net::address_v4 from;
+            while(!done) {
+                const auto len = sender.recv_from(net::buffer(data, sizeof(data) - 1), &from);
+                if(len > 4)
+                    flow.on_ack(from, std::stoull(std::string(data + 4, size_t(len) - 4)));
+            }
+        });
+        // Prime the window with one ACK so the receiver is known to support them
+        flow.enqueue(receiver_addr, count, std::make_shared<const std::string>("snip" + std::to_string(count) + " hello"));
+        flow.pump([&](const auto& addr, const std::string& msg) { sender.send_to(net::buffer(msg), addr); });
+        std::this_thread::sleep_for(milliseconds(20));
+        for(size_t seq = 0; seq < count; seq++)
+            flow.enqueue(receiver_addr, seq, std::make_shared<const std::string>("snip" + std::to_string(seq) + " " + padding));
+        while(flow.queued() > 0) {
+            const auto next = flow.pump([&](const auto& addr, const std::string& msg) {
+                sender.send_to(net::buffer(msg), addr);
+            });
+            std::this_thread::sleep_for(std::clamp(next, steady_clock::duration(microseconds(20)), steady_clock::duration(milliseconds(5))));
+        }
+        const auto stats = flow.stats();
+        std::cout << "  aimd: sent " << stats.sent << ", acked " << stats.acked << ", lost " << stats.lost
+                  << ", final window " << flow.window(receiver_addr) << '\n';
+        done = true;
+        acks.join();
+        delivered--;        // The priming message
+    }
+    done = true;
+    consumer.join();
+    return { delivered, duration<double>(last_delivery - start).count() };
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 20000;
+    const auto cost    = microseconds(argc > 2 ? std::stoul(argv[2]) : 50);
+    const int rcvbuf   = argc > 3 ? std::stoi(argv[3]) : 16384;
+
+    for(const bool paced : { false, true }) {
+        const auto [delivered, seconds] = run(paced, count, cost, rcvbuf);
+        std::cout << (paced ? "aimd paced" : "unpaced") << ": delivered " << delivered << "/" << count
+                  << " (loss " << 100.0 * double(count - delivered) / double(count) << "%) in " << seconds
+                  << " s, goodput " << double(delivered) / seconds << " msg/s\n";
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "../net/udp.hpp"
+
+#include <poll.h>
+#include <ctime>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Compares the plain send path (one sendto per datagram) with segmented sends (UDP GSO), and plain receives with
+ * coalesced receives (UDP GRO), by streaming trains of equal-size datagrams between two sockets on loopback.
+ * Reports the sender throughput, the CPU time spent per megabyte on each side, and the fraction delivered.
+ *
+ * Usage: gso_bench [megabytes per run] [segment size]
+ */
+double thread_cpu() {
+    timespec ts = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+}
+
+struct result {
+    double send_seconds;
+    double send_cpu;
+    double recv_cpu;
+    size_t received;
+    size_t receives;
+};
+
+result run(bool gso, bool gro, size_t total, size_t segment_size, in_port_t port) {
+    const net::address_v4 address("127.0.0.1", port);
+    net::udp::socket receiver(address);
+    receiver.set_option(SOL_SOCKET, SO_RCVBUF, int(8 << 20));
+    if(gro && !receiver.enable_gro())
+        std::fprintf(stderr, "UDP_GRO is not supported, receiving without it\n");
+
+    result ret = {};
+    std::atomic<bool> ready = false;
+    std::thread reader([&] {
+        std::vector<char> buffer(1 << 16);
+        net::address_v4 src;
+        ready = true;
+        const double start = thread_cpu();
+        pollfd pfd = { receiver.handle(), POLLIN, 0 };
+        while(::poll(&pfd, 1, 300) > 0) {
+            size_t segment = 0;
+            const auto len = gro ? receiver.recv_segments(net::buffer(buffer.data(), buffer.size()), MSG_DONTWAIT, &src, segment)
+                                 : receiver.recv_from(net::buffer(buffer.data(), buffer.size()), MSG_DONTWAIT, &src);
+            if(len > 0) {
+                ret.received += size_t(len);
+                ret.receives++;
+            }
+        }
+        ret.recv_cpu = thread_cpu() - start;
+    });
+    while(!ready) std::this_thread::yield();
+
+    net::udp::socket sender(net::address_v4("127.0.0.1", 0));
+    const size_t train = 64 * segment_size;
+    const std::vector<char> payload(train, 'x');
+    const double cpu = thread_cpu();
+    const auto start = steady_clock::now();
+    for(size_t sent = 0; sent < total; sent += train) {
+        if(gso) {
+            sender.send_segments(net::const_buffer(payload.data(), payload.size()), segment_size, address);
+        } else {
+            for(size_t offset = 0; offset < train; offset += segment_size)
+                sender.send_to(net::const_buffer(payload.data() + offset, segment_size), 0, address);
+        }
+    }
+    ret.send_seconds = duration<double>(steady_clock::now() - start).count();
+    ret.send_cpu = thread_cpu() - cpu;
+    reader.join();
+    return ret;
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t total = (argc > 1 ? std::stoul(argv[1]) : 256) << 20;
+    const size_t segment_size = argc > 2 ? std::stoul(argv[2]) : 1400;
+
+    std::printf("%-8s %-10s %12s %16s %16s %10s %14s\n", "send", "receive", "send MB/s", "send CPU us/MB", "recv CPU us/MB", "delivered", "bytes/receive");
+    in_port_t port = 47900;
+    for(const bool gso : { false, true }) {
+        for(const bool gro : { false, true }) {
+            const auto r = run(gso, gro, total, segment_size, port++);
+            const double mb = double(total) / (1 << 20);
+            std::printf("%-8s %-10s %12.1f %16.1f %16.1f %9.1f%% %14.0f\n", gso ? "gso" : "sendto", gro ? "gro" : "recvfrom",
+                        mb / r.send_seconds, r.send_cpu * 1e6 / mb, r.recv_cpu * 1e6 / mb,
+                        100.0 * double(r.received) / double(total), r.receives ? double(r.received) / double(r.receives) : 0.0);
+        }
+    }
+    std::printf("segmentation offload %s\n", net::udp::socket::has_gso() ? "used" : "unavailable, fell back to sendto");
+    return 0;
+}
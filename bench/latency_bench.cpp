@@ -0,0 +1,212 @@
+#include "../peer_manager.hpp"
+#include "../snippet_manager.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Measures the end-to-end latency of snippets: from io_context::put_outgoing on one node to the line printed by the
+ * snippet_manager of every other node. A loopback mesh of nodes runs in this process; the sender queues numbered
+ * snippets at a fixed rate, and the output stream of each receiver timestamps every printed line. The sweep over
+ * message rates and mesh sizes is printed as JSON, with latencies in microseconds.
+ *
+ * Usage: latency_bench [messages per run] [rates, e.g. 1,5,20] [peer counts, e.g. 2,4,8]
+ */
+using clock_type = steady_clock;
+
+/**
+ * An output stream buffer which records the latency of every snippet line printed through it.
+ */
+class latency_sink : public std::streambuf {
+public:
+    latency_sink(const std::vector<clock_type::time_point>& sent, std::vector<long>& latencies, std::mutex& mutex)
+            : m_sent(sent), m_latencies(latencies), m_mutex(mutex) {}
+
+protected:
+    int_type overflow(int_type ch) override {
+        if(ch == traits_type::eof()) return ch;
+        if(ch != '\n') {
+            m_line.push_back(static_cast<char>(ch));
+            return ch;
+        }
+        const auto now = clock_type::now();
+        const auto pos = m_line.find("> lat");
+        if(pos != std::string::npos) {
+            const auto seq = std::stoul(m_line.substr(pos + 5));
+            std::scoped_lock lock(m_mutex);
+            if(seq < m_sent.size())
+                m_latencies.push_back(duration_cast<microseconds>(now - m_sent[seq]).count());
+        }
+        m_line.clear();
+        return ch;
+    }
+
+private:
+    const std::vector<clock_type::time_point>& m_sent;
+    std::vector<long>& m_latencies;
+    std::mutex& m_mutex;
+    std::string m_line;
+};
+
+/**
+ * An input stream buffer with no input, which blocks readers until it is closed, so that the snippet_manager of a
+ * receiver sends nothing.
+ */
+class idle_source : public std::streambuf {
+public:
+    void close() {
+        {
+            std::scoped_lock lock(m_mutex);
+            m_closed = true;
+        }
+        m_cv.notify_all();
+    }
+
+protected:
+    int_type underflow() override {
+        std::unique_lock lock(m_mutex);
+        m_cv.wait(lock, [this] { return m_closed; });
+        return traits_type::eof();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_closed = false;
+};
+
+struct result {
+    size_t peers;
+    double rate;
+    size_t messages;
+    size_t expected;
+    std::vector<long> latencies;
+};
+
+result run(size_t peers, double rate, size_t messages, in_port_t base_port) {
+    result ret = { peers, rate, messages, messages * (peers - 1), {} };
+    std::vector<clock_type::time_point> sent(messages);
+    std::mutex mutex;
+
+    std::unordered_set<net::address_v4> mesh;
+    for(size_t i = 0; i < peers; i++)
+        mesh.emplace("127.0.0.1", static_cast<in_port_t>(base_port + i));
+
+    std::vector<std::unique_ptr<net::io_context>> contexts;
+    std::vector<std::shared_ptr<peer_manager>> nodes;
+    std::vector<std::unique_ptr<latency_sink>> sinks;
+    std::vector<std::unique_ptr<std::ostream>> outputs;
+    std::vector<std::unique_ptr<idle_source>> sources;
+    std::vector<std::unique_ptr<std::istream>> inputs;
+    std::vector<std::shared_ptr<snippet_manager>> interfaces;
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < peers; i++) {
+        const net::address_v4 address("127.0.0.1", static_cast<in_port_t>(base_port + i));
+        auto others = mesh;
+        others.erase(address);
+        contexts.push_back(std::make_unique<net::io_context>());
+        nodes.push_back(std::make_shared<peer_manager>(*contexts.back(), address, others, std::make_shared<shared_state>(address)));
+        threads.emplace_back([node = nodes.back()] { node->run(); });
+        if(i == 0) continue;
+        sinks.push_back(std::make_unique<latency_sink>(sent, ret.latencies, mutex));
+        outputs.push_back(std::make_unique<std::ostream>(sinks.back().get()));
+        sources.push_back(std::make_unique<idle_source>());
+        inputs.push_back(std::make_unique<std::istream>(sources.back().get()));
+        interfaces.push_back(std::make_shared<snippet_manager>(*contexts.back()));
+        interfaces.back()->run(*inputs.back(), *outputs.back());
+    }
+    std::this_thread::sleep_for(milliseconds(200));
+
+    const auto interval = duration_cast<clock_type::duration>(duration<double>(1.0 / rate));
+    auto next = clock_type::now();
+    for(size_t seq = 0; seq < messages; seq++) {
+        std::this_thread::sleep_until(next);
+        {
+            std::scoped_lock lock(mutex);
+            sent[seq] = clock_type::now();
+        }
+        contexts.front()->put_outgoing("lat" + std::to_string(seq));
+        next += interval;
+    }
+    const auto deadline = clock_type::now() + seconds(10) + interval * messages;
+    while(clock_type::now() < deadline) {
+        {
+            std::scoped_lock lock(mutex);
+            if(ret.latencies.size() >= ret.expected) break;
+        }
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    net::udp::socket control(net::address_v4("127.0.0.1", 0));
+    const std::string stop = "stop";
+    for(const auto& addr : mesh)
+        control.send_to(net::buffer(stop), addr);
+    for(auto& thread : threads)
+        thread.join();
+    for(auto& interface : interfaces)
+        interface->close();
+    for(auto& source : sources)
+        source->close();
+    // The detached interface threads share ownership of their snippet_manager, so it is destroyed once both have
+    // returned; until then they still use the streams and contexts of this run
+    const std::vector<std::weak_ptr<snippet_manager>> closing(interfaces.begin(), interfaces.end());
+    interfaces.clear();
+    for(const auto& interface : closing) {
+        while(!interface.expired())
+            std::this_thread::sleep_for(milliseconds(1));
+    }
+    std::scoped_lock lock(mutex);
+    return ret;
+}
+
+long percentile(const std::vector<long>& sorted, double q) {
+    if(sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * double(sorted.size())))];
+}
+
+std::vector<double> parse_list(const std::string& list) {
+    std::vector<double> ret;
+    std::stringstream in(list);
+    for(std::string item; std::getline(in, item, ',');)
+        ret.push_back(std::stod(item));
+    return ret;
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t messages = argc > 1 ? std::stoul(argv[1]) : 20;
+    const auto rates = parse_list(argc > 2 ? argv[2] : "1,5,20");
+    const auto peer_counts = parse_list(argc > 3 ? argv[3] : "2,4,8");
+    std::cerr.setstate(std::ios::failbit);      // Silence the join notices
+
+    in_port_t port = 47600;
+    std::printf("{\n  \"benchmark\": \"snippet_latency\",\n  \"unit\": \"us\",\n  \"results\": [");
+    const char* separator = "\n";
+    for(const auto peers : peer_counts) {
+        for(const auto rate : rates) {
+            auto r = run(static_cast<size_t>(peers), rate, messages, port);
+            port += static_cast<in_port_t>(peers);
+            std::sort(r.latencies.begin(), r.latencies.end());
+            std::printf("%s    { \"peers\": %zu, \"rate\": %g, \"messages\": %zu, \"deliveries\": %zu, \"lost\": %zu, "
+                        "\"p50\": %ld, \"p99\": %ld, \"p99.9\": %ld, \"max\": %ld }",
+                        separator, r.peers, r.rate, r.messages, r.latencies.size(), r.expected - std::min(r.expected, r.latencies.size()),
+                        percentile(r.latencies, 0.5), percentile(r.latencies, 0.99), percentile(r.latencies, 0.999),
+                        r.latencies.empty() ? 0 : r.latencies.back());
+            std::fflush(stdout);
+            separator = ",\n";
+        }
+    }
+    std::printf("\n  ]\n}\n");
+    return 0;
+}
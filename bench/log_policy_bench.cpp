@@ -0,0 +1,68 @@
+#include "../peer_manager.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Measures the rate of 'peer' heartbeats a node handles with each logging policy. A set of client sockets, each one
+ * a distinct peer, floods the node for a fixed time, and the node's statistics give the number of datagrams handled.
+ *
+ * Usage: log_policy_bench [peers] [seconds per run]
+ */
+template<typename Log>
+double run(size_t peers, duration<double> length, in_port_t port) {
+    net::io_context ioc;
+    const net::address_v4 address("127.0.0.1", port);
+    const auto node = std::make_shared<basic_peer_manager<Log>>(ioc, address, std::unordered_set<net::address_v4>{}, std::make_shared<shared_state>(address));
+    std::thread runner([&] { node->run(); });
+    std::this_thread::sleep_for(milliseconds(50));
+
+    std::vector<net::udp::socket> clients;
+    std::vector<std::string> heartbeats;
+    for(size_t i = 0; i < peers; i++) {
+        clients.emplace_back(net::address_v4("127.0.0.1", 0));
+        heartbeats.push_back("peer127.0.0.1:" + std::to_string(clients.back().address().port()));
+    }
+
+    std::atomic<bool> done = false;
+    std::thread load([&] {
+        while(!done) {
+            for(size_t i = 0; i < peers; i++)
+                clients[i].send_to(net::buffer(std::as_const(heartbeats[i])), address);
+        }
+    });
+    const auto start = steady_clock::now();
+    std::this_thread::sleep_for(length);
+    done = true;
+    load.join();
+    const auto elapsed = duration<double>(steady_clock::now() - start).count();
+
+    uint64_t datagrams = 0;
+    for(const auto& row : node->stats().rows())
+        datagrams += row[peer_stats::counter::messages_in];
+    clients.front().send_to(net::buffer(std::string("stop")), address);
+    runner.join();
+    return double(datagrams) / elapsed;
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t peers = argc > 1 ? std::stoul(argv[1]) : 64;
+    const duration<double> length(argc > 2 ? std::stod(argv[2]) : 2.0);
+    std::cerr.setstate(std::ios::failbit);      // Silence the join notices
+
+    std::printf("%zu peers, %.1f s per run\n", peers, length.count());
+    std::printf("%12s %16s\n", "policy", "datagrams/s");
+    std::printf("%12s %16.0f\n", "full", run<log_policy::full>(peers, length, 47500));
+    std::printf("%12s %16.0f\n", "sampled/64", run<log_policy::sampled<64>>(peers, length, 47501));
+    std::printf("%12s %16.0f\n", "counting", run<log_policy::counting>(peers, length, 47502));
+    std::printf("%12s %16.0f\n", "none", run<log_policy::none>(peers, length, 47503));
+    return 0;
+}
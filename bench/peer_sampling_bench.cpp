@@ -0,0 +1,140 @@
+#include "../net/udp.hpp"
+#include "../peer_sampling.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Runs a cluster of Cyclon partial views exchanging shuffles over loopback UDP, and reports the in-degree
+ * distribution and connectivity of the resulting overlay. Halfway through, a fraction of the nodes is killed to
+ * show how quickly dead descriptors disappear from the views.
+ *
+ * Usage: peer_sampling_bench [nodes] [rounds] [view size] [fraction killed]
+ */
+struct node {
+    net::udp::socket sock;
+    std::unique_ptr<partial_view> view;
+    bool alive = true;
+};
+
+/**
+ * Counts how many nodes can be reached from the first live node by following view edges (or reversed edges).
+ */
+size_t reachable(const std::vector<node>& nodes, const std::unordered_map<in_port_t, size_t>& ids, bool reverse) {
+    std::vector<std::vector<size_t>> edges(nodes.size());
+    for(size_t i = 0; i < nodes.size(); i++) {
+        if(!nodes[i].alive) continue;
+        for(const auto& peer : nodes[i].view->peers()) {
+            const size_t j = ids.at(peer.port());
+            if(!nodes[j].alive) continue;
+            reverse ? edges[j].push_back(i) : edges[i].push_back(j);
+        }
+    }
+    size_t start = 0;
+    while(!nodes[start].alive) start++;
+    std::vector<bool> seen(nodes.size());
+    std::queue<size_t> queue;
+    queue.push(start);
+    seen[start] = true;
+    size_t count = 0;
+    while(!queue.empty()) {
+        const size_t i = queue.front();
+        queue.pop();
+        count++;
+        for(const size_t j : edges[i])
+            if(!seen[j]) { seen[j] = true; queue.push(j); }
+    }
+    return count;
+}
+
+void report(size_t round, const std::vector<node>& nodes, const std::unordered_map<in_port_t, size_t>& ids) {
+    std::vector<size_t> in_degree(nodes.size());
+    size_t live = 0, links = 0, dead_links = 0;
+    for(const auto& n : nodes) {
+        if(!n.alive) continue;
+        live++;
+        for(const auto& peer : n.view->peers()) {
+            const size_t j = ids.at(peer.port());
+            links++;
+            if(nodes[j].alive) in_degree[j]++;
+            else dead_links++;
+        }
+    }
+    double mean = 0, var = 0;
+    size_t lo = SIZE_MAX, hi = 0;
+    for(size_t i = 0; i < nodes.size(); i++) {
+        if(!nodes[i].alive) continue;
+        mean += double(in_degree[i]) / live;
+        lo = std::min(lo, in_degree[i]);
+        hi = std::max(hi, in_degree[i]);
+    }
+    for(size_t i = 0; i < nodes.size(); i++)
+        if(nodes[i].alive) var += (in_degree[i] - mean) * (in_degree[i] - mean) / live;
+    std::cout << "round " << round << ": live " << live << ", in-degree mean " << mean << " stddev " << std::sqrt(var)
+              << " min " << lo << " max " << hi << ", dead links " << dead_links << "/" << links
+              << ", reachable " << reachable(nodes, ids, false) << " (reverse " << reachable(nodes, ids, true) << ")\n";
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t num_nodes = argc > 1 ? std::stoul(argv[1]) : 200;
+    const size_t rounds    = argc > 2 ? std::stoul(argv[2]) : 60;
+    const size_t view_size = argc > 3 ? std::stoul(argv[3]) : partial_view::DEFAULT_CAPACITY;
+    const double killed    = argc > 4 ? std::stod(argv[4]) : 0.2;
+
+    std::vector<node> nodes(num_nodes);
+    std::unordered_map<in_port_t, size_t> ids;
+    for(size_t i = 0; i < num_nodes; i++) {
+        nodes[i].sock = net::udp::socket(net::address_v4("127.0.0.1", 0));
+        nodes[i].sock.set_non_blocking();
+        const net::address_v4 self = { "127.0.0.1", nodes[i].sock.address().port() };
+        nodes[i].view = std::make_unique<partial_view>(self, view_size, partial_view::DEFAULT_SHUFFLE_LENGTH, i);
+        ids[self.port()] = i;
+    }
+    // Bootstrap as a ring with a few random chords, the worst case for a random overlay
+    for(size_t i = 0; i < num_nodes; i++) {
+        nodes[i].view->add(nodes[(i + 1) % num_nodes].view->self());
+        nodes[i].view->add(nodes[(i * 7 + 3) % num_nodes].view->self());
+    }
+
+    char data[65536];
+    for(size_t round = 1; round <= rounds; round++) {
+        if(round == rounds / 2) {
+            for(size_t i = 0; i < num_nodes * killed; i++) {
+                nodes[(i * 5) % num_nodes].alive = false;
+                nodes[(i * 5) % num_nodes].sock.close();
+            }
+            std::cout << "killed " << size_t(num_nodes * killed) << " nodes\n";
+        }
+        for(auto& n : nodes) {
+            if(!n.alive) continue;
+            if(const auto request = n.view->begin_shuffle())
+                n.sock.send_to(net::buffer("shuf" + partial_view::encode(request->second)), request->first);
+        }
+        for(bool busy = true; busy;) {
+            busy = false;
+            for(auto& n : nodes) {
+                if(!n.alive) continue;
+                net::address_v4 sender;
+                for(ssize_t len; (len = n.sock.recv_from(net::buffer(data, sizeof(data) - 1), &sender)) > 0;) {
+                    busy = true;
+                    const std::string message(data, size_t(len));
+                    const auto entries = partial_view::decode(message.substr(4));
+                    if(message.compare(0, 4, "shuf") == 0) {
+                        const auto reply = n.view->on_request(sender, entries);
+                        n.sock.send_to(net::buffer("shrp" + partial_view::encode(reply)), sender);
+                    } else {
+                        n.view->on_reply(entries);
+                    }
+                }
+            }
+        }
+        if(round == 1 || round % 10 == 0 || round == rounds / 2 + 1)
+            report(round, nodes, ids);
+    }
+    return 0;
+}
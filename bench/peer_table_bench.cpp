@@ -0,0 +1,101 @@
+#include "../peer_manager.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace std::chrono;
+
+/**
+ * Floods a node with 'peer' heartbeats from a local generator and reports the size of its peer table and the
+ * resident memory of the process as the flood goes on, with and without a bounded peer table and with both log
+ * policies:
+ *     - announcements: heartbeats from one socket advertising a different random address every time, as spoofed
+ *          announcements would;
+ *     - churn: heartbeats from a steady stream of new sockets, each bound to its own loopback address.
+ * With the counting policy the node counts events instead of logging them, so that the numbers only show the per-peer
+ * state; with the full policy they also include the peer log, which the bound applies to as well.
+ *
+ * Usage: peer_table_bench [heartbeats per phase] [capacity]
+ */
+double rss_mb() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return double(resident) * double(::sysconf(_SC_PAGESIZE)) / (1 << 20);
+}
+
+std::string random_address(std::mt19937& rng) {
+    return "10." + std::to_string(rng() % 256) + '.' + std::to_string(rng() % 256) + '.' + std::to_string(rng() % 256) + ':'
+           + std::to_string(1024 + rng() % 60000);
+}
+
+void report(const char* policy, const char* config, const char* phase, size_t sent, const shared_state& state) {
+    std::printf("%-9s %-16s %-14s %10zu %10zu %10lu %10lu %10.1f\n", policy, config, phase, sent, state.copy_peers().size(),
+                static_cast<unsigned long>(state.evictions()), static_cast<unsigned long>(state.rejected()), rss_mb());
+    std::fflush(stdout);
+}
+
+template<typename Log>
+void run(const char* policy, const char* config, size_t capacity, bool verify, size_t heartbeats, in_port_t port) {
+    const net::address_v4 address("127.0.0.1", port);
+    net::io_context ioc;
+    auto state = std::make_shared<shared_state>(address);
+    auto node = std::make_shared<basic_peer_manager<Log>>(ioc, address, std::unordered_set<net::address_v4>{}, state);
+    if(capacity)
+        node->limit_peers(capacity, verify);
+    std::thread thread([node] { node->run(); });
+    std::this_thread::sleep_for(milliseconds(100));
+    report(policy, config, "start", 0, *state);
+    const size_t report_every = std::max<size_t>(1, heartbeats / 4);
+
+    std::mt19937 rng(7);
+    net::udp::socket generator(net::address_v4("127.0.0.1", 0));
+    for(size_t i = 1; i <= heartbeats; i++) {
+        const std::string heartbeat = "peer" + random_address(rng) + "@0";
+        generator.send_to(net::buffer(heartbeat), address);
+        if(i % 256 == 0) std::this_thread::sleep_for(microseconds(500));
+        if(i % report_every == 0) {
+            std::this_thread::sleep_for(milliseconds(50));
+            report(policy, config, "announcements", i, *state);
+        }
+    }
+
+    for(size_t i = 1; i <= heartbeats; i++) {
+        const net::address_v4 source("127." + std::to_string(1 + i / 65536 % 254) + '.' + std::to_string(i / 256 % 256) + '.'
+                                     + std::to_string(1 + i % 254), 0);
+        net::udp::socket sock(source);
+        const std::string heartbeat = "peer" + sock.address().to_string() + "@0";
+        sock.send_to(net::buffer(heartbeat), address);
+        if(i % 256 == 0) std::this_thread::sleep_for(microseconds(500));
+        if(i % report_every == 0) {
+            std::this_thread::sleep_for(milliseconds(50));
+            report(policy, config, "churn", i, *state);
+        }
+    }
+
+    const std::string stop = "stop";
+    generator.send_to(net::buffer(stop), address);
+    thread.join();
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t heartbeats = argc > 1 ? std::stoul(argv[1]) : 40000;
+    const size_t capacity = argc > 2 ? std::stoul(argv[2]) : 256;
+    std::cerr.setstate(std::ios::failbit);      // Silence the join notices
+
+    std::printf("%-9s %-16s %-14s %10s %10s %10s %10s %10s\n", "log", "config", "phase", "sent", "peers", "evicted", "rejected", "RSS MB");
+    run<log_policy::counting>("counting", "unbounded", 0, false, heartbeats, 48300);
+    run<log_policy::counting>("counting", "bounded", capacity, false, heartbeats, 48301);
+    run<log_policy::counting>("counting", "bounded+verified", capacity, true, heartbeats, 48302);
+    run<log_policy::full>("full", "unbounded", 0, false, heartbeats, 48303);
+    run<log_policy::full>("full", "bounded", capacity, false, heartbeats, 48304);
+    run<log_policy::full>("full", "bounded+verified", capacity, true, heartbeats, 48305);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "../search_index.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Benchmarks the indexing throughput and query latency of the snippet search index.
+ *
+ * Usage: search_bench [number of snippets] [number of queries]
+ */
+int main(int argc, const char* argv[]) {
+    const size_t num_snippets = argc > 1 ? std::stoul(argv[1]) : 2'000'000;
+    const size_t num_queries  = argc > 2 ? std::stoul(argv[2]) : 200;
+
+    // Zipf-like vocabulary so a few terms are very common and most are rare
+    std::mt19937_64 rng(42);
+    std::vector<std::string> vocabulary;
+    for(size_t i = 0; i < 20000; i++)
+        vocabulary.push_back("w" + std::to_string(i));
+    std::vector<double> weights(vocabulary.size());
+    for(size_t i = 0; i < weights.size(); i++)
+        weights[i] = 1.0 / double(i + 1);
+    std::discrete_distribution<size_t> word(weights.begin(), weights.end());
+    std::uniform_int_distribution<size_t> length(3, 16), peer(0, 63);
+
+    std::vector<std::string> senders;
+    for(size_t i = 0; i < 64; i++)
+        senders.push_back("10.0.0." + std::to_string(i) + ":" + std::to_string(50000 + i));
+    std::vector<std::string> messages(num_snippets);
+    size_t text_bytes = 0;
+    for(auto& message : messages) {
+        for(size_t n = length(rng); n > 0; n--)
+            message += vocabulary[word(rng)] + ' ';
+        text_bytes += message.size();
+    }
+
+    search_index index;
+    const auto start = steady_clock::now();
+    for(size_t i = 0; i < num_snippets; i++)
+        index.add(i, senders[peer(rng)], messages[i]);
+    const double seconds = duration<double>(steady_clock::now() - start).count();
+    std::cout << "indexed " << num_snippets << " snippets in " << seconds << " s: "
+              << num_snippets / seconds << " snippets/s, " << text_bytes / seconds / 1e6 << " MB/s\n"
+              << "terms " << index.term_count() << ", posting bytes " << index.posting_bytes()
+              << " (" << double(index.posting_bytes()) / double(text_bytes) << " of text)\n";
+
+    const auto run = [&](const std::string& name, const auto& make_query) {
+        std::vector<double> latencies;
+        size_t hits = 0;
+        for(size_t i = 0; i < num_queries; i++) {
+            const search_query query = make_query();
+            const auto begin = steady_clock::now();
+            hits += index.search(query).size();
+            latencies.push_back(duration<double, std::micro>(steady_clock::now() - begin).count());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << name << ": p50 " << latencies[latencies.size() / 2] << " us, p99 "
+                  << latencies[latencies.size() * 99 / 100] << " us, avg hits " << double(hits) / num_queries << '\n';
+    };
+
+    std::uniform_int_distribution<size_t> rare(1000, vocabulary.size() - 1), common(0, 20);
+    run("rare term", [&] { search_query q; q.terms = { vocabulary[rare(rng)] }; return q; });
+    run("common term", [&] { search_query q; q.terms = { vocabulary[common(rng)] }; return q; });
+    run("common AND rare", [&] {
+        search_query q; q.terms = { vocabulary[common(rng)], vocabulary[rare(rng)] }; return q;
+    });
+    run("phrase", [&] {
+        search_query q; q.phrases = { { vocabulary[common(rng)], vocabulary[common(rng)] } }; return q;
+    });
+    run("term + sender + time", [&] {
+        search_query q;
+        q.terms = { vocabulary[common(rng)] };
+        q.sender = senders[peer(rng)];
+        q.from = num_snippets / 2;
+        q.to = num_snippets / 2 + num_snippets / 10;
+        return q;
+    });
+    return 0;
+}
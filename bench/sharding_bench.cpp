@@ -0,0 +1,93 @@
+#include "../sharded_peer_manager.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Measures how the number of 'peer' datagrams a sharded node handles per second scales with its number of shards.
+ * A set of client sockets, each one a distinct peer, floods the node with heartbeats for a fixed time.
+ *
+ * Usage: sharding_bench [peers] [seconds per run] [max shards]
+ */
+struct result {
+    double datagrams_per_second;
+    size_t peers;
+    double forwarded_ratio;
+};
+
+result run(size_t shards, size_t peers, duration<double> length, in_port_t port) {
+    net::io_context ioc;
+    const net::address_v4 address("127.0.0.1", port);
+    const auto node = std::make_shared<sharded_peer_manager>(ioc, address, std::unordered_set<net::address_v4>{}, address, shards);
+    std::atomic<bool> stopped = false;
+    std::thread runner([&] { node->run(); stopped = true; });
+    std::this_thread::sleep_for(milliseconds(50));
+
+    std::vector<net::udp::socket> clients;
+    std::vector<std::string> heartbeats;
+    for(size_t i = 0; i < peers; i++) {
+        clients.emplace_back(net::address_v4("127.0.0.1", 0));
+        heartbeats.push_back("peer127.0.0.1:" + std::to_string(clients.back().address().port()));
+    }
+
+    std::atomic<bool> done = false;
+    std::vector<std::thread> load;
+    const size_t generators = std::max(1u, std::thread::hardware_concurrency() / 2);
+    for(size_t g = 0; g < generators; g++) {
+        load.emplace_back([&, g] {
+            while(!done) {
+                for(size_t i = g; i < peers; i += generators)
+                    clients[i].send_to(net::buffer(std::as_const(heartbeats[i])), address);
+            }
+        });
+    }
+    const auto start = steady_clock::now();
+    std::this_thread::sleep_for(length);
+    done = true;
+    for(auto& thread : load)
+        thread.join();
+    const auto elapsed = duration<double>(steady_clock::now() - start).count();
+
+    result ret = {};
+    uint64_t datagrams = 0, forwarded = 0;
+    for(size_t id = 0; id < node->shard_count(); id++) {
+        const auto stats = node->stats(id);
+        datagrams += stats.datagrams;
+        forwarded += stats.forwarded;
+        ret.peers += stats.peers;
+    }
+    // The socket buffers may still be full of heartbeats, which drops the first 'stop'
+    while(!stopped) {
+        clients.front().send_to(net::buffer(std::string("stop")), address);
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    runner.join();
+    ret.datagrams_per_second = double(datagrams) / elapsed;
+    ret.forwarded_ratio = datagrams == 0 ? 0 : double(forwarded) / double(datagrams);
+    return ret;
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t peers = argc > 1 ? std::stoul(argv[1]) : 256;
+    const duration<double> length(argc > 2 ? std::stod(argv[2]) : 2.0);
+    const size_t max_shards = argc > 3 ? std::stoul(argv[3]) : std::max(2u, std::thread::hardware_concurrency());
+    std::cerr.setstate(std::ios::failbit);      // Silence the join notices
+
+    std::printf("%u hardware threads, %zu peers, %.1f s per run\n", std::thread::hardware_concurrency(), peers, length.count());
+    std::printf("%8s %16s %16s %8s %10s\n", "shards", "datagrams/s", "per shard", "peers", "forwarded");
+    in_port_t port = 47400;
+    for(size_t shards = 1; shards <= max_shards; shards *= 2) {
+        const auto r = run(shards, peers, length, port++);
+        std::printf("%8zu %16.0f %16.0f %8zu %9.0f%%\n", shards, r.datagrams_per_second,
+                    r.datagrams_per_second / double(shards), r.peers, 100 * r.forwarded_ratio);
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "../virtual_peers.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Hosts many virtual peers on loopback, each knowing its next few neighbours on a ring, and reports the memory and
+ * threads they cost and how fast a snippet floods through them.
+ *
+ * Usage: virtual_peers_bench [identities] [neighbours] [reactor threads] [snippets]
+ */
+size_t resident_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+size_t thread_count() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)) {
+        if(line.rfind("Threads:", 0) == 0)
+            return std::stoul(line.substr(8));
+    }
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 500;
+    const size_t neighbours = argc > 2 ? std::stoul(argv[2]) : 4;
+    const size_t threads = argc > 3 ? std::stoul(argv[3]) : 2;
+    const size_t snippets = argc > 4 ? std::stoul(argv[4]) : 20;
+    constexpr in_port_t BASE_PORT = 48000;
+
+    virtual_host host(threads);
+    std::atomic<size_t> delivered = 0;
+    host.on_snippet([&](virtual_peer&, const net::address_v4&, size_t, const std::string&) { delivered++; });
+
+    const auto before = resident_bytes();
+    const net::address_v4 registry("127.0.0.1", BASE_PORT - 1);
+    std::vector<std::shared_ptr<virtual_peer>> peers;
+    for(size_t i = 0; i < count; i++) {
+        std::unordered_set<net::address_v4> known;
+        for(size_t j = 1; j <= neighbours; j++)
+            known.emplace("127.0.0.1", static_cast<in_port_t>(BASE_PORT + (i + j) % count));
+        peers.push_back(host.add({ "127.0.0.1", static_cast<in_port_t>(BASE_PORT + i) }, registry, known));
+    }
+
+    std::thread reactor([&] { host.run(); });
+    std::this_thread::sleep_for(milliseconds(500));         // First keep-alive sweep
+    const auto after = resident_bytes();
+
+    size_t links = 0;
+    for(const auto& peer : peers)
+        links += peer->peer_count();
+
+    size_t expected = 0;
+    for(size_t i = 0; i < snippets; i++)
+        expected += peers[i % count]->peer_count();
+    const auto start = steady_clock::now();
+    for(size_t i = 0; i < snippets; i++)
+        peers[i % count]->send_snippet("bench" + std::to_string(i));
+    while(delivered < expected && steady_clock::now() - start < seconds(5))
+        std::this_thread::sleep_for(microseconds(100));
+    const auto elapsed = duration<double>(steady_clock::now() - start).count();
+
+    std::printf("%zu identities, %zu neighbours each, %zu reactor threads\n", count, neighbours, host.threads());
+    std::printf("process threads:        %zu\n", thread_count());
+    std::printf("resident per identity:  %.1f KB\n", double(after - before) / 1024.0 / double(count));
+    std::printf("peer links:             %zu\n", links);
+    std::printf("interned strings:       %zu\n", host.names().size());
+    std::printf("snippets delivered:     %zu / %zu in %.1f ms\n", delivered.load(), expected, 1000 * elapsed);
+
+    host.stop();
+    reactor.join();
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "../outgoing_log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+/**
+ * Measures the commit latency and throughput of the outgoing log at each durability level, with one or more threads
+ * appending snippets at once, and checks that unacknowledged snippets are recovered after reopening the log.
+ * The log is written in the current directory unless a path is given; use a real disk, not a tmpfs, for
+ * meaningful flush costs.
+ *
+ * Usage: wal_bench [appends per thread] [log path]
+ */
+struct result {
+    double seconds;
+    std::vector<long> latencies;        // Microseconds
+    wal_stats stats;
+};
+
+result run(durability level, size_t threads, size_t appends, const std::string& path) {
+    std::remove(path.c_str());
+    wal_options opts;
+    opts.path = path;
+    opts.level = level;
+    outgoing_log log(opts);
+    const std::string snippet(128, 's');
+    std::vector<std::vector<long>> latencies(threads);
+    std::vector<std::thread> writers;
+    const auto start = steady_clock::now();
+    for(size_t t = 0; t < threads; t++) {
+        writers.emplace_back([&, t] {
+            for(size_t i = 0; i < appends; i++) {
+                const auto before = steady_clock::now();
+                const auto seq = log.append(snippet);
+                latencies[t].push_back(duration_cast<microseconds>(steady_clock::now() - before).count());
+                log.acknowledge(seq);
+            }
+        });
+    }
+    for(auto& writer : writers)
+        writer.join();
+    result ret = { duration<double>(steady_clock::now() - start).count(), {}, log.stats() };
+    for(const auto& l : latencies)
+        ret.latencies.insert(ret.latencies.end(), l.begin(), l.end());
+    std::sort(ret.latencies.begin(), ret.latencies.end());
+    return ret;
+}
+
+long percentile(const std::vector<long>& sorted, double q) {
+    if(sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * double(sorted.size())))];
+}
+
+bool check_recovery(const std::string& path) {
+    std::remove(path.c_str());
+    wal_options opts;
+    opts.path = path;
+    {
+        outgoing_log log(opts);
+        for(int i = 0; i < 100; i++) {
+            const auto seq = log.append("snippet " + std::to_string(i));
+            if(i % 5 != 0)
+                log.acknowledge(seq);
+        }
+    }
+    outgoing_log log(opts);
+    const auto& recovered = log.recovered();
+    if(recovered.size() != 20) return false;
+    for(size_t i = 0; i < recovered.size(); i++)
+        if(recovered[i].second != "snippet " + std::to_string(i * 5)) return false;
+    return true;
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t appends = argc > 1 ? std::stoul(argv[1]) : 2000;
+    const std::string path = argc > 2 ? argv[2] : "wal_bench.wal";
+
+    std::printf("recovery: %s\n", check_recovery(path) ? "ok" : "FAILED");
+    std::printf("%-9s %8s %14s %10s %10s %10s %14s\n", "level", "threads", "appends/s", "p50 us", "p99 us", "max us", "appends/sync");
+    for(const auto level : { durability::none, durability::interval, durability::commit }) {
+        for(const size_t threads : { 1, 4 }) {
+            const auto r = run(level, threads, appends, path);
+            std::printf("%-9s %8zu %14.0f %10ld %10ld %10ld %14.1f\n",
+                        level == durability::none ? "none" : level == durability::interval ? "interval" : "commit", threads,
+                        double(r.latencies.size()) / r.seconds, percentile(r.latencies, 0.5), percentile(r.latencies, 0.99),
+                        r.latencies.empty() ? 0 : r.latencies.back(),
+                        r.stats.syncs ? double(r.stats.appends) / double(r.stats.syncs) : 0.0);
+        }
+    }
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,134 @@
+#ifndef BUSY_POLL_HPP
+#define BUSY_POLL_HPP
+
+#include "net/buffer.hpp"
+#include "net/udp.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+
+/**
+ * Configuration of the spin-then-block receive mode.
+ */
+struct spin_options {
+    // Longest spin before blocking. Spinning only pays off when the sender runs on another core, so it is off by
+    // default on single-core machines.
+    std::chrono::microseconds max_budget = std::chrono::microseconds(std::thread::hardware_concurrency() > 1 ? 200 : 0);
+    bool kernel = false;        // Let the kernel busy-poll the device queue (SO_BUSY_POLL) instead of spinning in user space
+};
+
+
+/**
+ * Receives datagrams by polling the socket for a while before parking in a blocking recvfrom, which avoids the
+ * wakeup latency of the blocking call when the next datagram arrives soon.
+ *
+ * The spin budget adapts to the recent arrival rate: it is twice the moving average of the gap between datagrams,
+ * which catches most arrivals of a steady stream, and drops to zero as soon as that exceeds the maximum budget, so
+ * an idle node blocks right away and burns no CPU. With the kernel mode, the budget is handed to SO_BUSY_POLL
+ * instead, which polls the device queue from the blocking call (raising it above net.core.busy_read needs
+ * CAP_NET_ADMIN). The kernel budget is rounded up to a power of two and updated at most every KERNEL_UPDATE_INTERVAL,
+ * so the moving average does not cost a setsockopt per datagram.
+ */
+class adaptive_receiver {
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    static constexpr auto KERNEL_UPDATE_INTERVAL = std::chrono::milliseconds(50);
+
+    struct statistics {
+        uint64_t spin_hits      = 0;    // Datagrams received while spinning
+        uint64_t blocked        = 0;    // Datagrams received from a blocking call
+        uint64_t kernel_updates = 0;    // SO_BUSY_POLL changes
+    };
+
+    explicit adaptive_receiver(spin_options opts = {})
+            : m_options(opts), m_gap(opts.max_budget), m_last_arrival(clock_type::now()) {}
+
+    /**
+     * Receives a datagram, spinning for the current budget before blocking.
+     * @param sock the socket to receive from.
+     * @param payload the buffer to receive into.
+     * @param sender the address of the sender of the datagram.
+     * @return the size of the datagram, or -1 on error.
+     */
+    ssize_t recv_from(const net::udp::socket& sock, const net::mutable_buffer& payload, net::address_v4* sender) {
+        const auto budget = this->budget();
+        ssize_t len = -1;
+        if(m_options.kernel) {
+            const auto target = quantize(budget);
+            if(target != m_kernel_budget && !m_kernel_failed && m_last_arrival - m_kernel_update >= KERNEL_UPDATE_INTERVAL) {
+                m_kernel_failed = !set_kernel_budget(sock, target);
+                m_kernel_budget = target;
+                m_kernel_update = m_last_arrival;
+                m_stats.kernel_updates++;
+            }
+        } else if(budget.count() > 0) {
+            const auto deadline = clock_type::now() + budget;
+            do {
+                len = sock.recv_from(payload, MSG_DONTWAIT, sender);
+            } while(len < 0 && clock_type::now() < deadline);
+        }
+        if(len >= 0) {
+            m_stats.spin_hits++;
+        } else {
+            len = sock.recv_from(payload, 0, sender);
+            m_stats.blocked++;
+        }
+        observe_arrival();
+        return len;
+    }
+
+    /**
+     * Gets the current spin budget.
+     * @return the time to poll before blocking.
+     */
+    [[nodiscard]] std::chrono::microseconds budget() const noexcept {
+        if(2 * m_gap > m_options.max_budget) return std::chrono::microseconds(0);
+        return 2 * m_gap;
+    }
+
+    [[nodiscard]] const statistics& stats() const noexcept { return m_stats; }
+
+private:
+    void observe_arrival() {
+        const auto now = clock_type::now();
+        const auto gap = std::chrono::duration_cast<std::chrono::microseconds>(now - m_last_arrival);
+        m_last_arrival = now;
+        // Cap the sample so a single long idle period does not take many datagrams to forget
+        const auto sample = std::min(gap, 4 * m_options.max_budget);
+        m_gap = (7 * m_gap + sample) / 8;
+    }
+
+    /**
+     * Rounds a kernel budget up to a power of two microseconds, at most the maximum budget.
+     */
+    [[nodiscard]] std::chrono::microseconds quantize(std::chrono::microseconds budget) const noexcept {
+        if(budget.count() <= 0) return budget;
+        std::chrono::microseconds ret(1);
+        while(ret < budget)
+            ret *= 2;
+        return std::min(ret, m_options.max_budget);
+    }
+
+    static bool set_kernel_budget(const net::udp::socket& sock, std::chrono::microseconds budget) {
+        if(sock.set_option(SOL_SOCKET, SO_BUSY_POLL, static_cast<int>(budget.count())))
+            return true;
+        std::cerr << "Failed to set SO_BUSY_POLL: " << sock.last_error_str() << std::endl;
+        return false;
+    }
+
+    const spin_options m_options;
+
+    std::chrono::microseconds m_gap;
+    std::chrono::microseconds m_kernel_budget = std::chrono::microseconds(0);
+    bool m_kernel_failed = false;
+    clock_type::time_point m_kernel_update;
+    clock_type::time_point m_last_arrival;
+    statistics m_stats;
+};
+
+#endif //BUSY_POLL_HPP
@@ -0,0 +1,202 @@
+#ifndef CHANNELS_HPP
+#define CHANNELS_HPP
+
+#include "net/socket_address.hpp"
+
+#include "utils.hpp"
+
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+
+/**
+ * Helpers for the channel tags carried by snippets and heartbeats.
+ *
+ * A channel is attached to the first token of a message with a '#', e.g. "snip12#ops text" or
+ * "peer10.0.0.1:5000#ops,dev". Messages without a tag belong to the default channel, which every peer receives,
+ * so nodes that do not use channels keep exchanging the original protocol.
+ */
+namespace channels {
+
+constexpr char TAG = '#';
+constexpr size_t MAX_NAME_SIZE = 32;
+
+/**
+ * Checks if a string is a valid channel name (1-32 characters of [a-z0-9_-]).
+ * @param name the channel name.
+ * @return true if the name is valid, false otherwise.
+ */
+bool is_valid(const std::string& name) {
+    return !name.empty() && name.size() <= MAX_NAME_SIZE && std::all_of(name.begin(), name.end(), [](char c) {
+        return std::islower(static_cast<unsigned char>(c)) || std::isdigit(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+    });
+}
+
+/**
+ * Splits a channel tag off a token, e.g. "12#ops" becomes { "12", "ops" }.
+ * @param token the token to split.
+ * @return a pair of the untagged token and the channel name (empty for the default channel).
+ */
+std::pair<std::string, std::string> untag(const std::string& token) {
+    const auto pos = token.find(TAG);
+    if(pos == std::string::npos) return { token, "" };
+    return { token.substr(0, pos), token.substr(pos + 1) };
+}
+
+/**
+ * Splits a leading "#channel " off a line typed by the user.
+ * @param line the typed line.
+ * @return a pair of the channel name (empty for the default channel) and the rest of the line.
+ */
+std::pair<std::string, std::string> parse_outgoing(const std::string& line) {
+    if(line.empty() || line.front() != TAG) return { "", line };
+    const auto pos = line.find(' ');
+    const auto name = line.substr(1, pos == std::string::npos ? std::string::npos : pos - 1);
+    if(!is_valid(name)) return { "", line };
+    return { name, pos == std::string::npos ? "" : line.substr(pos + 1) };
+}
+
+} // channels
+
+
+/**
+ * Keeps track of which channels this node and its peers are subscribed to.
+ *
+ * Peers advertise their subscriptions in heartbeats. The index maps every channel to the peers subscribed to it,
+ * so a snippet on a channel is only sent to its subscribers, plus the "open" peers that never advertised any
+ * subscription (and therefore receive everything). The cost of a send is proportional to the number of
+ * interested peers rather than the size of the peer table.
+ */
+class channel_index {
+public:
+    using peer_type = net::address_v4;
+    using channel_set = std::unordered_set<std::string>;
+
+    /**
+     * Subscribes this node to a channel. A node without subscriptions receives every channel.
+     * @param channel the channel name.
+     */
+    void subscribe(const std::string& channel) {
+        std::unique_lock lock(m_mutex);
+        if(channels::is_valid(channel))
+            m_local.insert(channel);
+    }
+
+    /**
+     * Checks if this node wants snippets from a channel.
+     * @param channel the channel name (empty for the default channel).
+     * @return true if the snippets should be delivered, false otherwise.
+     */
+    [[nodiscard]] bool is_subscribed(const std::string& channel) const {
+        std::shared_lock lock(m_mutex);
+        return channel.empty() || m_local.empty() || m_local.count(channel) != 0;
+    }
+
+    /**
+     * Gets the heartbeat tag advertising the subscriptions of this node (e.g. "#ops,dev").
+     * @return the tag, or an empty string if this node receives every channel.
+     */
+    [[nodiscard]] std::string advertisement() const {
+        std::shared_lock lock(m_mutex);
+        std::string ret;
+        for(const auto& channel : m_local)
+            ret += (ret.empty() ? std::string(1, channels::TAG) : ",") + channel;
+        return ret;
+    }
+
+    /**
+     * Records the subscriptions advertised by a peer, replacing the previous ones.
+     * @param peer the peer.
+     * @param tag the comma-separated channel list of its heartbeat (empty if it receives every channel).
+     */
+    void advertise(const peer_type& peer, const std::string& tag) {
+        channel_set subscriptions;
+        for(size_t begin = 0; begin < tag.size();) {
+            const auto end = std::min(tag.find(',', begin), tag.size());
+            const auto name = tag.substr(begin, end - begin);
+            if(channels::is_valid(name))
+                subscriptions.insert(name);
+            begin = end + 1;
+        }
+        {
+            std::shared_lock lock(m_mutex);
+            const auto it = m_peers.find(peer);
+            if(it != m_peers.end() && it->second == subscriptions) return;
+        }
+        std::unique_lock lock(m_mutex);
+        remove(peer);
+        for(const auto& channel : subscriptions)
+            m_subscribers[channel].insert(peer);
+        if(subscriptions.empty())
+            m_open.insert(peer);
+        m_peers[peer] = std::move(subscriptions);
+    }
+
+    /**
+     * Adds a peer whose subscriptions are not known yet; it receives every channel until it advertises.
+     * @param peer the peer.
+     */
+    void add(const peer_type& peer) {
+        {
+            std::shared_lock lock(m_mutex);
+            if(m_peers.count(peer)) return;
+        }
+        std::unique_lock lock(m_mutex);
+        if(m_peers.try_emplace(peer).second)
+            m_open.insert(peer);
+    }
+
+    /**
+     * Removes a peer that has left the network.
+     * @param peer the peer.
+     */
+    void forget(const peer_type& peer) {
+        std::unique_lock lock(m_mutex);
+        remove(peer);
+    }
+
+    /**
+     * Visits every peer that should receive a snippet on a channel.
+     * @param channel the channel name (empty for the default channel).
+     * @param fn a callable taking a const peer_type&.
+     * @return false if the channel is the default one, in which case every peer should receive it and fn is not called.
+     */
+    template<typename Fn>
+    bool for_each_recipient(const std::string& channel, Fn&& fn) const {
+        if(channel.empty()) return false;
+        std::shared_lock lock(m_mutex);
+        for(const auto& peer : m_open)
+            fn(peer);
+        const auto it = m_subscribers.find(channel);
+        if(it != m_subscribers.end())
+            for(const auto& peer : it->second)
+                fn(peer);
+        return true;
+    }
+
+private:
+    void remove(const peer_type& peer) {
+        const auto it = m_peers.find(peer);
+        if(it == m_peers.end()) return;
+        for(const auto& channel : it->second) {
+            auto& subscribers = m_subscribers[channel];
+            subscribers.erase(peer);
+            if(subscribers.empty())
+                m_subscribers.erase(channel);
+        }
+        m_open.erase(peer);
+        m_peers.erase(it);
+    }
+
+    channel_set m_local;
+    std::unordered_map<peer_type, channel_set> m_peers;
+    std::unordered_map<std::string, std::unordered_set<peer_type>> m_subscribers;
+    std::unordered_set<peer_type> m_open;
+
+    mutable std::shared_mutex m_mutex;
+};
+
+#endif //CHANNELS_HPP
@@ -0,0 +1,156 @@
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+
+/**
+ * CRC32C (Castagnoli) checksums, and the integrity trailer of datagrams.
+ *
+ * The checksum uses the SSE4.2 crc32 instruction when the CPU has it, detected once at run time, and otherwise a
+ * portable slicing-by-8 implementation which handles 8 bytes per step with 8 lookup tables.
+ *
+ * A sealed datagram ends with an 8-byte trailer: a NUL byte, "C32", then the CRC32C of everything before the
+ * trailer (4 bytes, little endian). Nodes without integrity checks read the request as a C string, so they stop
+ * at the NUL and never see the trailer.
+ */
+namespace crc32c {
+
+constexpr uint32_t POLYNOMIAL    = 0x82f63b78;     // Reversed Castagnoli polynomial
+constexpr char TRAILER_MAGIC[]   = { '\0', 'C', '3', '2' };
+constexpr size_t TRAILER_SIZE    = sizeof(TRAILER_MAGIC) + sizeof(uint32_t);
+
+namespace detail {
+
+struct tables {
+    std::array<std::array<uint32_t, 256>, 8> t;
+
+    constexpr tables() : t() {
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for(int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (POLYNOMIAL & (0u - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for(uint32_t i = 0; i < 256; i++)
+            for(size_t k = 1; k < 8; k++)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+    }
+};
+
+inline constexpr tables TABLES;
+
+} // detail
+
+/**
+ * Computes a CRC32C with slicing-by-8.
+ * @param data the bytes.
+ * @param size the number of bytes.
+ * @param crc the CRC of the preceding bytes, to checksum a buffer in pieces.
+ * @return the CRC.
+ */
+inline uint32_t software(const void* data, size_t size, uint32_t crc = 0) noexcept {
+    const auto& t = detail::TABLES.t;
+    const auto* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for(; size >= 8; p += 8, size -= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;      // Little endian
+        crc = t[7][lo & 0xff] ^ t[6][lo >> 8 & 0xff] ^ t[5][lo >> 16 & 0xff] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xff] ^ t[2][hi >> 8 & 0xff] ^ t[1][hi >> 16 & 0xff] ^ t[0][hi >> 24];
+    }
+    for(; size > 0; p++, size--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * Computes a CRC32C with the SSE4.2 crc32 instruction. Only call it if has_hardware() is true.
+ */
+__attribute__((target("sse4.2")))
+inline uint32_t hardware(const void* data, size_t size, uint32_t crc = 0) noexcept {
+    const auto* p = static_cast<const unsigned char*>(data);
+    uint64_t c = ~crc;
+    for(; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    auto c32 = static_cast<uint32_t>(c);
+    for(; size > 0; p++, size--)
+        c32 = _mm_crc32_u8(c32, *p);
+    return ~c32;
+}
+
+inline bool has_hardware() noexcept {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#else
+inline uint32_t hardware(const void* data, size_t size, uint32_t crc = 0) noexcept {
+    return software(data, size, crc);
+}
+
+constexpr bool has_hardware() noexcept { return false; }
+#endif
+
+/**
+ * Computes a CRC32C with the fastest implementation available.
+ */
+inline uint32_t compute(const void* data, size_t size, uint32_t crc = 0) noexcept {
+    return has_hardware() ? hardware(data, size, crc) : software(data, size, crc);
+}
+
+/**
+ * Appends the integrity trailer to a datagram.
+ * @param datagram the datagram.
+ * @return the sealed datagram.
+ */
+inline std::string seal(const std::string& datagram) {
+    const uint32_t crc = compute(datagram.data(), datagram.size());
+    std::string ret;
+    ret.reserve(datagram.size() + TRAILER_SIZE);
+    ret.append(datagram).append(TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+    for(int i = 0; i < 4; i++)
+        ret.push_back(static_cast<char>(crc >> (8 * i)));
+    return ret;
+}
+
+enum class verdict {
+    valid,          // The trailer matched and was removed
+    unsealed,       // No trailer, e.g. from a node without integrity checks
+    corrupt,        // The trailer did not match
+};
+
+/**
+ * Checks and removes the integrity trailer of a received datagram.
+ * @param data the datagram; the trailer is replaced with NUL bytes if valid.
+ * @param size the size of the datagram, reduced by the trailer size if valid.
+ * @return the verdict.
+ */
+inline verdict open(char* data, size_t& size) noexcept {
+    if(size < TRAILER_SIZE || std::memcmp(data + size - TRAILER_SIZE, TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) != 0)
+        return verdict::unsealed;
+    const auto* trailer = reinterpret_cast<const unsigned char*>(data + size - sizeof(uint32_t));
+    const uint32_t expected = uint32_t(trailer[0]) | uint32_t(trailer[1]) << 8 | uint32_t(trailer[2]) << 16 | uint32_t(trailer[3]) << 24;
+    if(compute(data, size - TRAILER_SIZE) != expected)
+        return verdict::corrupt;
+    size -= TRAILER_SIZE;
+    std::memset(data + size, 0, TRAILER_SIZE);
+    return verdict::valid;
+}
+
+} // crc32c
+
+#endif //CRC32C_HPP
@@ -0,0 +1,293 @@
+#ifndef DIAG_HPP
+#define DIAG_HPP
+
+#include "net/socket_address.hpp"
+
+#include "spsc_queue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Asynchronous diagnostics, for messages that used to be written to std::cerr from the protocol threads, often
+ * while holding a lock: a slow terminal or a full pipe then stalled every thread waiting on that lock.
+ *
+ * Every thread enqueues small fixed-size records into its own lock-free queue, after a severity filter and a
+ * per-thread rate limit; a full queue drops the record instead of waiting. A background writer drains all the
+ * queues every few milliseconds, orders the records by time, formats them and writes the whole batch to std::cerr
+ * at once. Dropped and rate-limited records are counted and reported by the writer.
+ */
+namespace diag {
+
+enum class severity : uint8_t {
+    debug,
+    info,
+    warning,
+    error,
+};
+
+enum class kind : uint8_t {
+    text,               // Free text, truncated to TEXT_SIZE - 1 characters
+    peer_joined,        // peer: the peer
+    peer_left,          // peer: the peer
+};
+
+constexpr size_t TEXT_SIZE       = 96;
+constexpr size_t QUEUE_CAPACITY  = 1024;
+constexpr double RATE            = 1000;       // Records per second and thread, on average
+constexpr double BURST           = 1000;       // ... and at once
+constexpr auto FLUSH_INTERVAL    = std::chrono::milliseconds(10);
+
+struct record {
+    int64_t time;           // Steady clock, in nanoseconds
+    severity level;
+    kind type;
+    uint32_t addr;          // Peer address and port, in host byte order
+    uint16_t port;
+    char text[TEXT_SIZE];
+};
+
+/**
+ * Counters of the diagnostics.
+ */
+struct counters {
+    uint64_t written;
+    uint64_t dropped;       // The queue of the thread was full
+    uint64_t suppressed;    // Over the rate limit of the thread
+};
+
+namespace detail {
+
+inline int64_t now() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * The queue and rate limit of one thread. The token bucket is only touched by its thread.
+ */
+struct producer {
+    spsc_queue<record> queue{ QUEUE_CAPACITY };
+    std::atomic<uint64_t> dropped = 0;
+    std::atomic<uint64_t> suppressed = 0;
+    std::atomic<bool> retired = false;
+    double tokens = BURST;
+    int64_t last_refill = now();
+
+    bool take_token() noexcept {
+        const auto t = now();
+        tokens = std::min(BURST, tokens + double(t - last_refill) * RATE / 1e9);
+        last_refill = t;
+        if(tokens < 1) return false;
+        tokens -= 1;
+        return true;
+    }
+};
+
+/**
+ * The background writer and the registry of thread queues. A thread only takes the registry lock once, the first
+ * time it logs.
+ *
+ * The writer is never destroyed, since detached threads may still log while the process exits; it writes what is
+ * left and stops at exit instead.
+ */
+class writer {
+public:
+    static writer& instance() {
+        static writer* w = [] {
+            auto* ret = new writer;
+            std::atexit([] { instance().shutdown(); });
+            return ret;
+        }();
+        return *w;
+    }
+
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+
+    /**
+     * Stops the background thread after a last drain. Records logged afterwards are discarded.
+     */
+    void shutdown() {
+        if(!m_running.exchange(false)) return;
+        if(m_thread.joinable())
+            m_thread.join();
+        drain();
+    }
+
+    /**
+     * Gets the queue of the calling thread, registering it on first use.
+     */
+    producer& local() {
+        struct handle {
+            std::shared_ptr<producer> p;
+            explicit handle(writer& w) : p(std::make_shared<producer>()) { w.add(p); }
+            ~handle() { p->retired = true; }
+        };
+        thread_local handle h(*this);
+        return *h.p;
+    }
+
+    std::atomic<severity> level = severity::info;
+
+    /**
+     * Waits until every record enqueued before the call has been written.
+     */
+    void flush() {
+        const auto target = m_passes.load() + 2;
+        while(m_running && m_passes.load() < target)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    counters stats() {
+        std::scoped_lock lock(m_mutex);
+        counters ret = { m_written, m_dropped, m_suppressed };
+        for(const auto& p : m_producers) {
+            ret.dropped += p->dropped.load(std::memory_order_relaxed);
+            ret.suppressed += p->suppressed.load(std::memory_order_relaxed);
+        }
+        return ret;
+    }
+
+private:
+    writer() : m_thread([this] { run(); }) {}
+
+    void add(std::shared_ptr<producer> p) {
+        std::scoped_lock lock(m_mutex);
+        m_producers.push_back(std::move(p));
+    }
+
+    void run() {
+        while(m_running) {
+            std::this_thread::sleep_for(FLUSH_INTERVAL);
+            drain();
+            m_passes++;
+        }
+    }
+
+    /**
+     * Writes everything queued so far, and forgets the queues of threads that have exited.
+     */
+    void drain() {
+        std::vector<record> batch;
+        uint64_t dropped = 0, suppressed = 0;
+        {
+            std::scoped_lock lock(m_mutex);
+            for(auto it = m_producers.begin(); it != m_producers.end();) {
+                auto& p = **it;
+                const bool retired = p.retired.load();      // Read first: nothing is queued after retiring
+                while(auto r = p.queue.pop())
+                    batch.push_back(*r);
+                dropped += p.dropped.exchange(0, std::memory_order_relaxed);
+                suppressed += p.suppressed.exchange(0, std::memory_order_relaxed);
+                it = retired ? m_producers.erase(it) : it + 1;
+            }
+            m_written += batch.size();
+            m_dropped += dropped;
+            m_suppressed += suppressed;
+        }
+        if(batch.empty() && dropped == 0 && suppressed == 0)
+            return;
+        std::stable_sort(batch.begin(), batch.end(), [](const record& a, const record& b) { return a.time < b.time; });
+        std::string out;
+        for(const auto& r : batch)
+            format(out, r);
+        if(dropped || suppressed)
+            out += "diag: " + std::to_string(dropped) + " messages dropped, " + std::to_string(suppressed) + " suppressed\n";
+        std::cerr.write(out.data(), static_cast<std::streamsize>(out.size()));
+        std::cerr.flush();
+    }
+
+    static void format(std::string& out, const record& r) {
+        if(r.level == severity::warning) out += "warning: ";
+        else if(r.level == severity::error) out += "error: ";
+        switch(r.type) {
+            case kind::peer_joined: out += net::address_v4(htonl(r.addr), r.port).to_string() + " has joined."; break;
+            case kind::peer_left:   out += net::address_v4(htonl(r.addr), r.port).to_string() + " has left."; break;
+            default:                out += r.text; break;
+        }
+        out += '\n';
+    }
+
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<producer>> m_producers;
+    uint64_t m_written = 0;
+    uint64_t m_dropped = 0;
+    uint64_t m_suppressed = 0;
+    std::atomic<uint64_t> m_passes = 0;
+    std::atomic<bool> m_running = true;
+    std::thread m_thread;
+};
+
+inline void enqueue(severity level, kind type, const net::address_v4* peer, std::string_view text) noexcept {
+    auto& w = writer::instance();
+    if(level < w.level.load(std::memory_order_relaxed)) return;
+    auto& p = w.local();
+    if(!p.take_token()) {
+        p.suppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    record r;
+    r.time = now();
+    r.level = level;
+    r.type = type;
+    r.addr = peer ? peer->address() : 0;
+    r.port = peer ? peer->port() : 0;
+    const auto n = std::min(text.size(), TEXT_SIZE - 1);
+    std::memcpy(r.text, text.data(), n);
+    r.text[n] = '\0';
+    if(!p.queue.push(r))
+        p.dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // detail
+
+/**
+ * Logs a peer event. Never blocks.
+ */
+inline void log(severity level, kind type, const net::address_v4& peer) noexcept {
+    detail::enqueue(level, type, &peer, {});
+}
+
+/**
+ * Logs a message, truncated to TEXT_SIZE - 1 characters. Never blocks.
+ */
+inline void log(severity level, std::string_view text) noexcept {
+    detail::enqueue(level, kind::text, nullptr, text);
+}
+
+/**
+ * Sets the lowest severity logged; records below it are discarded before they are queued.
+ */
+inline void set_level(severity level) noexcept {
+    detail::writer::instance().level = level;
+}
+
+/**
+ * Waits until every record logged before the call has been written, e.g. before exiting.
+ */
+inline void flush() {
+    detail::writer::instance().flush();
+}
+
+/**
+ * Gets the number of records written, dropped and rate-limited so far.
+ */
+inline counters stats() {
+    return detail::writer::instance().stats();
+}
+
+} // diag
+
+#endif //DIAG_HPP
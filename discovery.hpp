@@ -0,0 +1,136 @@
+#ifndef DISCOVERY_HPP
+#define DISCOVERY_HPP
+
+#include "net/udp.hpp"
+
+#include <netinet/in.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <optional>
+
+
+/**
+ * Registry-free bootstrap on a local network.
+ *
+ * A node in discovery mode sends beacons from its protocol socket to a multicast group (or a broadcast address),
+ * so every beacon carries the address of its node as its source. The other nodes receive the beacons on a socket
+ * bound to the group port, add the sender to their peer table and answer right away with a heartbeat to the
+ * sender's protocol socket, which adds them in turn. A joining node therefore learns every node that answers within
+ * one round trip. Beacons are sent quickly at first, then less and less often, to also heal partitions.
+ */
+namespace discovery {
+
+constexpr char BEACON[] = "bcn1";
+
+/**
+ * Configuration of discovery.
+ */
+struct options {
+    net::address_v4 group = { "239.255.80.80", 55920 };                    // Multicast group or broadcast address
+    std::chrono::milliseconds first_interval = std::chrono::milliseconds(50);  // Delay before the second beacon
+    std::chrono::milliseconds max_interval = std::chrono::seconds(5);          // ... doubling up to this delay
+};
+
+/**
+ * Checks if an address is a multicast group.
+ */
+inline bool is_multicast(const net::address_v4& addr) noexcept {
+    return IN_MULTICAST(addr.address());
+}
+
+/**
+ * Finds the local address the system would send beacons to the group from, without sending anything.
+ * @param group the multicast group or broadcast address.
+ * @param port the port of the node.
+ * @return the address of the node.
+ */
+inline net::address_v4 local_address(const net::address_v4& group, in_port_t port) {
+    net::udp::socket probe(net::address_v4(in_port_t(0)));
+    probe.set_option(SOL_SOCKET, SO_BROADCAST, int(1));
+    if(!probe.connect(group))
+        return { "127.0.0.1", port };
+    return { htonl(probe.address().address()), port };
+}
+
+/**
+ * The beacons of one node: when to send them, and the socket receiving the beacons of the other nodes.
+ */
+class beacon {
+public:
+    /**
+     * Opens the receiving socket, bound to the port of the group and shared with the other nodes of the host.
+     * @param opts the discovery configuration.
+     * @param local the address of the node, whose interface sends and receives the beacons.
+     */
+    beacon(options opts, const net::address_v4& local) : m_options(std::move(opts)), m_local(local), m_interval(m_options.first_interval) {
+        m_socket.set_option(SOL_SOCKET, SO_REUSEADDR, int(1));
+        m_socket.set_option(SOL_SOCKET, SO_REUSEPORT, int(1));
+        if(!m_socket.bind(net::address_v4("0.0.0.0", m_options.group.port())))
+            std::cerr << "Failed to bind the discovery socket: " << m_socket.last_error_str() << std::endl;
+        if(is_multicast(m_options.group)) {
+            ip_mreq request = {};
+            request.imr_multiaddr.s_addr = htonl(m_options.group.address());
+            request.imr_interface.s_addr = htonl(m_local.address());
+            if(!m_socket.set_option(IPPROTO_IP, IP_ADD_MEMBERSHIP, request))
+                std::cerr << "Failed to join the discovery group: " << m_socket.last_error_str() << std::endl;
+        }
+    }
+
+    /**
+     * Prepares the protocol socket of the node to send beacons.
+     * @param sock the protocol socket.
+     */
+    void configure(const net::udp::socket& sock) const {
+        sock.set_option(SOL_SOCKET, SO_BROADCAST, int(1));
+        if(is_multicast(m_options.group)) {
+            in_addr iface = {};
+            iface.s_addr = htonl(m_local.address());
+            sock.set_option(IPPROTO_IP, IP_MULTICAST_IF, iface);
+        }
+    }
+
+    /**
+     * Sends a beacon from the protocol socket if it is due, and schedules the next one.
+     * @param sock the protocol socket.
+     */
+    void send_if_due(const net::udp::socket& sock) {
+        const auto now = std::chrono::steady_clock::now();
+        if(now < m_next) return;
+        static const std::string message = BEACON;
+        sock.send_to(net::buffer(message), m_options.group);
+        m_next = now + m_interval;
+        m_interval = std::min(m_interval * 2, m_options.max_interval);
+    }
+
+    /**
+     * Waits for a beacon from another node until the next beacon of this node is due, or for a while at most.
+     * @param max_wait the longest wait, to notice that the node stopped.
+     * @return the address of the node that sent a beacon, if any.
+     */
+    std::optional<net::address_v4> receive(std::chrono::milliseconds max_wait) {
+        const auto until_due = std::chrono::duration_cast<std::chrono::milliseconds>(m_next - std::chrono::steady_clock::now());
+        pollfd pfd = { m_socket.handle(), POLLIN, 0 };
+        if(::poll(&pfd, 1, static_cast<int>(std::clamp(until_due, std::chrono::milliseconds(0), max_wait).count())) <= 0)
+            return std::nullopt;
+        char data[64] = {};
+        net::address_v4 sender;
+        const auto len = m_socket.recv_from(net::buffer(data, sizeof(data) - 1), MSG_DONTWAIT, &sender);
+        if(len < 4 || std::memcmp(data, BEACON, 4) != 0 || sender == m_local)
+            return std::nullopt;
+        return sender;
+    }
+
+private:
+    const options m_options;
+    const net::address_v4 m_local;
+    net::udp::socket m_socket;
+    std::chrono::steady_clock::time_point m_next;
+    std::chrono::milliseconds m_interval;
+};
+
+} // discovery
+
+#endif //DISCOVERY_HPP
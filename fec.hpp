@@ -0,0 +1,341 @@
+#ifndef FEC_HPP
+#define FEC_HPP
+
+#include "net/socket_address.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Forward error correction for snippet datagrams with interleaved XOR parity.
+ *
+ * The snippets a node sends on a channel are grouped in blocks of k datagrams. Each block gets r parity datagrams:
+ * parity j is the XOR of the datagrams whose index i satisfies i % r == j, so any r consecutive losses in a block
+ * (or one loss per parity class) can be rebuilt by the receiver without waiting for a retransmission, at the cost
+ * of r/k extra bandwidth.
+ *
+ * A protected snippet tags its timestamp with its block and index, e.g. "snip12~5.3#ops text"; nodes without FEC
+ * still read the timestamp as 12. Parity datagrams are "fecp<block>.<class>.<k>.<r>.<length> " followed by the XOR
+ * of the datagram sizes (2 bytes, little endian) and the XOR of the datagrams, padded to the longest one, whose
+ * length is given in the header so that truncated parity is rejected. Only snippets of at most MAX_DATAGRAM_SIZE
+ * bytes are protected, so the largest parity datagram is MAX_PARITY_SIZE bytes.
+ *
+ * XOR parity is used rather than Reed-Solomon because it needs no Galois field arithmetic or dependency, and the
+ * interleaving gives a similar burst tolerance for small k. The codec is not allocation-free: parity buffers are
+ * strings that grow to the longest datagram of their class, and blocks are kept in maps keyed by channel or sender.
+ */
+namespace fec {
+
+constexpr char TAG = '~';
+constexpr char PARITY_REQUEST[] = "fecp";
+constexpr size_t MAX_DATAGRAM_SIZE = 2048;                        // Largest snippet datagram protected
+constexpr size_t MAX_TAG_SIZE = 32;                               // "~<block>.<index>"
+constexpr size_t MAX_PARITY_HEADER = 4 + 5 * 20 + 5;              // Request, five fields and their separators
+constexpr size_t MAX_PARITY_SIZE = MAX_PARITY_HEADER + 2 + MAX_DATAGRAM_SIZE;
+
+struct frame_id {
+    uint64_t block;
+    uint32_t index;
+};
+
+/**
+ * Gets the tag attached to the timestamp of a protected snippet.
+ * @param id the block and index of the snippet.
+ * @return the tag, e.g. "~5.3".
+ */
+std::string tag(const frame_id& id) {
+    return TAG + std::to_string(id.block) + '.' + std::to_string(id.index);
+}
+
+/**
+ * Splits an FEC tag off a timestamp token, e.g. "12~5.3" becomes { "12", { 5, 3 } }.
+ * @param token the token to split.
+ * @return a pair of the untagged token and the frame id, if the token had a valid tag.
+ */
+std::pair<std::string, std::optional<frame_id>> untag(const std::string& token) {
+    const auto pos = token.find(TAG);
+    if(pos == std::string::npos) return { token, std::nullopt };
+    const auto dot = token.find('.', pos);
+    try {
+        if(dot != std::string::npos)
+            return { token.substr(0, pos), frame_id { std::stoull(token.substr(pos + 1, dot - pos - 1)),
+                                                      static_cast<uint32_t>(std::stoul(token.substr(dot + 1))) } };
+    } catch(std::logic_error&) {}
+    return { token.substr(0, pos), std::nullopt };
+}
+
+/**
+ * XORs a datagram into a parity buffer, growing the buffer to the size of the datagram.
+ */
+inline void xor_into(std::string& parity, const char* data, size_t size) {
+    if(parity.size() < size)
+        parity.resize(size, '\0');
+    for(size_t i = 0; i < size; i++)
+        parity[i] = static_cast<char>(parity[i] ^ data[i]);
+}
+
+} // fec
+
+
+/**
+ * Builds the parity datagrams of the snippets sent by this node, one block per channel.
+ */
+class fec_encoder {
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 8;
+    static constexpr size_t DEFAULT_REDUNDANCY = 1;
+
+    /**
+     * @param k the number of data datagrams per block.
+     * @param r the number of parity datagrams per block.
+     */
+    explicit fec_encoder(size_t k = DEFAULT_BLOCK_SIZE, size_t r = DEFAULT_REDUNDANCY)
+            : m_k(std::max<size_t>(k, 1)), m_r(std::clamp<size_t>(r, 1, m_k)) {}
+
+    /**
+     * Gets the block and index of the next snippet sent on a channel.
+     * @param channel the channel name (empty for the default channel).
+     * @return the frame id to tag the snippet with.
+     */
+    fec::frame_id next(const std::string& channel) {
+        std::scoped_lock lock(m_mutex);
+        auto& block = current(channel);
+        return { block.id, static_cast<uint32_t>(block.count) };
+    }
+
+    /**
+     * Adds a snippet datagram, tagged with the id returned by next(), to the current block of its channel.
+     * @param channel the channel name.
+     * @param datagram the whole datagram as sent.
+     * @return the parity datagrams to send on the channel once the block is complete, or nothing.
+     */
+    std::vector<std::string> add(const std::string& channel, const std::string& datagram) {
+        std::scoped_lock lock(m_mutex);
+        auto& block = current(channel);
+        auto& [size_xor, bytes] = block.parities[block.count % m_r];
+        size_xor ^= static_cast<uint16_t>(datagram.size());
+        fec::xor_into(bytes, datagram.data(), datagram.size());
+        block.count++;
+        if(block.count < m_k) return {};
+        return seal(block);
+    }
+
+    /**
+     * Completes the partial blocks of every channel, so the last snippets of a burst are protected too.
+     * @return pairs of channel names and the parity datagrams to send on them.
+     */
+    std::vector<std::pair<std::string, std::string>> flush() {
+        std::scoped_lock lock(m_mutex);
+        std::vector<std::pair<std::string, std::string>> ret;
+        for(auto& [channel, block] : m_blocks) {
+            if(block.count == 0) continue;
+            for(auto& parity : seal(block))
+                ret.emplace_back(channel, std::move(parity));
+        }
+        return ret;
+    }
+
+    [[nodiscard]] size_t block_size() const noexcept { return m_k; }
+    [[nodiscard]] size_t redundancy() const noexcept { return m_r; }
+
+private:
+    struct block_state {
+        uint64_t id = 0;
+        size_t count = 0;
+        std::vector<std::pair<uint16_t, std::string>> parities;
+    };
+
+    block_state& current(const std::string& channel) {
+        auto [it, inserted] = m_blocks.try_emplace(channel);
+        if(inserted) {
+            it->second.id = m_next_block++;
+            it->second.parities.resize(m_r);
+        }
+        return it->second;
+    }
+
+    /**
+     * Builds the parity datagrams of a block and starts the next block of the channel.
+     */
+    std::vector<std::string> seal(block_state& block) {
+        std::vector<std::string> ret;
+        const size_t r = std::min(m_r, block.count);
+        for(size_t j = 0; j < r; j++) {
+            auto& [size_xor, bytes] = block.parities[j];
+            std::string datagram = fec::PARITY_REQUEST + std::to_string(block.id) + '.' + std::to_string(j) + '.' +
+                                   std::to_string(block.count) + '.' + std::to_string(r) + '.' + std::to_string(bytes.size()) + ' ';
+            datagram += static_cast<char>(size_xor & 0xff);
+            datagram += static_cast<char>(size_xor >> 8);
+            datagram += bytes;
+            ret.push_back(std::move(datagram));
+        }
+        block.id = m_next_block++;
+        block.count = 0;
+        for(auto& parity : block.parities)
+            parity = {};
+        return ret;
+    }
+
+    const size_t m_k;
+    const size_t m_r;
+
+    std::unordered_map<std::string, block_state> m_blocks;
+    uint64_t m_next_block = 1;
+
+    std::mutex m_mutex;
+};
+
+
+/**
+ * Rebuilds lost snippet datagrams from the parity datagrams of their block, and filters out the datagrams that
+ * arrive after they have already been rebuilt. Keeps the last MAX_BLOCKS blocks of every sender.
+ */
+class fec_decoder {
+public:
+    using peer_type = net::address_v4;
+
+    static constexpr size_t MAX_BLOCKS = 64;
+
+    struct statistics {
+        uint64_t recovered  = 0;
+        uint64_t duplicates = 0;
+        uint64_t rejected   = 0;    // Malformed or truncated parity datagrams
+    };
+
+    /**
+     * Records a protected snippet datagram.
+     * @param sender the sender of the datagram.
+     * @param id the block and index of the datagram.
+     * @param datagram the whole datagram as received.
+     * @param recovered receives the datagrams of the block that could be rebuilt thanks to this one.
+     * @return true if the datagram should be delivered, false if it was already rebuilt or received.
+     */
+    bool on_data(const peer_type& sender, const fec::frame_id& id, const std::string& datagram, std::vector<std::string>& recovered) {
+        std::scoped_lock lock(m_mutex);
+        auto& block = find(sender, id.block);
+        if(!block.frames.try_emplace(id.index, datagram).second) {
+            m_stats.duplicates++;
+            return false;
+        }
+        recover(block, recovered);
+        return true;
+    }
+
+    /**
+     * Records a parity datagram.
+     * @param sender the sender of the datagram.
+     * @param data the datagram without its request prefix.
+     * @param size the size of the datagram without its request prefix.
+     * @return the datagrams of the block that could be rebuilt thanks to this one.
+     */
+    std::vector<std::string> on_parity(const peer_type& sender, const char* data, size_t size) {
+        std::vector<std::string> recovered;
+        const auto header_end = std::find(data, data + size, ' ');
+        uint64_t fields[5] = {};
+        size_t n = 0;
+        for(const char* p = data; p < header_end && n < 5; p++) {
+            if(*p == '.') n++;
+            else if(*p >= '0' && *p <= '9') fields[n] = fields[n] * 10 + (*p - '0');
+            else n = 5;
+        }
+        const auto [block_id, j, k, r, length] = fields;
+        if(header_end == data + size || n != 4 || k == 0 || r == 0 || j >= r || k > fec::MAX_DATAGRAM_SIZE
+                || length > fec::MAX_DATAGRAM_SIZE || size_t(data + size - header_end) != length + 3) {
+            std::scoped_lock lock(m_mutex);
+            m_stats.rejected++;
+            return recovered;
+        }
+
+        std::scoped_lock lock(m_mutex);
+        auto& block = find(sender, block_id);
+        block.k = k;
+        block.r = r;
+        const auto* payload = reinterpret_cast<const unsigned char*>(header_end + 1);
+        auto& parity = block.parities[static_cast<uint32_t>(j)];
+        parity.first = static_cast<uint16_t>(payload[0] | payload[1] << 8);
+        parity.second.assign(reinterpret_cast<const char*>(payload + 2), data + size - header_end - 3);
+        recover(block, recovered);
+        return recovered;
+    }
+
+    /**
+     * Forgets a sender that has left the network.
+     * @param sender the sender.
+     */
+    void forget(const peer_type& sender) {
+        std::scoped_lock lock(m_mutex);
+        m_senders.erase(sender);
+    }
+
+    [[nodiscard]] statistics stats() const {
+        std::scoped_lock lock(m_mutex);
+        return m_stats;
+    }
+
+private:
+    struct block_state {
+        uint64_t k = 0;
+        uint64_t r = 0;
+        std::map<uint32_t, std::string> frames;                             // Received or rebuilt datagrams
+        std::map<uint32_t, std::pair<uint16_t, std::string>> parities;      // Class -> (size XOR, bytes XOR)
+    };
+
+    block_state& find(const peer_type& sender, uint64_t block) {
+        auto& blocks = m_senders[sender];
+        if(blocks.size() >= MAX_BLOCKS && blocks.find(block) == blocks.end())
+            blocks.erase(blocks.begin());
+        return blocks[block];
+    }
+
+    /**
+     * Rebuilds every datagram that is the only one missing from its parity class.
+     */
+    void recover(block_state& block, std::vector<std::string>& recovered) {
+        for(auto it = block.parities.begin(); it != block.parities.end();) {
+            const uint32_t j = it->first;
+            std::optional<uint32_t> missing;
+            size_t missing_count = 0;
+            for(uint32_t i = j; i < block.k; i += static_cast<uint32_t>(block.r)) {
+                if(block.frames.count(i) == 0) {
+                    missing = i;
+                    missing_count++;
+                }
+            }
+            if(missing_count > 1) {
+                ++it;
+                continue;
+            }
+            if(missing) {
+                auto [size, bytes] = it->second;
+                for(uint32_t i = j; i < block.k; i += static_cast<uint32_t>(block.r)) {
+                    if(i == *missing) continue;
+                    const auto& frame = block.frames.at(i);
+                    size ^= static_cast<uint16_t>(frame.size());
+                    fec::xor_into(bytes, frame.data(), frame.size());
+                }
+                if(size <= bytes.size()) {
+                    bytes.resize(size);
+                    recovered.push_back(bytes);
+                    block.frames.emplace(*missing, std::move(bytes));
+                    m_stats.recovered++;
+                }
+            }
+            it = block.parities.erase(it);
+        }
+    }
+
+    std::unordered_map<peer_type, std::map<uint64_t, block_state>> m_senders;
+    statistics m_stats;
+
+    mutable std::mutex m_mutex;
+};
+
+#endif //FEC_HPP
@@ -0,0 +1,246 @@
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+/**
+ * An always-on flight recorder of recent protocol events.
+ *
+ * Every thread writes fixed-size binary events to its own ring buffer: a timestamp and three integers, with no
+ * formatting and no lock, so recording costs a few stores and can stay on in production. The rings live in static
+ * storage, which lets a signal handler write them to a file with nothing but open() and write(): on SIGUSR1, on a
+ * fatal signal (before the default action runs), or on request, e.g. when the watchdog detects a stall. decode()
+ * turns a dump back into text; the flight_decode tool does the same from the command line.
+ */
+namespace flight {
+
+constexpr size_t MAX_THREADS       = 32;
+constexpr size_t EVENTS_PER_THREAD = 1024;      // A power of two
+constexpr size_t NAME_SIZE         = 16;
+constexpr uint32_t MAGIC           = 0x52544c46;   // "FLTR"
+constexpr uint32_t VERSION         = 1;
+
+enum class kind : uint32_t {
+    datagram,           // a: size, b: sender, c: request (four characters)
+    handler,            // a: request (four characters), b: sender
+    peer_joined,        // b: peer
+    peer_expired,       // b: peer
+    queue_depth,        // a: queue, b: depth
+    snippet_sent,       // a: Lamport timestamp, b: recipients
+    stall,              // a: duration in ms so far
+    mark,               // a, b, c: free
+};
+
+enum queue : uint32_t {
+    peer_batch,         // Peer observations waiting to be applied by the listening thread
+    flow,               // Snippets waiting for a flow control window
+};
+
+struct event {
+    int64_t time;       // Steady clock, in nanoseconds
+    uint32_t type;
+    uint32_t a;
+    uint64_t b;
+    uint64_t c;
+};
+
+struct ring {
+    char name[NAME_SIZE];
+    std::atomic<uint64_t> head;         // Number of events written so far
+    event events[EVENTS_PER_THREAD];
+};
+
+struct header {
+    uint32_t magic;
+    uint32_t version;
+    int32_t cause;                      // Signal number, or 0 for a dump on request
+    uint32_t threads;
+    uint32_t events_per_thread;
+    uint32_t reserved;
+    int64_t steady_time;                // Clocks at the time of the dump, to convert event times to wall time
+    int64_t system_time;
+};
+
+/**
+ * Packs an address into an event field.
+ * @param addr the address in host byte order.
+ * @param port the port in host byte order.
+ */
+constexpr uint64_t pack_peer(uint32_t addr, uint16_t port) noexcept {
+    return uint64_t(addr) << 16 | port;
+}
+
+/**
+ * Packs a request prefix, e.g. "snip", into an event field.
+ */
+inline uint32_t pack_request(const char* data, size_t size) noexcept {
+    uint32_t ret = 0;
+    std::memcpy(&ret, data, std::min<size_t>(size, sizeof(ret)));
+    return ret;
+}
+
+namespace detail {
+
+inline std::array<ring, MAX_THREADS> rings;
+inline std::atomic<uint32_t> ring_count = 0;
+inline char dump_path[256] = "flight.bin";
+
+inline ring* this_ring() noexcept {
+    thread_local ring* r = [] () -> ring* {
+        const auto index = ring_count.fetch_add(1, std::memory_order_relaxed);
+        return index < MAX_THREADS ? &rings[index] : nullptr;     // Threads beyond the limit are not recorded
+    }();
+    return r;
+}
+
+inline int64_t now() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Writes every ring to the dump file. Only calls async-signal-safe functions.
+ */
+inline bool write_dump(int cause) noexcept {
+    const int fd = ::open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) return false;
+    const uint32_t threads = std::min<uint32_t>(ring_count.load(std::memory_order_acquire), MAX_THREADS);
+    const header h = { MAGIC, VERSION, cause, threads, EVENTS_PER_THREAD, 0, now(),
+                       std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count() };
+    bool ok = ::write(fd, &h, sizeof(h)) == ssize_t(sizeof(h));
+    for(uint32_t i = 0; i < threads && ok; i++)
+        ok = ::write(fd, &rings[i], sizeof(ring)) == ssize_t(sizeof(ring));
+    ::close(fd);
+    return ok;
+}
+
+inline void on_signal(int sig) {
+    const int saved = errno;
+    write_dump(sig);
+    errno = saved;
+    if(sig != SIGUSR1) {
+        // The handler was reset on entry, so raising again runs the default action (core dump, exit)
+        ::raise(sig);
+    }
+}
+
+} // detail
+
+/**
+ * Names the ring of the calling thread in dumps.
+ * @param name the name, truncated to 15 characters.
+ */
+inline void name_thread(const char* name) noexcept {
+    if(auto* r = detail::this_ring()) {
+        std::strncpy(r->name, name, NAME_SIZE - 1);
+        r->name[NAME_SIZE - 1] = '\0';
+    }
+}
+
+/**
+ * Records an event in the ring of the calling thread.
+ */
+inline void record(kind type, uint32_t a = 0, uint64_t b = 0, uint64_t c = 0) noexcept {
+    auto* r = detail::this_ring();
+    if(!r) return;
+    const auto head = r->head.load(std::memory_order_relaxed);
+    r->events[head & (EVENTS_PER_THREAD - 1)] = { detail::now(), static_cast<uint32_t>(type), a, b, c };
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * Sets the dump file and installs the dump handlers for SIGUSR1 and the fatal signals.
+ * @param path the path of the dump file.
+ */
+inline void install(const std::string& path) {
+    std::strncpy(detail::dump_path, path.c_str(), sizeof(detail::dump_path) - 1);
+    struct sigaction action = {};
+    action.sa_handler = detail::on_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+    action.sa_flags = SA_RESETHAND | SA_NODEFER;
+    for(const int sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT })
+        sigaction(sig, &action, nullptr);
+}
+
+/**
+ * Writes the rings to the dump file now.
+ * @return true if the dump was written, false otherwise.
+ */
+inline bool dump() noexcept {
+    return detail::write_dump(0);
+}
+
+/**
+ * Decodes a dump into text, one line per event, oldest first within each thread. Events that were being
+ * overwritten while the dump was taken may be garbled.
+ * @param path the path of the dump file.
+ * @return the decoded dump, or an empty string if the file is not a valid dump.
+ */
+inline std::string decode(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    header h = {};
+    if(!in.read(reinterpret_cast<char*>(&h), sizeof(h)) || h.magic != MAGIC || h.version != VERSION || h.events_per_thread != EVENTS_PER_THREAD)
+        return {};
+    const auto peer = [](uint64_t packed) {
+        const uint32_t addr = uint32_t(packed >> 16);
+        return std::to_string(addr >> 24) + '.' + std::to_string(addr >> 16 & 0xff) + '.' + std::to_string(addr >> 8 & 0xff) + '.'
+               + std::to_string(addr & 0xff) + ':' + std::to_string(packed & 0xffff);
+    };
+    const auto request = [](uint64_t packed) {
+        char str[5] = {};
+        std::memcpy(str, &packed, 4);
+        for(auto& c : str) if(c != '\0' && !std::isprint(static_cast<unsigned char>(c))) c = '?';
+        return std::string(str);
+    };
+
+    std::stringstream out;
+    out << "cause " << (h.cause == 0 ? std::string("request") : "signal " + std::to_string(h.cause)) << ", " << h.threads << " threads\n";
+    auto r = std::make_unique<ring>();
+    for(uint32_t t = 0; t < h.threads && in.read(reinterpret_cast<char*>(r.get()), sizeof(ring)); t++) {
+        r->name[NAME_SIZE - 1] = '\0';
+        const auto head = r->head.load();
+        const auto count = std::min<uint64_t>(head, EVENTS_PER_THREAD);
+        out << "thread " << t << " '" << r->name << "': " << head << " events, last " << count << '\n';
+        for(uint64_t i = head - count; i < head; i++) {
+            const auto& e = r->events[i & (EVENTS_PER_THREAD - 1)];
+            const double age = double(h.steady_time - e.time) / 1e6;
+            out << "  -" << std::fixed << std::setprecision(3) << std::setw(12) << age << "ms ";
+            switch(static_cast<kind>(e.type)) {
+                case kind::datagram:     out << "datagram " << e.a << " bytes '" << request(e.c) << "' from " << peer(e.b); break;
+                case kind::handler:      out << "handler '" << request(e.a) << "' for " << peer(e.b); break;
+                case kind::peer_joined:  out << "peer joined " << peer(e.b); break;
+                case kind::peer_expired: out << "peer expired " << peer(e.b); break;
+                case kind::queue_depth:  out << "queue " << (e.a == queue::flow ? "flow" : "peer_batch") << " depth " << e.b; break;
+                case kind::snippet_sent: out << "snippet " << e.a << " sent to " << e.b << " peers"; break;
+                case kind::stall:        out << "stall for " << e.a << "ms"; break;
+                case kind::mark:         out << "mark " << e.a << ' ' << e.b << ' ' << e.c; break;
+                default:                 out << "unknown event " << e.type; break;
+            }
+            out << '\n';
+        }
+    }
+    return out.str();
+}
+
+} // flight
+
+#endif //FLIGHT_RECORDER_HPP
@@ -0,0 +1,230 @@
+#ifndef FLOW_CONTROL_HPP
+#define FLOW_CONTROL_HPP
+
+#include "net/socket_address.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+/**
+ * Configuration of the per-peer send windows.
+ */
+struct flow_options {
+    double initial_window = 4;                                  // Messages in flight before the first ACK
+    double min_window     = 1;
+    double max_window     = 256;
+    std::chrono::microseconds initial_rtt = std::chrono::milliseconds(20);
+    std::chrono::microseconds min_rto     = std::chrono::milliseconds(100);
+    size_t max_queue = 4096;                                    // Messages queued per peer before the oldest is dropped
+};
+
+
+/**
+ * Additive-increase/multiplicative-decrease congestion and flow control for snippets.
+ *
+ * Every peer gets its own send window. Each ACK ('sack<seq>') grows the window by one message per round trip, and
+ * a message that has not been acknowledged within the retransmission timeout halves it (at most once per round
+ * trip). Sends inside the window are paced at one message every srtt / window, so a burst leaves at the rate the
+ * peer has been draining rather than all at once. Messages that do not fit are queued per peer.
+ *
+ * Peers that have never acknowledged anything are assumed not to support ACKs and are sent to immediately, as
+ * before, so mixing with nodes that do not run flow control keeps working.
+ */
+class flow_control {
+public:
+    using peer_type  = net::address_v4;
+    using clock_type = std::chrono::steady_clock;
+    using message_ptr = std::shared_ptr<const std::string>;
+
+    struct statistics {
+        uint64_t sent  = 0;
+        uint64_t acked = 0;
+        uint64_t lost  = 0;
+        uint64_t dropped = 0;           // Dropped from a full queue before being sent
+    };
+
+    explicit flow_control(flow_options opts = {})
+            : m_options(opts) {}
+
+    /**
+     * Queues a message for a peer.
+     * @param peer the destination.
+     * @param seq the sequence number the peer will acknowledge.
+     * @param message the message.
+     * @return true if the oldest queued message of the peer was dropped to make room, false otherwise.
+     */
+    bool enqueue(const peer_type& peer, uint64_t seq, message_ptr message) {
+        std::scoped_lock lock(m_mutex);
+        auto& state = peer_state(peer);
+        const bool dropped = state.queue.size() >= m_options.max_queue;
+        if(dropped) {
+            state.queue.pop_front();
+            m_stats.dropped++;
+        }
+        state.queue.emplace_back(seq, std::move(message));
+        return dropped;
+    }
+
+    /**
+     * Sends every queued message that the windows and pacing currently allow, and detects losses.
+     * @param send a callable taking (const peer_type&, const std::string&) that puts a message on the wire.
+     * @return the time until the next message becomes due, or max() if nothing is queued.
+     */
+    template<typename Fn>
+    clock_type::duration pump(Fn&& send) {
+        std::scoped_lock lock(m_mutex);
+        const auto now = clock_type::now();
+        auto next = clock_type::duration::max();
+        for(auto& [peer, state] : m_peers) {
+            detect_losses(state, now);
+            while(!state.queue.empty()) {
+                if(state.ack_capable) {
+                    if(double(state.inflight.size()) >= state.window) break;
+                    if(now < state.next_send) {
+                        next = std::min(next, state.next_send - now);
+                        break;
+                    }
+                    state.inflight[state.queue.front().first] = now;
+                    state.next_send = std::max(state.next_send, now) + pacing_interval(state);
+                }
+                send(peer, *state.queue.front().second);
+                state.queue.pop_front();
+                m_stats.sent++;
+            }
+            if(!state.inflight.empty())
+                next = std::min(next, std::chrono::duration_cast<clock_type::duration>(rto(state)));
+        }
+        return next;
+    }
+
+    /**
+     * Handles an ACK from a peer: updates its RTT estimate and grows its window.
+     * @param peer the peer that sent the ACK.
+     * @param seq the acknowledged sequence number.
+     */
+    void on_ack(const peer_type& peer, uint64_t seq) {
+        std::scoped_lock lock(m_mutex);
+        auto& state = peer_state(peer);
+        state.ack_capable = true;
+        const auto it = state.inflight.find(seq);
+        if(it == state.inflight.end()) return;
+        const auto sample = std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - it->second);
+        state.inflight.erase(it);
+        // RFC 6298 smoothing
+        const auto delta = sample > state.srtt ? sample - state.srtt : state.srtt - sample;
+        state.rttvar = (3 * state.rttvar + delta) / 4;
+        state.srtt = (7 * state.srtt + sample) / 8;
+        state.window = std::min(m_options.max_window, state.window + 1.0 / state.window);
+        m_stats.acked++;
+    }
+
+    /**
+     * Forgets a peer that has left the network, dropping whatever was queued for it.
+     * @param peer the peer.
+     */
+    void forget(const peer_type& peer) {
+        std::scoped_lock lock(m_mutex);
+        m_peers.erase(peer);
+    }
+
+    [[nodiscard]] statistics stats() const {
+        std::scoped_lock lock(m_mutex);
+        return m_stats;
+    }
+
+    /**
+     * Gets the current window of a peer.
+     * @param peer the peer.
+     * @return the window in messages, or 0 if the peer is unknown.
+     */
+    [[nodiscard]] double window(const peer_type& peer) const {
+        std::scoped_lock lock(m_mutex);
+        const auto it = m_peers.find(peer);
+        return it == m_peers.end() ? 0 : it->second.window;
+    }
+
+    /**
+     * Gets the smoothed round-trip time of a peer.
+     * @param peer the peer.
+     * @return the smoothed RTT, or zero if the peer is unknown.
+     */
+    [[nodiscard]] std::chrono::microseconds rtt(const peer_type& peer) const {
+        std::scoped_lock lock(m_mutex);
+        const auto it = m_peers.find(peer);
+        return it == m_peers.end() ? std::chrono::microseconds(0) : it->second.srtt;
+    }
+
+    [[nodiscard]] size_t queued() const {
+        std::scoped_lock lock(m_mutex);
+        size_t total = 0;
+        for(const auto& [peer, state] : m_peers)
+            total += state.queue.size() + state.inflight.size();
+        return total;
+    }
+
+private:
+    struct peer_flow {
+        double window = 0;
+        std::chrono::microseconds srtt;
+        std::chrono::microseconds rttvar;
+        clock_type::time_point next_send;
+        clock_type::time_point last_decrease;
+        bool ack_capable = false;
+        std::deque<std::pair<uint64_t, message_ptr>> queue;
+        std::map<uint64_t, clock_type::time_point> inflight;
+    };
+
+    peer_flow& peer_state(const peer_type& peer) {
+        auto [it, inserted] = m_peers.try_emplace(peer);
+        if(inserted) {
+            it->second.window = m_options.initial_window;
+            it->second.srtt = m_options.initial_rtt;
+            it->second.rttvar = m_options.initial_rtt / 2;
+        }
+        return it->second;
+    }
+
+    [[nodiscard]] std::chrono::microseconds rto(const peer_flow& state) const {
+        return std::max(m_options.min_rto, state.srtt + 4 * state.rttvar);
+    }
+
+    [[nodiscard]] static clock_type::duration pacing_interval(const peer_flow& state) {
+        return std::chrono::duration_cast<clock_type::duration>(state.srtt / state.window);
+    }
+
+    /**
+     * Treats messages unacknowledged past the retransmission timeout as lost, halving the window once per round trip.
+     */
+    void detect_losses(peer_flow& state, clock_type::time_point now) {
+        const auto timeout = rto(state);
+        for(auto it = state.inflight.begin(); it != state.inflight.end();) {
+            if(now - it->second < timeout) {
+                ++it;
+                continue;
+            }
+            if(now - state.last_decrease > state.srtt) {
+                state.window = std::max(m_options.min_window, state.window / 2);
+                state.last_decrease = now;
+            }
+            it = state.inflight.erase(it);
+            m_stats.lost++;
+        }
+    }
+
+    const flow_options m_options;
+
+    std::unordered_map<peer_type, peer_flow> m_peers;
+    statistics m_stats;
+
+    mutable std::mutex m_mutex;
+};
+
+#endif //FLOW_CONTROL_HPP
@@ -0,0 +1,210 @@
+#ifndef FRAGMENTS_HPP
+#define FRAGMENTS_HPP
+
+#include "net/socket_address.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Bulk transfer of messages larger than a datagram.
+ *
+ * A large message is cut into fragments of equal size (the last one may be shorter), so that the whole train can be
+ * handed to the kernel in one segmented send. Every fragment is "frag<id>.<index>.<count> " with fixed-width hex
+ * fields, followed by its part of the message, e.g. "frag0000002a.0001.0003 ...". The receiver reassembles the
+ * message once every fragment of an id arrived, and handles it as if it had been received in one datagram.
+ * Nodes without bulk transfer ignore fragments.
+ */
+namespace fragments {
+
+constexpr char REQUEST[]         = "frag";
+constexpr size_t HEADER_SIZE     = 23;         // "frag" + 8 + '.' + 4 + '.' + 4 + ' '
+constexpr size_t MAX_FRAGMENTS   = 0xffff;
+constexpr size_t MAX_MESSAGE     = 1 << 20;
+
+/**
+ * Cuts a message into fragments.
+ * @param id the id of the message, unique per sender for a while.
+ * @param message the message.
+ * @param payload_size the number of message bytes per fragment.
+ * @return the fragments, or nothing if the message needs too many of them.
+ */
+inline std::vector<std::string> split(uint32_t id, const std::string& message, size_t payload_size) {
+    if(payload_size == 0 || message.size() > MAX_MESSAGE) return {};
+    const size_t count = (message.size() + payload_size - 1) / payload_size;
+    if(count > MAX_FRAGMENTS) return {};
+    std::vector<std::string> ret;
+    ret.reserve(count);
+    char header[HEADER_SIZE + 1];
+    for(size_t i = 0; i < count; i++) {
+        std::snprintf(header, sizeof(header), "%s%08x.%04zx.%04zx ", REQUEST, id, i, count);
+        ret.emplace_back(header, HEADER_SIZE);
+        ret.back().append(message, i * payload_size, payload_size);
+    }
+    return ret;
+}
+
+/**
+ * Reassembles the messages of every sender from their fragments. Incomplete messages are dropped once they are
+ * older than the timeout, or when their sender has too many pending, so that one sender opening new messages only
+ * evicts its own. A larger cap on all senders together bounds the memory under spoofed senders. Safe to share
+ * between threads.
+ */
+class assembler {
+public:
+    static constexpr auto DEFAULT_TIMEOUT = std::chrono::seconds(5);
+    static constexpr size_t MAX_PENDING_PER_SENDER = 8;
+    static constexpr size_t MAX_PENDING            = 1024;
+
+    explicit assembler(std::chrono::steady_clock::duration timeout = DEFAULT_TIMEOUT) : m_timeout(timeout) {}
+
+    /**
+     * Adds a received fragment.
+     * @param sender the sender of the fragment.
+     * @param data the fragment, after the request prefix.
+     * @param size the size of the fragment, after the request prefix.
+     * @return the whole message if this fragment completed it, nothing otherwise.
+     */
+    std::optional<std::string> add(const net::address_v4& sender, const char* data, size_t size) {
+        const auto header = parse(data, size);
+        if(!header) return std::nullopt;
+        const auto& [id, index, count] = *header;
+        const auto now = std::chrono::steady_clock::now();
+
+        std::scoped_lock lock(m_mutex);
+        expire(now);
+        const key k = { sender, id };
+        auto it = m_pending.find(k);
+        if(it == m_pending.end()) {
+            if(const auto [first, last] = sender_range(sender); size_t(std::distance(first, last)) >= MAX_PENDING_PER_SENDER)
+                m_pending.erase(oldest(first, last));
+            else if(m_pending.size() >= MAX_PENDING)
+                m_pending.erase(oldest(m_pending.begin(), m_pending.end()));
+            it = m_pending.emplace(k, partial{ now, count, {}, 0 }).first;
+        }
+        auto& p = it->second;
+        const size_t body = size - (HEADER_SIZE - 4);
+        if(p.count != count || p.parts.count(index) || p.bytes + body > MAX_MESSAGE)
+            return std::nullopt;
+        p.parts.emplace(index, std::string(data + HEADER_SIZE - 4, body));
+        p.bytes += body;
+        if(p.parts.size() < count)
+            return std::nullopt;
+
+        std::string message;
+        message.reserve(p.bytes);
+        for(const auto& [i, part] : p.parts)
+            message += part;
+        m_pending.erase(it);
+        return message;
+    }
+
+    /**
+     * Gets the number of messages waiting for fragments.
+     */
+    [[nodiscard]] size_t pending() const {
+        std::scoped_lock lock(m_mutex);
+        return m_pending.size();
+    }
+
+    /**
+     * Gets the number of incomplete messages dropped so far.
+     */
+    [[nodiscard]] uint64_t dropped() const {
+        std::scoped_lock lock(m_mutex);
+        return m_dropped;
+    }
+
+private:
+    struct key {
+        net::address_v4 sender;
+        uint32_t id;
+
+        bool operator<(const key& other) const noexcept {
+            if(sender.address() != other.sender.address()) return sender.address() < other.sender.address();
+            if(sender.port() != other.sender.port()) return sender.port() < other.sender.port();
+            return id < other.id;
+        }
+    };
+
+    /**
+     * The fragments received so far of a message. They are stored as they arrive rather than in slots allocated
+     * for the announced count, so a pending message never takes more memory than the bytes received for it.
+     */
+    struct partial {
+        std::chrono::steady_clock::time_point first;
+        size_t count;
+        std::map<size_t, std::string> parts;
+        size_t bytes;
+    };
+
+    using header_type = std::tuple<uint32_t, size_t, size_t>;
+
+    static std::optional<header_type> parse(const char* data, size_t size) {
+        if(size < HEADER_SIZE - 4 || data[8] != '.' || data[13] != '.' || data[18] != ' ')
+            return std::nullopt;
+        const auto field = [&](size_t pos, size_t len) -> std::optional<size_t> {
+            size_t val = 0;
+            for(size_t i = pos; i < pos + len; i++) {
+                const char c = data[i];
+                if(c >= '0' && c <= '9') val = val * 16 + size_t(c - '0');
+                else if(c >= 'a' && c <= 'f') val = val * 16 + size_t(c - 'a' + 10);
+                else return std::nullopt;
+            }
+            return val;
+        };
+        const auto id = field(0, 8), index = field(9, 4), count = field(14, 4);
+        if(!id || !index || !count || *count == 0 || *index >= *count)
+            return std::nullopt;
+        return header_type{ static_cast<uint32_t>(*id), *index, *count };
+    }
+
+    void expire(std::chrono::steady_clock::time_point now) {
+        for(auto it = m_pending.begin(); it != m_pending.end();) {
+            if(now - it->second.first > m_timeout) {
+                it = m_pending.erase(it);
+                m_dropped++;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    using iterator = std::map<key, partial>::iterator;
+
+    /**
+     * Gets the pending messages of a sender, which are adjacent since the keys are ordered by sender first.
+     */
+    std::pair<iterator, iterator> sender_range(const net::address_v4& sender) {
+        return { m_pending.lower_bound({ sender, 0 }), m_pending.upper_bound({ sender, UINT32_MAX }) };
+    }
+
+    iterator oldest(iterator first, iterator last) {
+        m_dropped++;
+        auto ret = first;
+        for(auto it = first; it != last; ++it)
+            if(it->second.first < ret->second.first)
+                ret = it;
+        return ret;
+    }
+
+    const std::chrono::steady_clock::duration m_timeout;
+    mutable std::mutex m_mutex;
+    std::map<key, partial> m_pending;
+    uint64_t m_dropped = 0;
+};
+
+} // fragments
+
+#endif //FRAGMENTS_HPP
@@ -1,6 +1,9 @@
 #ifndef IO_CONTEXT_HPP
 #define IO_CONTEXT_HPP
 
+#include "outgoing_log.hpp"
+
+#include <memory>
 #include <queue>
 #include <string>
 #include <mutex>
@@ -11,16 +14,22 @@ struct message {
     std::string sender;
     std::string content;
     size_t timestamp;
+    std::string channel;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const message& msg) {
-    return (os << msg.timestamp << ' ' << msg.sender << "> " << msg.content);
+    os << msg.timestamp << ' ' << msg.sender << "> ";
+    if(!msg.channel.empty())
+        os << '#' << msg.channel << ' ';
+    return (os << msg.content);
 }
 
 
 /**
  * This class manages the queues of incoming/outgoing messages from stdout/stdin and the peer-to-peer server.
  * This class should be stored by reference between the snippet interface and the peer manager server.
+ * With a journal attached, outgoing messages are logged before they are queued and acknowledged once sent, so
+ * the messages still queued when the node stops are sent again after a restart.
  */
 class io_context {
 public:
@@ -28,9 +37,9 @@ public:
         return !m_incoming.empty();
     }
 
-    void put_incoming(const net::address_v4& sender, const std::string& message, size_t timestamp) noexcept {
+    void put_incoming(const net::address_v4& sender, const std::string& message, size_t timestamp, const std::string& channel = "") noexcept {
         std::scoped_lock lock(m_mutex);
-        m_incoming.push({ sender.to_string(), message, timestamp });
+        m_incoming.push({ sender.to_string(), message, timestamp, channel });
     }
 
     net::message pop_incoming() noexcept {
@@ -46,20 +55,58 @@ public:
     }
 
     void put_outgoing(const std::string& message) noexcept {
+        // Logged outside the lock, which commit durability would otherwise hold for a whole flush
+        const auto seq = m_journal ? m_journal->append(message) : 0;
         std::scoped_lock lock(m_mutex);
         m_outgoing.push(message);
+        m_outgoing_seqs.push(seq);
     }
 
     std::string pop_outgoing() noexcept {
         std::scoped_lock lock(m_mutex);
         auto ret = m_outgoing.front();
         m_outgoing.pop();
+        m_sending.push(m_outgoing_seqs.front());
+        m_outgoing_seqs.pop();
         return ret;
     }
 
+    /**
+     * Acknowledges the oldest outgoing message popped and not acknowledged yet, once it has been sent, so that the
+     * journal does not send it again after a restart.
+     */
+    void ack_outgoing() noexcept {
+        uint64_t seq;
+        {
+            std::scoped_lock lock(m_mutex);
+            if(m_sending.empty()) return;
+            seq = m_sending.front();
+            m_sending.pop();
+        }
+        if(m_journal)
+            m_journal->acknowledge(seq);
+    }
+
+    /**
+     * Logs the outgoing messages to a journal, and queues the messages it recovered from a previous run.
+     * Must be called before any message is queued.
+     * @param journal the journal.
+     */
+    void attach_journal(std::shared_ptr<outgoing_log> journal) {
+        std::scoped_lock lock(m_mutex);
+        for(const auto& [seq, message] : journal->recovered()) {
+            m_outgoing.push(message);
+            m_outgoing_seqs.push(seq);
+        }
+        m_journal = std::move(journal);
+    }
+
 private:
     std::queue<net::message> m_incoming;
     std::queue<std::string> m_outgoing;
+    std::queue<uint64_t> m_outgoing_seqs;       // Journal sequence numbers of the queued messages (0 if not logged)
+    std::queue<uint64_t> m_sending;             // ... and of the messages popped but not acknowledged yet
+    std::shared_ptr<outgoing_log> m_journal;
 
     std::mutex m_mutex;
 };
@@ -0,0 +1,165 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include "net/socket_address.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * Round-trip time estimates per peer, measured with ping/pong probes.
+ *
+ * Every heartbeat round carries a probe id ("peer10.0.0.1:5000@17"); peers that understand it answer right away
+ * with "pong17". The send time of the last few rounds is kept, so a pong gives one RTT sample, which is folded into
+ * an exponentially weighted moving average (gain 1/8) and a mean deviation used as the jitter (gain 1/4), as in
+ * RFC 6298. Peers that never answer simply have no estimate.
+ */
+class latency_tracker {
+public:
+    using peer_type  = net::address_v4;
+    using clock_type = std::chrono::steady_clock;
+    using duration   = std::chrono::microseconds;
+
+    static constexpr size_t MAX_PENDING_PROBES = 8;
+
+    struct estimate {
+        duration rtt;
+        duration jitter;
+    };
+
+    explicit latency_tracker(uint64_t seed = std::random_device{}())
+            : m_rng(seed) {}
+
+    /**
+     * Starts a new probe round.
+     * @return the id to attach to the heartbeats of this round.
+     */
+    uint32_t probe() {
+        std::scoped_lock lock(m_mutex);
+        const uint32_t id = ++m_last_probe;
+        m_probes[id % MAX_PENDING_PROBES] = { id, clock_type::now() };
+        return id;
+    }
+
+    /**
+     * Handles a pong from a peer.
+     * @param peer the peer that answered.
+     * @param id the id of the probe it answered.
+     * @return the new estimate of the peer, or nothing if the probe is unknown or too old.
+     */
+    std::optional<estimate> on_pong(const peer_type& peer, uint32_t id) {
+        const auto now = clock_type::now();
+        std::scoped_lock lock(m_mutex);
+        const auto& [probe_id, sent] = m_probes[id % MAX_PENDING_PROBES];
+        if(probe_id != id || id == 0) return std::nullopt;
+        const auto sample = std::chrono::duration_cast<duration>(now - sent);
+        auto [it, inserted] = m_estimates.try_emplace(peer, estimate { sample, sample / 2 });
+        if(!inserted) {
+            auto& e = it->second;
+            const auto delta = sample > e.rtt ? sample - e.rtt : e.rtt - sample;
+            e.jitter = (3 * e.jitter + delta) / 4;
+            e.rtt = (7 * e.rtt + sample) / 8;
+        }
+        return it->second;
+    }
+
+    /**
+     * Gets the current estimate of a peer.
+     * @param peer the peer.
+     * @return the estimate, or nothing if the peer has never answered a probe.
+     */
+    [[nodiscard]] std::optional<estimate> get(const peer_type& peer) const {
+        std::scoped_lock lock(m_mutex);
+        const auto it = m_estimates.find(peer);
+        if(it == m_estimates.end()) return std::nullopt;
+        return it->second;
+    }
+
+    /**
+     * Forgets a peer that has left the network.
+     * @param peer the peer.
+     */
+    void forget(const peer_type& peer) {
+        std::scoped_lock lock(m_mutex);
+        m_estimates.erase(peer);
+    }
+
+    /**
+     * Picks the k candidates with the lowest RTT. Candidates without an estimate come last, in their given order.
+     * @param candidates the peers to choose from.
+     * @param k the number of peers.
+     * @return up to k peers, nearest first.
+     */
+    [[nodiscard]] std::vector<peer_type> nearest(std::vector<peer_type> candidates, size_t k) const {
+        std::scoped_lock lock(m_mutex);
+        const auto key = [&](const peer_type& peer) {
+            const auto it = m_estimates.find(peer);
+            return it == m_estimates.end() ? duration::max() : it->second.rtt;
+        };
+        k = std::min(k, candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), [&](const peer_type& a, const peer_type& b) {
+            return key(a) < key(b);
+        });
+        candidates.resize(k);
+        return candidates;
+    }
+
+    /**
+     * Draws k distinct candidates at random, each with a probability proportional to 1 / (rtt + jitter), so nearby
+     * and stable peers are preferred without always picking the same ones. Candidates without an estimate are
+     * weighted as if they had the mean RTT of the others.
+     * @param candidates the peers to choose from.
+     * @param k the number of peers.
+     * @return up to k peers.
+     */
+    [[nodiscard]] std::vector<peer_type> weighted_sample(std::vector<peer_type> candidates, size_t k) {
+        std::scoped_lock lock(m_mutex);
+        std::vector<double> weights;
+        weights.reserve(candidates.size());
+        double known_total = 0;
+        size_t known = 0;
+        for(const auto& peer : candidates) {
+            const auto it = m_estimates.find(peer);
+            if(it == m_estimates.end()) {
+                weights.push_back(0);
+                continue;
+            }
+            const double cost = double((it->second.rtt + it->second.jitter).count()) + 1;
+            weights.push_back(1 / cost);
+            known_total += cost;
+            known++;
+        }
+        const double default_weight = known == 0 ? 1 : known / known_total;
+        for(auto& w : weights)
+            if(w == 0) w = default_weight;
+
+        // Sequential weighted draws without replacement
+        std::vector<peer_type> ret;
+        k = std::min(k, candidates.size());
+        while(ret.size() < k) {
+            std::discrete_distribution<size_t> dist(weights.begin(), weights.end());
+            const auto i = dist(m_rng);
+            ret.push_back(candidates[i]);
+            weights[i] = 0;
+        }
+        return ret;
+    }
+
+private:
+    std::array<std::pair<uint32_t, clock_type::time_point>, MAX_PENDING_PROBES> m_probes = {};
+    uint32_t m_last_probe = 0;
+    std::unordered_map<peer_type, estimate> m_estimates;
+    std::mt19937_64 m_rng;
+
+    mutable std::mutex m_mutex;
+};
+
+#endif //LATENCY_HPP
@@ -0,0 +1,100 @@
+#ifndef LOG_POLICY_HPP
+#define LOG_POLICY_HPP
+
+#include "logger.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+/**
+ * The kinds of events a peer manager logs.
+ */
+enum class log_event : size_t {
+    peer,           // A peer learned from a source or a 'peer' request
+    source,         // The peers received from a registry
+    sent_peer,      // A 'peer' heartbeat sent
+    recv_peer,      // A batch of 'peer' requests received
+    snippet,        // A snippet delivered
+    count,
+};
+
+
+/**
+ * Event sinks of basic_peer_manager, chosen at compile time.
+ *
+ * Every policy is a base class of the manager and states whether it keeps events:
+ *     - A policy that keeps events is a logger. Before building an entry, the manager asks it whether to keep the
+ *          event with sample(); the arguments of the entry (address strings, dates) are only built when it does.
+ *          Reports, snapshots, snippet stores and search indexes are only available with these policies.
+ *     - A policy that does not keep events only gets count() calls, with no argument built at all.
+ */
+namespace log_policy {
+
+/**
+ * Keeps every event. The default, needed for the full report sent to the registry.
+ */
+class full : public logger {
+public:
+    static constexpr bool keeps_events = true;
+
+    static constexpr bool sample(log_event) noexcept { return true; }
+};
+
+
+/**
+ * Keeps one 'peer' heartbeat sent and one batch of 'peer' requests received out of every N, which make up nearly
+ * all of the log volume, and every other event. The report stays well-formed, with its heartbeat sections thinned.
+ */
+template<size_t N>
+class sampled : public logger {
+    static_assert(N > 0, "The sampling period must be positive");
+
+public:
+    static constexpr bool keeps_events = true;
+
+    bool sample(log_event kind) noexcept {
+        if(kind != log_event::sent_peer && kind != log_event::recv_peer)
+            return true;
+        return m_seen[static_cast<size_t>(kind)].fetch_add(1, std::memory_order_relaxed) % N == 0;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(log_event::count)> m_seen = {};
+};
+
+
+/**
+ * Counts events of each kind without keeping any.
+ */
+class counting {
+public:
+    static constexpr bool keeps_events = false;
+
+    void count(log_event kind, size_t n = 1) noexcept {
+        m_counts[static_cast<size_t>(kind)].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t counted(log_event kind) const noexcept {
+        return m_counts[static_cast<size_t>(kind)].load(std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(log_event::count)> m_counts = {};
+};
+
+
+/**
+ * Discards every event; the logging code of the manager compiles down to nothing.
+ */
+class none {
+public:
+    static constexpr bool keeps_events = false;
+
+    static constexpr void count(log_event, size_t = 1) noexcept {}
+};
+
+} // log_policy
+
+#endif //LOG_POLICY_HPP
@@ -1,8 +1,13 @@
 #ifndef LOGGER_HPP
 #define LOGGER_HPP
 
+#include "search_index.hpp"
+#include "snippet_store.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -27,6 +32,17 @@ struct snippet_entry {
     std::string sender;
 };
 
+/**
+ * A copy of every log of a logger, as captured for a snapshot.
+ */
+struct log_snapshot {
+    std::unordered_set<std::string> peers;
+    std::unordered_map<std::string, source_entry> sources;
+    std::vector<peer_entry> sent_peers;
+    std::vector<peer_entry> recv_peers;
+    std::vector<snippet_entry> snippets;
+};
+
 
 /**
  * Class that records all server events that has occured in the peer manager.
@@ -35,7 +51,7 @@ class logger {
 public:
     void log_peer(const std::string& peer) {
         std::scoped_lock lock(m_mutex);
-        m_peers.insert(peer);
+        insert_peer(peer);
     }
 
     void log_source(const std::string& src, const std::unordered_set<net::address_v4>& peers) {
@@ -53,11 +69,130 @@ public:
         m_recv_peers.push_back({ to, from, clocks::get_current_time_str() });
     }
 
+    /**
+     * Logs a batch of received 'peer' requests with a single lock acquisition.
+     * @param peers the distinct peers seen in the batch.
+     * @param received the (to, from) pair of every request in the batch.
+     */
+    void log_recv_peers(const std::vector<std::string>& peers, const std::vector<std::pair<std::string, std::string>>& received) {
+        const auto date = clocks::get_current_time_str();
+        std::scoped_lock lock(m_mutex);
+        for(const auto& peer : peers)
+            insert_peer(peer);
+        for(const auto& [to, from] : received)
+            m_recv_peers.push_back({ to, from, date });
+    }
+
     void log_snippet(size_t timestamp, const std::string& snippet, const std::string& sender) {
+        if(m_index)
+            m_index->add(timestamp, sender, snippet);
+        if(m_store) {
+            m_store->append(timestamp, sender, snippet);
+            return;
+        }
         std::scoped_lock lock(m_mutex);
         m_snippets.push_back({ timestamp, snippet, sender });
     }
 
+    /**
+     * Persists all further snippets into the given store instead of keeping them in memory.
+     * Must be called before the logger is shared between threads.
+     * @param store the snippet store.
+     */
+    void attach_store(std::shared_ptr<snippet_store> store) noexcept {
+        m_store = std::move(store);
+    }
+
+    /**
+     * Indexes all further snippets for search. Snippets already logged are indexed first; their arrival time is not
+     * logged, so they do not match queries filtered by arrival time.
+     * Must be called before the logger is shared between threads.
+     * @param index the search index.
+     */
+    void attach_index(std::shared_ptr<search_index> index) {
+        m_index = std::move(index);
+        visit_snippets([&](size_t timestamp, std::string_view message, std::string_view sender) {
+            m_index->add(timestamp, sender, message, clocks::time_type());
+        });
+    }
+
+    /**
+     * Bounds the number of distinct peers in the peer log; further peers are only counted, see dropped_peers().
+     * @param capacity the largest number of peers logged, or 0 for no bound.
+     */
+    void limit_peer_log(size_t capacity) {
+        std::scoped_lock lock(m_mutex);
+        m_peer_capacity = capacity;
+    }
+
+    /**
+     * Gets the number of peers left out of the peer log because it was full.
+     */
+    [[nodiscard]] uint64_t dropped_peers() const {
+        std::scoped_lock lock(m_mutex);
+        return m_dropped_peers;
+    }
+
+    /**
+     * Runs the retention and compaction of the attached snippet store, if any.
+     */
+    void maintain_store() {
+        if(m_store)
+            m_store->maintain();
+    }
+
+    /**
+     * Visits every logged snippet, either from the attached store or from memory.
+     * @param fn a callable taking the timestamp, message and sender of a snippet.
+     */
+    template<typename Fn>
+    void visit_snippets(Fn&& fn) const {
+        if(m_store) {
+            m_store->scan(0, std::numeric_limits<uint64_t>::max(), [&](const snippet_view& view) {
+                fn(static_cast<size_t>(view.timestamp), view.message, view.sender);
+            });
+            return;
+        }
+        for(const auto& snippet : m_snippets)
+            fn(snippet.timestamp, std::string_view(snippet.message), std::string_view(snippet.sender));
+    }
+
+    /**
+     * Brings a copy of the logs up to date. The event logs are append-only, so only the entries added since the
+     * previous call are copied while the lock is held.
+     * @param copy the copy to update; it must only ever be updated from this logger.
+     */
+    void copy_logs(log_snapshot& copy) const {
+        std::scoped_lock lock(m_mutex);
+        copy.peers = m_peers;
+        copy.sources = m_sources;
+        copy.sent_peers.insert(copy.sent_peers.end(), m_sent_peers.begin() + copy.sent_peers.size(), m_sent_peers.end());
+        copy.recv_peers.insert(copy.recv_peers.end(), m_recv_peers.begin() + copy.recv_peers.size(), m_recv_peers.end());
+        copy.snippets.insert(copy.snippets.end(), m_snippets.begin() + copy.snippets.size(), m_snippets.end());
+    }
+
+    /**
+     * Merges logs restored from a snapshot. Restored events are placed before the events of this run.
+     * With a snippet store attached, restored snippets the store does not hold yet are appended to it instead, so
+     * they are visited and reported like the stored ones; the store itself is the durable copy of the snippets.
+     * @param logs the restored logs.
+     */
+    void restore_logs(log_snapshot&& logs) {
+        if(m_store) {
+            merge_into_store(logs.snippets);
+            logs.snippets.clear();
+        }
+        std::scoped_lock lock(m_mutex);
+        m_peers.insert(logs.peers.begin(), logs.peers.end());
+        m_sources.merge(logs.sources);
+        logs.sent_peers.insert(logs.sent_peers.end(), m_sent_peers.begin(), m_sent_peers.end());
+        logs.recv_peers.insert(logs.recv_peers.end(), m_recv_peers.begin(), m_recv_peers.end());
+        logs.snippets.insert(logs.snippets.end(), m_snippets.begin(), m_snippets.end());
+        m_sent_peers = std::move(logs.sent_peers);
+        m_recv_peers = std::move(logs.recv_peers);
+        m_snippets = std::move(logs.snippets);
+    }
+
     const std::unordered_set<std::string>& peer_log() const noexcept {
         return m_peers;
     }
@@ -79,13 +214,49 @@ public:
     }
 
 private:
+    /**
+     * Appends the snippets missing from the attached store, e.g. when the store directory is newer than a snapshot.
+     */
+    void merge_into_store(const std::vector<snippet_entry>& snippets) {
+        if(snippets.empty()) return;
+        const auto [lowest, highest] = std::minmax_element(snippets.begin(), snippets.end(), [](const auto& a, const auto& b) {
+            return a.timestamp < b.timestamp;
+        });
+        const auto key = [](uint64_t timestamp, std::string_view sender, std::string_view message) {
+            return std::to_string(timestamp) + ' ' + std::string(sender) + ' ' + std::string(message);
+        };
+        std::unordered_set<std::string> stored;
+        m_store->scan(lowest->timestamp, highest->timestamp, [&](const snippet_view& view) {
+            stored.insert(key(view.timestamp, view.sender, view.message));
+        });
+        for(const auto& snippet : snippets) {
+            if(stored.insert(key(snippet.timestamp, snippet.sender, snippet.message)).second)
+                m_store->append(snippet.timestamp, snippet.sender, snippet.message);
+        }
+    }
+
+    /**
+     * Adds a peer to the peer log unless it is full. Must be called with the lock held.
+     */
+    void insert_peer(const std::string& peer) {
+        if(m_peer_capacity && m_peers.size() >= m_peer_capacity && !m_peers.count(peer)) {
+            m_dropped_peers++;
+            return;
+        }
+        m_peers.insert(peer);
+    }
+
     std::unordered_set<std::string> m_peers;
     std::unordered_map<std::string, source_entry> m_sources;
     std::vector<peer_entry> m_sent_peers;
     std::vector<peer_entry> m_recv_peers;
     std::vector<snippet_entry> m_snippets;
+    std::shared_ptr<snippet_store> m_store;
+    std::shared_ptr<search_index> m_index;
+    size_t m_peer_capacity = 0;
+    uint64_t m_dropped_peers = 0;
 
-    std::mutex m_mutex;
+    mutable std::mutex m_mutex;
 };
 
 #endif // LOGGER_HPP
@@ -1,31 +1,197 @@
 #include "net/socket_address.hpp"
 #include "registry.hpp"
 #include "peer_manager.hpp"
+#include "search_index.hpp"
+#include "sharded_peer_manager.hpp"
 #include "snippet_manager.hpp"
+#include "snippet_store.hpp"
 
 #include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+
+/**
+ * Parses the optional '--key=value' (or '--flag') arguments that follow the positional arguments.
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @param first the index of the first optional argument.
+ * @return a map of option names (without the leading dashes) to their values.
+ */
+std::unordered_map<std::string, std::string> parse_options(int argc, const char* argv[], int first) {
+    std::unordered_map<std::string, std::string> options;
+    for(int i = first; i < argc; i++) {
+        const std::string arg = argv[i];
+        if(!strings::starts_with(arg, "--")) {
+            std::cerr << "Ignoring argument '" << arg << "'" << std::endl;
+            continue;
+        }
+        const auto pos = arg.find('=');
+        options[arg.substr(2, pos - 2)] = pos == std::string::npos ? "" : arg.substr(pos + 1);
+    }
+    return options;
+}
+
+/**
+ * Options of features that the thread-per-core mode (--shards) does not implement.
+ */
+constexpr const char* UNSUPPORTED_OPTIONS[] = {
+        "data-dir", "search", "snapshot", "channels", "view-size", "flow-control", "fec", "faults", "fault-seed",
+        "busy-poll", "kernel-busy-poll", "watchdog", "trace", "integrity", "bulk", "max-peers", "discovery" };
 
 
 int main(int argc, const char* argv[]) {
-    if(argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <team name> <port>";
+    if(argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <team name> <port> [--data-dir=<path>] [--search] [--snapshot=<path>] [--channels=<a,b,...>] [--view-size=<n>] [--flow-control] [--fec=<k>,<r>] [--busy-poll=<max us>] [--kernel-busy-poll] [--faults=<loss=p,duplicate=p,reorder=p,delay=us,jitter=us>] [--fault-seed=<n>] [--shards=<n>] [--watchdog=<ms>] [--trace=<path>] [--flight-recorder=<path>] [--integrity[=required]] [--bulk[=<segment size>]] [--wal=<path>[,none|interval|commit]] [--max-peers=<n>[,verified]] [--discovery[=<local ip>[,<group:port>]]] [--log-level=<debug|info|warning|error>]";
         return EXIT_FAILURE;
     }
     const std::string name = argv[1];
     const size_t port = std::stoul(argv[2]);
+    const auto options = parse_options(argc, argv, 3);
+    if(options.count("shards")) {
+        for(const auto* option : UNSUPPORTED_OPTIONS) {
+            if(options.count(option)) {
+                std::cerr << "--" << option << " is not available with --shards" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if(options.count("log-level")) {
+        const auto& level = options.at("log-level");
+        diag::set_level(level == "debug" ? diag::severity::debug : level == "warning" ? diag::severity::warning
+                      : level == "error" ? diag::severity::error : diag::severity::info);
+    }
+    flight::install(options.count("flight-recorder") ? options.at("flight-recorder") : "flight-" + std::to_string(port) + ".bin");
     const net::address_v4 addr = { "136.159.5.22", 55921 };
 
     registry::context ctx = { name };
-    std::cout << "Getting initial peers..." << std::endl;
-    registry::run(net::address_v4(port), addr, ctx);
+    const bool discover = options.count("discovery") != 0;
+    discovery::options discovery_opts;
+    if(discover) {
+        // The registry is only a fallback, asked for peers while discovery runs
+        const auto& value = options.at("discovery");
+        const auto comma = value.find(',');
+        if(comma != std::string::npos) {
+            const auto& [group, group_port] = strings::split(value.substr(comma + 1), ':');
+            discovery_opts.group = { group, static_cast<in_port_t>(std::stoul(group_port)) };
+        }
+        const auto local = value.substr(0, comma);
+        ctx.address = local.empty() ? discovery::local_address(discovery_opts.group, static_cast<in_port_t>(port))
+                                    : net::address_v4(local, static_cast<in_port_t>(port));
+    } else {
+        std::cout << "Getting initial peers..." << std::endl;
+        registry::run(net::address_v4(port), addr, ctx);
+    }
 
     net::io_context ioc;
-    const auto snippets = std::make_shared<snippet_manager>(ioc);
+    if(options.count("wal")) {
+        const auto& value = options.at("wal");
+        const auto comma = value.find(',');
+        wal_options wal_opts;
+        if(comma != 0 && !value.empty())
+            wal_opts.path = value.substr(0, comma);
+        const auto level = comma == std::string::npos ? "" : value.substr(comma + 1);
+        if(level == "none")
+            wal_opts.level = durability::none;
+        else if(level == "interval")
+            wal_opts.level = durability::interval;
+        ioc.attach_journal(std::make_shared<outgoing_log>(wal_opts));
+        if(ioc.has_outgoing())
+            std::cout << "Replaying unsent snippets from " << wal_opts.path << std::endl;
+    }
+    const auto index    = options.count("search") ? std::make_shared<search_index>() : nullptr;
+    const auto snippets = std::make_shared<snippet_manager>(ioc, index);
+    if(options.count("shards")) {
+        // Thread-per-core mode: only the base protocol and the journal are available
+        const auto shards = options.at("shards").empty() ? std::thread::hardware_concurrency() : std::stoul(options.at("shards"));
+        const auto node = std::make_shared<sharded_peer_manager>(ioc, addr, ctx.peers, ctx.address, shards);
+        snippets->run();
+        node->run();
+        snippets->close();
+
+        std::cout << "Sending report..." << std::endl;
+        ctx.report = node->report();
+        registry::run(net::address_v4(port), addr, ctx);
+        return 0;
+    }
     const auto manager  = std::make_shared<peer_manager>(ioc, addr, ctx.peers, std::make_shared<shared_state>(ctx.address));
+    if(options.count("data-dir")) {
+        store_options store_opts;
+        store_opts.directory = options.at("data-dir");
+        manager->attach_store(std::make_shared<snippet_store>(store_opts));
+    }
+    if(options.count("snapshot")) {
+        if(manager->restore_snapshot(options.at("snapshot")))
+            std::cout << "Restored snapshot " << options.at("snapshot") << std::endl;
+        manager->enable_snapshots(options.at("snapshot"));
+    }
+    if(index)
+        manager->attach_index(index);
+    if(options.count("channels")) {
+        std::stringstream list(options.at("channels"));
+        for(std::string channel; std::getline(list, channel, ',');)
+            manager->subscribe(channel);
+    }
+    if(options.count("max-peers")) {
+        const auto& value = options.at("max-peers");
+        const auto comma = value.find(',');
+        manager->limit_peers(std::stoul(value.substr(0, comma)), comma != std::string::npos && value.substr(comma + 1) == "verified");
+    }
+    if(options.count("view-size"))
+        manager->enable_sampling(std::stoul(options.at("view-size")));
+    if(options.count("flow-control"))
+        manager->enable_flow_control();
+    if(options.count("fec")) {
+        const auto& value = options.at("fec");
+        const auto comma = value.find(',');
+        manager->enable_fec(value.empty() ? fec_encoder::DEFAULT_BLOCK_SIZE : std::stoul(value.substr(0, comma)),
+                            comma == std::string::npos ? fec_encoder::DEFAULT_REDUNDANCY : std::stoul(value.substr(comma + 1)));
+    }
+    if(options.count("faults")) {
+        const auto seed = options.count("fault-seed") ? std::stoull(options.at("fault-seed")) : 1;
+        manager->enable_fault_injection(std::make_shared<net::fault_injector>(net::fault_options::parse(options.at("faults")), seed));
+    }
+    if(options.count("busy-poll") || options.count("kernel-busy-poll")) {
+        spin_options spin_opts;
+        if(options.count("busy-poll") && !options.at("busy-poll").empty())
+            spin_opts.max_budget = std::chrono::microseconds(std::stoul(options.at("busy-poll")));
+        spin_opts.kernel = options.count("kernel-busy-poll") != 0;
+        manager->enable_busy_poll(spin_opts);
+    }
+    if(options.count("trace"))
+        manager->enable_tracing();
+    if(options.count("integrity"))
+        manager->enable_integrity(options.at("integrity") == "required");
+    if(options.count("bulk") && options.at("bulk").empty())
+        manager->enable_bulk_transfer();
+    else if(options.count("bulk")) {
+        const auto segment_size = std::stoul(options.at("bulk"));
+        if(segment_size > peer_manager::MAX_SEGMENT) {
+            std::cerr << "--bulk segment size must be at most " << peer_manager::MAX_SEGMENT << std::endl;
+            return EXIT_FAILURE;
+        }
+        manager->enable_bulk_transfer(segment_size);
+    }
+    if(options.count("watchdog"))
+        manager->enable_watchdog(options.at("watchdog").empty() ? watchdog::DEFAULT_THRESHOLD : std::chrono::milliseconds(std::stoul(options.at("watchdog"))));
+    if(discover) {
+        manager->enable_discovery(discovery_opts);
+        std::cout << "Discovering peers from " << ctx.address << "..." << std::endl;
+        // The fetch owns its own context and is never joined, so an unreachable registry cannot hold up shutdown
+        std::thread([fetch_ctx = std::make_shared<registry::context>(ctx), addr, port, manager] {
+            registry::run(net::address_v4(static_cast<in_port_t>(port)), addr, *fetch_ctx);
+            manager->add_peers(fetch_ctx->peers);
+        }).detach();
+    }
     snippets->run();
     manager->run();     // This method is blocking, and will run once the peer manager receives 'stop'
     snippets->close();
+    if(options.count("watchdog"))
+        std::cout << "Loop stalls:\n" << manager->stalls().report();
+    if(options.count("trace") && manager->dump_trace(options.at("trace")))
+        std::cout << "Wrote trace to " << options.at("trace") << std::endl;
 
+    diag::flush();
     std::cout << "Sending report..." << std::endl;
     ctx.report = assemble_report(*manager);
     registry::run(net::address_v4(port), addr, ctx);
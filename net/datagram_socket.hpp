@@ -4,6 +4,19 @@
 #include "buffer.hpp"
 #include "socket.hpp"
 
+#include <netinet/udp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
 namespace net {
 
 /**
@@ -46,7 +59,7 @@ public:
         socket_t h = create_handle(domain);
         if(base_t::check_socket_bool(h)) {
             base_t::reset(h);
-            bind(addr);
+            base_t::bind(addr);
         }
     }
 
@@ -161,6 +174,95 @@ public:
         return recv_from(payload, 0, src_addr);
     }
 
+    /**
+     * Sends a buffer as a train of datagrams of segment_size bytes each (the last one may be shorter).
+     * Uses UDP generic segmentation offload (UDP_SEGMENT), which hands up to 64 datagrams to the kernel in a single
+     * call, and falls back to one sendto per datagram on kernels without it.
+     * @param payload the datagrams, back to back.
+     * @param segment_size the size of every datagram but the last.
+     * @param dst_addr the destination.
+     * @return the number of bytes sent, or -1 if a send failed.
+     */
+    template<address_family Family>
+    ssize_t send_segments(const const_buffer& payload, size_t segment_size, const socket_address<Family>& dst_addr) const noexcept {
+        if(segment_size == 0) return -1;
+        const auto* data = static_cast<const char*>(payload.data());
+        const size_t per_call = std::max<size_t>(1, std::min<size_t>(MAX_SEGMENTS, MAX_GSO_PAYLOAD / segment_size));
+        size_t sent = 0;
+        while(sent < payload.size()) {
+            const size_t size = std::min(payload.size() - sent, per_call * segment_size);
+            bool segmented = size > segment_size && gso_state().load(std::memory_order_relaxed) != support::absent;
+            if(segmented) {
+                if(send_gso(data + sent, size, segment_size, dst_addr) >= 0) {
+                    gso_state().store(support::present, std::memory_order_relaxed);
+                } else if(errno == EINVAL || errno == ENOPROTOOPT || errno == EIO || errno == EOPNOTSUPP) {
+                    gso_state().store(support::absent, std::memory_order_relaxed);
+                    segmented = false;
+                } else {
+                    return -1;
+                }
+            }
+            if(!segmented) {
+                for(size_t offset = 0; offset < size; offset += segment_size) {
+                    if(send_to(const_buffer(data + sent + offset, std::min(segment_size, size - offset)), 0, dst_addr) < 0)
+                        return -1;
+                }
+            }
+            sent += size;
+        }
+        return static_cast<ssize_t>(sent);
+    }
+
+    /**
+     * Checks if the kernel accepted segmentation offload so far. Unknown until send_segments() has tried it.
+     * @return true if UDP_SEGMENT sends are known to work.
+     */
+    [[nodiscard]] static bool has_gso() noexcept {
+        return gso_state().load(std::memory_order_relaxed) == support::present;
+    }
+
+    /**
+     * Lets the kernel coalesce consecutive datagrams of the same flow into one receive (UDP_GRO), to be read with
+     * recv_segments().
+     * @return true if the kernel supports it, false otherwise; recv_segments() still works either way.
+     */
+    bool enable_gro() const noexcept {
+        return base_t::set_option(SOL_UDP, UDP_GRO, int(1));
+    }
+
+    /**
+     * Receives one or more datagrams from the same sender, coalesced by the kernel if UDP_GRO is enabled.
+     * @param payload the buffer to receive into; 64KB fits any coalesced receive.
+     * @param flags the receive flags.
+     * @param src_addr the sender.
+     * @param segment_size the size of every datagram but the last, or the size of the receive if not coalesced.
+     * @return the number of bytes received, or -1 on error.
+     */
+    template<address_family Family>
+    ssize_t recv_segments(const mutable_buffer& payload, int flags, socket_address<Family>* src_addr, size_t& segment_size) const noexcept {
+        iovec iov = { payload.data(), payload.size() };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr msg = {};
+        msg.msg_name = src_addr ? src_addr->sockaddr_ptr() : nullptr;
+        msg.msg_namelen = src_addr ? src_addr->size() : 0;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        const auto len = base_t::check_return(::recvmsg(base_t::handle(), &msg, flags));
+        if(len < 0) return len;
+        segment_size = static_cast<size_t>(len);
+        for(auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int size;
+                std::memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                if(size > 0)
+                    segment_size = static_cast<size_t>(size);
+            }
+        }
+        return len;
+    }
+
     /**
      * Receives a message from another socket.
      * @param payload
@@ -180,6 +282,40 @@ protected:
     static socket_t create_handle(int domain) {
         return socket_t(::socket(domain, COMM_TYPE, 0));
     }
+
+private:
+    static constexpr size_t MAX_SEGMENTS    = 64;          // UDP_MAX_SEGMENTS in the kernel
+    static constexpr size_t MAX_GSO_PAYLOAD = 65507;       // Largest UDP payload over IPv4
+
+    enum class support { unknown, present, absent };
+
+    /**
+     * Whether the kernel supports UDP_SEGMENT, learned from the first segmented send.
+     */
+    static std::atomic<support>& gso_state() noexcept {
+        static std::atomic<support> state = support::unknown;
+        return state;
+    }
+
+    template<address_family Family>
+    ssize_t send_gso(const char* data, size_t size, size_t segment_size, const socket_address<Family>& dst_addr) const noexcept {
+        iovec iov = { const_cast<char*>(data), size };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+        msghdr msg = {};
+        msg.msg_name = const_cast<sockaddr*>(dst_addr.sockaddr_ptr());
+        msg.msg_namelen = dst_addr.size();
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        auto* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        const auto gso_size = static_cast<uint16_t>(segment_size);
+        std::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+        return base_t::check_return(::sendmsg(base_t::handle(), &msg, 0));
+    }
 };
 
 } // net
@@ -0,0 +1,310 @@
+#ifndef FAULT_INJECTION_HPP
+#define FAULT_INJECTION_HPP
+
+#include "buffer.hpp"
+#include "datagram_socket.hpp"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace net {
+
+/**
+ * Probabilities and latencies of the faults injected into datagram traffic.
+ */
+struct fault_options {
+    double loss      = 0;           // Probability of dropping a datagram
+    double duplicate = 0;           // Probability of delivering a datagram twice
+    double reorder   = 0;           // Probability of holding a datagram back so later ones overtake it
+    microseconds delay        = microseconds(0);    // Fixed latency added to every datagram
+    microseconds jitter       = microseconds(0);    // Uniformly distributed latency added on top of the delay
+    microseconds reorder_hold = milliseconds(2);    // Extra latency of a reordered datagram
+
+    /**
+     * Parses a comma-separated list of faults, e.g. "loss=0.1,duplicate=0.01,delay=2000,jitter=500".
+     * Latencies are in microseconds. Unknown keys are ignored.
+     * @param spec the list of faults.
+     * @return the parsed options.
+     */
+    static fault_options parse(const std::string& spec) {
+        fault_options ret;
+        std::stringstream list(spec);
+        for(std::string item; std::getline(list, item, ',');) {
+            const auto pos = item.find('=');
+            if(pos == std::string::npos) continue;
+            const auto key = item.substr(0, pos);
+            const auto value = std::stod(item.substr(pos + 1));
+            if(key == "loss")               ret.loss = value;
+            else if(key == "duplicate")     ret.duplicate = value;
+            else if(key == "reorder")       ret.reorder = value;
+            else if(key == "delay")         ret.delay = microseconds(static_cast<int64_t>(value));
+            else if(key == "jitter")        ret.jitter = microseconds(static_cast<int64_t>(value));
+            else if(key == "reorder_hold")  ret.reorder_hold = microseconds(static_cast<int64_t>(value));
+        }
+        return ret;
+    }
+};
+
+
+/**
+ * Draws the faults of every datagram from a seeded generator, and sends delayed datagrams from its own thread.
+ * One injector can be shared by the sockets of several threads; its options can be changed at any time.
+ */
+class fault_injector {
+public:
+    using clock_type = steady_clock;
+
+    struct statistics {
+        uint64_t dropped    = 0;
+        uint64_t duplicated = 0;
+        uint64_t reordered  = 0;
+        uint64_t delayed    = 0;
+    };
+
+    /**
+     * The faults drawn for one datagram.
+     */
+    struct verdict {
+        bool drop = false;
+        size_t copies = 1;
+        microseconds latency = microseconds(0);     // 0 if the datagram goes through right away
+    };
+
+    explicit fault_injector(fault_options opts = {}, uint64_t seed = 1)
+            : m_options(opts), m_rng(seed) {}
+
+    ~fault_injector() {
+        {
+            std::scoped_lock lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cv.notify_all();
+        if(m_timer.joinable())
+            m_timer.join();
+    }
+
+    /**
+     * Replaces the faults injected from now on.
+     * @param opts the new options.
+     */
+    void configure(const fault_options& opts) {
+        std::scoped_lock lock(m_mutex);
+        m_options = opts;
+    }
+
+    [[nodiscard]] fault_options options() const {
+        std::scoped_lock lock(m_mutex);
+        return m_options;
+    }
+
+    [[nodiscard]] statistics stats() const {
+        std::scoped_lock lock(m_mutex);
+        return m_stats;
+    }
+
+    /**
+     * Draws the faults of a datagram.
+     * @return the verdict.
+     */
+    verdict decide() {
+        std::scoped_lock lock(m_mutex);
+        verdict ret;
+        std::uniform_real_distribution<double> coin(0, 1);
+        if(coin(m_rng) < m_options.loss) {
+            m_stats.dropped++;
+            ret.drop = true;
+            return ret;
+        }
+        if(coin(m_rng) < m_options.duplicate) {
+            m_stats.duplicated++;
+            ret.copies = 2;
+        }
+        ret.latency = m_options.delay;
+        if(m_options.jitter.count() > 0)
+            ret.latency += microseconds(std::uniform_int_distribution<int64_t>(0, m_options.jitter.count())(m_rng));
+        if(coin(m_rng) < m_options.reorder) {
+            m_stats.reordered++;
+            ret.latency += m_options.reorder_hold;
+        }
+        if(ret.latency.count() > 0)
+            m_stats.delayed++;
+        return ret;
+    }
+
+    /**
+     * Runs a task from the timer thread once it is due.
+     * @param due the time to run the task.
+     * @param task the task.
+     */
+    void schedule(clock_type::time_point due, std::function<void()> task) {
+        {
+            std::scoped_lock lock(m_mutex);
+            m_tasks.emplace(due, std::move(task));
+            if(!m_timer.joinable())
+                m_timer = std::thread([this] { run_timer(); });
+        }
+        m_cv.notify_all();
+    }
+
+private:
+    void run_timer() {
+        std::unique_lock lock(m_mutex);
+        while(!m_stopped) {
+            if(m_tasks.empty()) {
+                m_cv.wait(lock);
+                continue;
+            }
+            const auto due = m_tasks.begin()->first;
+            if(clock_type::now() < due) {
+                m_cv.wait_until(lock, due);
+                continue;
+            }
+            auto task = std::move(m_tasks.begin()->second);
+            m_tasks.erase(m_tasks.begin());
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    fault_options m_options;
+    std::mt19937_64 m_rng;
+    statistics m_stats;
+
+    std::multimap<clock_type::time_point, std::function<void()>> m_tasks;
+    std::thread m_timer;
+    std::condition_variable m_cv;
+    bool m_stopped = false;
+
+    mutable std::mutex m_mutex;
+};
+
+
+/**
+ * Decorates a datagram socket with the faults drawn by a fault_injector, on both send_to and recv_from.
+ *
+ * Sent datagrams that are delayed are sent from the injector's thread through a duplicate of the socket handle,
+ * made once per decorator, so a decorator should be kept rather than built for every send. Received datagrams that
+ * are delayed are held back by the decorator and returned once they are due, so a decorator should only be used by
+ * one receiving thread.
+ */
+template<typename Socket>
+class faulty_socket {
+public:
+    using address_t = typename Socket::address_t;
+
+    faulty_socket(const Socket& sock, fault_injector& injector)
+            : m_socket(sock), m_delayed(std::make_shared<Socket>(sock.clone())), m_injector(injector) {}
+
+    [[nodiscard]] const Socket& socket() const noexcept { return m_socket; }
+
+    /**
+     * Sends a message to another socket, unless it is dropped or delayed.
+     * @return the size of the message (also for dropped messages), or -1 on error.
+     */
+    ssize_t send_to(const const_buffer& payload, int flags, const address_t& dst_addr) const {
+        const auto verdict = m_injector.decide();
+        if(verdict.drop)
+            return static_cast<ssize_t>(payload.size());
+        if(verdict.latency.count() == 0) {
+            ssize_t ret = 0;
+            for(size_t i = 0; i < verdict.copies && ret >= 0; i++)
+                ret = m_socket.send_to(payload, flags, dst_addr);
+            return ret;
+        }
+        auto data = std::make_shared<std::string>(static_cast<const char*>(payload.data()), payload.size());
+        for(size_t i = 0; i < verdict.copies; i++) {
+            m_injector.schedule(fault_injector::clock_type::now() + verdict.latency, [sock = m_delayed, data, flags, dst_addr] {
+                sock->send_to(const_buffer(data->data(), data->size()), flags, dst_addr);
+            });
+        }
+        return static_cast<ssize_t>(payload.size());
+    }
+
+    ssize_t send_to(const const_buffer& payload, const address_t& dst_addr) const {
+        return send_to(payload, 0, dst_addr);
+    }
+
+    /**
+     * Receives a message from another socket, skipping dropped messages and holding back delayed ones.
+     * With MSG_DONTWAIT, returns -1 with errno set to EAGAIN if no message is due.
+     * @return the size of the message, or -1 on error.
+     */
+    ssize_t recv_from(const mutable_buffer& payload, int flags, address_t* src_addr = nullptr) {
+        char data[65536];
+        while(true) {
+            const auto now = fault_injector::clock_type::now();
+            if(!m_held.empty() && m_held.top().due <= now) {
+                const auto& held = m_held.top();
+                const auto size = std::min(payload.size(), held.data.size());
+                std::memcpy(payload.data(), held.data.data(), size);
+                if(src_addr) *src_addr = held.sender;
+                m_held.pop();
+                return static_cast<ssize_t>(size);
+            }
+            int timeout = -1;
+            if(flags & MSG_DONTWAIT)
+                timeout = 0;
+            else if(!m_held.empty())
+                timeout = static_cast<int>(ceil<milliseconds>(m_held.top().due - now).count());
+            pollfd fd = { m_socket.handle(), POLLIN, 0 };
+            const int ready = ::poll(&fd, 1, timeout);
+            if(ready == 0 && (flags & MSG_DONTWAIT)) {
+                errno = EAGAIN;
+                return -1;
+            }
+            if(ready <= 0) continue;
+
+            address_t sender;
+            const auto len = m_socket.recv_from(buffer(data, sizeof(data)), MSG_DONTWAIT, &sender);
+            if(len < 0) continue;
+            const auto verdict = m_injector.decide();
+            if(verdict.drop) continue;
+            // Delays count from the arrival, not from before the wait
+            const auto arrival = fault_injector::clock_type::now();
+            for(size_t i = verdict.latency.count() == 0 ? 1 : 0; i < verdict.copies; i++)
+                m_held.push({ arrival + verdict.latency, std::string(data, size_t(len)), sender });
+            if(verdict.latency.count() == 0) {
+                const auto size = std::min(payload.size(), size_t(len));
+                std::memcpy(payload.data(), data, size);
+                if(src_addr) *src_addr = sender;
+                return static_cast<ssize_t>(size);
+            }
+        }
+    }
+
+    ssize_t recv_from(const mutable_buffer& payload, address_t* src_addr = nullptr) {
+        return recv_from(payload, 0, src_addr);
+    }
+
+private:
+    struct held_datagram {
+        fault_injector::clock_type::time_point due;
+        std::string data;
+        address_t sender;
+
+        bool operator>(const held_datagram& rhs) const noexcept { return due > rhs.due; }
+    };
+
+    const Socket& m_socket;
+    std::shared_ptr<Socket> m_delayed;      // Sends the delayed datagrams from the injector's thread
+    fault_injector& m_injector;
+    std::priority_queue<held_datagram, std::vector<held_datagram>, std::greater<>> m_held;
+};
+
+} // net
+
+#endif //FAULT_INJECTION_HPP
@@ -347,7 +347,7 @@ protected:
     /**
      *
      */
-    void set_last_error() noexcept {
+    void set_last_error() const noexcept {
         m_last_error = get_last_error();
     }
 
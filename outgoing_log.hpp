@@ -0,0 +1,293 @@
+#ifndef OUTGOING_LOG_HPP
+#define OUTGOING_LOG_HPP
+
+#include "crc32c.hpp"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+/**
+ * How long an outgoing snippet takes to become durable, traded against the cost of appending it.
+ */
+enum class durability {
+    none,           // Written to the page cache: survives a crash of the process, not of the machine
+    interval,       // Flushed to disk every sync interval by a background thread: loses at most one interval
+    commit,         // append() returns once the snippet is on disk; concurrent appends share one flush
+};
+
+/**
+ * Configuration of an outgoing log.
+ */
+struct wal_options {
+    std::string path = "outgoing.wal";
+    durability level = durability::commit;
+    std::chrono::milliseconds sync_interval = std::chrono::milliseconds(10);   // For durability::interval
+    size_t compact_bytes = 1 << 20;         // The log is emptied past this size once nothing is pending
+};
+
+/**
+ * Counters of an outgoing log.
+ */
+struct wal_stats {
+    uint64_t appends;
+    uint64_t syncs;                 // fdatasync calls; appends / syncs is the group commit batch size
+    uint64_t pending;               // Appended but not acknowledged yet
+};
+
+
+/**
+ * A write-ahead log of the snippets typed by the user, so that snippets still queued for broadcast when the node
+ * stops or crashes are sent after a restart.
+ *
+ * Every snippet is appended as a record before it is queued, and acknowledged once it has been handed to the peers.
+ * On opening, the records appended but never acknowledged are recovered, in order, and the log is rewritten with
+ * only those. Acknowledgements are never flushed on their own, so a crash may send a snippet twice, never zero times.
+ *
+ * Flushes use group commit: a single thread calls fdatasync for every record written since the previous call, while
+ * appenders keep writing. Under load a flush covers many appends, so commit durability costs far less than one
+ * flush per snippet.
+ *
+ * Record layout (host byte order): u64 sequence, u32 payload size, u16 type, u16 magic, u32 CRC32C of the header
+ * fields and the payload, u32 reserved, then the payload. A torn or corrupt record ends the log.
+ */
+class outgoing_log {
+    static constexpr uint16_t RECORD_MAGIC = 0x574c;    // "WL"
+
+    enum class record_type : uint16_t {
+        append      = 1,
+        acknowledge = 2,
+    };
+
+    struct record_header {
+        uint64_t seq;
+        uint32_t size;
+        uint16_t type;
+        uint16_t magic;
+        uint32_t crc;
+        uint32_t reserved;
+    };
+    static_assert(sizeof(record_header) == 24, "Record header must not contain padding.");
+
+public:
+    /**
+     * Opens (or creates) the log, recovers the snippets that were never acknowledged and starts the flushing thread.
+     * @param opts the log configuration.
+     */
+    explicit outgoing_log(wal_options opts = {}) : m_options(std::move(opts)) {
+        recover();
+        if(m_options.level != durability::none)
+            m_syncer = std::thread([this] { sync_loop(); });
+    }
+
+    outgoing_log(const outgoing_log&) = delete;
+    outgoing_log& operator=(const outgoing_log&) = delete;
+
+    ~outgoing_log() {
+        {
+            std::scoped_lock lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        if(m_syncer.joinable())
+            m_syncer.join();
+        if(m_fd >= 0) {
+            if(m_options.level != durability::none)
+                ::fdatasync(m_fd);
+            ::close(m_fd);
+        }
+    }
+
+    /**
+     * Gets the snippets recovered when the log was opened, oldest first, with their sequence numbers.
+     */
+    [[nodiscard]] const std::vector<std::pair<uint64_t, std::string>>& recovered() const noexcept {
+        return m_recovered;
+    }
+
+    /**
+     * Appends a snippet, and waits for it to be on disk if the durability level is commit.
+     * @param message the snippet.
+     * @return the sequence number of the snippet, to acknowledge it, or 0 if it could not be written.
+     */
+    uint64_t append(std::string_view message) noexcept {
+        std::unique_lock lock(m_mutex);
+        const auto seq = m_next_seq++;
+        if(!write_record(record_type::append, seq, message))
+            return 0;
+        m_pending.insert(seq);
+        m_appends++;
+        if(m_options.level == durability::commit) {
+            const auto target = m_written;
+            m_cv.notify_all();
+            m_cv.wait(lock, [&] { return m_synced >= target || m_stopping; });
+        }
+        return seq;
+    }
+
+    /**
+     * Marks a snippet as handed to the peers, so that it is not sent again after a restart.
+     * @param seq the sequence number returned by append().
+     */
+    void acknowledge(uint64_t seq) noexcept {
+        if(seq == 0) return;
+        std::scoped_lock lock(m_mutex);
+        if(m_pending.erase(seq) == 0) return;
+        write_record(record_type::acknowledge, seq, {});
+        if(m_pending.empty() && m_file_bytes >= m_options.compact_bytes) {
+            if(::ftruncate(m_fd, 0) == 0)
+                m_file_bytes = 0;
+        }
+    }
+
+    /**
+     * Gets the counters of the log.
+     */
+    [[nodiscard]] wal_stats stats() const {
+        std::scoped_lock lock(m_mutex);
+        return { m_appends, m_syncs, m_pending.size() };
+    }
+
+private:
+    /**
+     * Reads the existing log, if any, and replaces it with a log holding only the unacknowledged snippets.
+     */
+    void recover() {
+        std::map<uint64_t, std::string> pending;
+        uint64_t last_seq = 0;
+        const int in = ::open(m_options.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(in >= 0) {
+            std::string data;
+            char chunk[1 << 16];
+            for(ssize_t n; (n = ::read(in, chunk, sizeof(chunk))) > 0;)
+                data.append(chunk, size_t(n));
+            ::close(in);
+            size_t offset = 0;
+            record_header header = {};
+            while(offset + sizeof(header) <= data.size()) {
+                std::memcpy(&header, data.data() + offset, sizeof(header));
+                const auto payload = offset + sizeof(header);
+                if(header.magic != RECORD_MAGIC || payload + header.size > data.size()
+                        || checksum(header, std::string_view(data).substr(payload, header.size)) != header.crc) {
+                    std::cerr << "Outgoing log " << m_options.path << " ends with a torn record at offset " << offset << std::endl;
+                    break;
+                }
+                if(header.type == uint16_t(record_type::append))
+                    pending[header.seq] = data.substr(payload, header.size);
+                else if(header.type == uint16_t(record_type::acknowledge))
+                    pending.erase(header.seq);
+                last_seq = std::max(last_seq, header.seq);
+                offset = payload + header.size;
+            }
+        }
+        m_next_seq = last_seq + 1;
+
+        // Rewrite the log with the pending snippets only, and swap it in atomically
+        const auto tmp_path = m_options.path + ".tmp";
+        m_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(m_fd < 0)
+            throw std::system_error(errno, std::generic_category(), "Failed to open outgoing log " + tmp_path);
+        for(auto& [seq, message] : pending) {
+            if(!write_record(record_type::append, seq, message))
+                throw std::system_error(errno, std::generic_category(), "Failed to rewrite outgoing log " + tmp_path);
+            m_pending.insert(seq);
+            m_recovered.emplace_back(seq, std::move(message));
+        }
+        if(::fdatasync(m_fd) != 0 || std::rename(tmp_path.c_str(), m_options.path.c_str()) != 0)
+            throw std::system_error(errno, std::generic_category(), "Failed to replace outgoing log " + m_options.path);
+        m_synced = m_written;
+        ::close(m_fd);
+        m_fd = ::open(m_options.path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if(m_fd < 0)
+            throw std::system_error(errno, std::generic_category(), "Failed to open outgoing log " + m_options.path);
+    }
+
+    /**
+     * Writes one record. Must be called with the lock held.
+     * @return true if the record was written, false otherwise.
+     */
+    bool write_record(record_type type, uint64_t seq, std::string_view payload) noexcept {
+        record_header header = { seq, static_cast<uint32_t>(payload.size()), static_cast<uint16_t>(type), RECORD_MAGIC, 0, 0 };
+        header.crc = checksum(header, payload);
+        iovec iov[2] = {
+                { &header, sizeof(header) },
+                { const_cast<char*>(payload.data()), payload.size() } };
+        const size_t length = sizeof(header) + payload.size();
+        const auto written = ::writev(m_fd, iov, 2);
+        if(written != static_cast<ssize_t>(length)) {
+            std::cerr << "Failed to append to outgoing log " << m_options.path << std::endl;
+            if(written > 0 && ::ftruncate(m_fd, static_cast<off_t>(m_file_bytes)) != 0)
+                std::cerr << "Failed to truncate " << m_options.path << std::endl;
+            return false;
+        }
+        m_file_bytes += length;
+        m_written += length;
+        return true;
+    }
+
+    static uint32_t checksum(const record_header& header, std::string_view payload) noexcept {
+        record_header copy = header;
+        copy.crc = 0;
+        return crc32c::compute(payload.data(), payload.size(), crc32c::compute(&copy, sizeof(copy)));
+    }
+
+    /**
+     * Flushes the records written since the previous flush, as soon as there are any with commit durability, or
+     * every sync interval with interval durability. Appends continue while a flush runs and join the next one.
+     */
+    void sync_loop() {
+        std::unique_lock lock(m_mutex);
+        while(!m_stopping) {
+            if(m_options.level == durability::interval)
+                m_cv.wait_for(lock, m_options.sync_interval, [&] { return m_stopping; });
+            else
+                m_cv.wait(lock, [&] { return m_written > m_synced || m_stopping; });
+            if(m_written == m_synced) continue;
+            const auto target = m_written;
+            lock.unlock();
+            const bool ok = ::fdatasync(m_fd) == 0;
+            lock.lock();
+            if(!ok)
+                std::cerr << "Failed to flush outgoing log " << m_options.path << std::endl;
+            m_synced = target;      // Waiters are released even on failure rather than blocking the node
+            m_syncs++;
+            m_cv.notify_all();
+        }
+    }
+
+    const wal_options m_options;
+    int m_fd = -1;
+    std::thread m_syncer;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stopping = false;
+    uint64_t m_next_seq = 1;
+    uint64_t m_written = 0;         // Bytes written since opening, never reset
+    uint64_t m_synced = 0;          // ... and known to be on disk
+    size_t m_file_bytes = 0;        // Current size of the file
+    std::set<uint64_t> m_pending;               // Sequence numbers appended but not acknowledged
+    std::vector<std::pair<uint64_t, std::string>> m_recovered;
+    uint64_t m_appends = 0;
+    uint64_t m_syncs = 0;
+};
+
+#endif //OUTGOING_LOG_HPP
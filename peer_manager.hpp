@@ -2,18 +2,39 @@
 #define PEER_MANAGER_HPP
 
 #include "net/buffer.hpp"
+#include "net/fault_injection.hpp"
 #include "net/udp.hpp"
 
+#include "busy_poll.hpp"
+#include "channels.hpp"
+#include "crc32c.hpp"
+#include "diag.hpp"
+#include "discovery.hpp"
+#include "fec.hpp"
+#include "fragments.hpp"
+#include "flight_recorder.hpp"
+#include "flow_control.hpp"
 #include "io_context.hpp"
+#include "latency.hpp"
+#include "log_policy.hpp"
 #include "logger.hpp"
+#include "peer_sampling.hpp"
 #include "shared_state.hpp"
+#include "snapshot.hpp"
+#include "trace.hpp"
+#include "watchdog.hpp"
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <deque>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <sstream>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -30,6 +51,58 @@ auto parse_request(const char* data) {
     return std::make_pair<std::string, std::string>({ data, data + 4 }, { data + 4 });
 }
 
+/**
+ * The fields of a 'peer' request (heartbeat), e.g. "10.0.0.1:5000@42#news,sports".
+ */
+struct heartbeat_request {
+    std::string address;                    // The address advertised by the sender
+    std::optional<std::string> probe;       // The id of the RTT probe to answer with a 'pong', if any
+    std::string subscriptions;              // The channel tag of the sender
+};
+
+/**
+ * Parses the contents of a 'peer' request.
+ * @param content the contents of the request.
+ * @return the fields of the heartbeat; the address is not checked.
+ */
+heartbeat_request parse_heartbeat(const std::string& content) {
+    auto [address, subscriptions] = channels::untag(content);
+    std::optional<std::string> probe;
+    if(const auto pos = address.find('@'); pos != std::string::npos) {
+        probe = address.substr(pos + 1);
+        address.resize(pos);
+    }
+    return { std::move(address), std::move(probe), std::move(subscriptions) };
+}
+
+/**
+ * The fields of a 'snip' request, e.g. "12%16@10.0.0.1:5000#news text". The tags follow the timestamp in the order
+ * gossip, trace, FEC, channel.
+ */
+struct snippet_request {
+    std::string stamp;                          // The timestamp given by the origin, as sent
+    size_t timestamp;
+    std::string channel;                        // Empty for the default channel
+    std::optional<trace::context> context;
+    std::optional<gossip::route> route;         // Set if the snippet is gossiped on behalf of its origin
+    std::string text;
+};
+
+/**
+ * Parses the contents of a 'snip' request.
+ * @param content the contents of the request.
+ * @return the fields of the snippet.
+ * @throws std::logic_error if the timestamp is invalid.
+ */
+snippet_request parse_snippet(const std::string& content) {
+    auto [token, text] = strings::split(content, ' ');
+    auto [tagged_stamp, channel] = channels::untag(token);
+    auto [routed_stamp, context] = trace::untag(fec::untag(tagged_stamp).first);
+    auto [stamp, route] = gossip::untag(routed_stamp);
+    const auto timestamp = std::stoul(stamp);
+    return { std::move(stamp), timestamp, std::move(channel), context, route, std::move(text) };
+}
+
 
 /**
  * This class manages the lifetime of the peer to peer chat server. When run the manager will handle three threads:
@@ -37,28 +110,75 @@ auto parse_request(const char* data) {
  *          as well as removes any inactive peers in the network.
  *     - A broadcast thread which multicasts any outgoing messages from the client
  *     - A listening thread which receives and handles any incoming message from other peers.
+ *
+ * Events are logged through the Log policy (see log_policy.hpp); peer_manager keeps every event.
  */
-class peer_manager : public std::enable_shared_from_this<peer_manager>, public logger {
+template<typename Log = log_policy::full>
+class basic_peer_manager : public std::enable_shared_from_this<basic_peer_manager<Log>>, public Log {
     static constexpr auto DEFAULT_KEEP_ALIVE = std::chrono::seconds(5);
     static constexpr auto DEFAULT_TIMEOUT    = std::chrono::seconds(20);
+    static constexpr auto SNAPSHOT_INTERVAL  = std::chrono::seconds(30);
+    static constexpr size_t MAX_PEER_BATCH   = 256;
+    static constexpr auto FEC_FLUSH_DELAY    = std::chrono::seconds(1);
+    static constexpr size_t DEFAULT_SEGMENT  = 1400;      // Fits an Ethernet MTU with the IP and UDP headers
+    static constexpr size_t MAX_DATAGRAM     = fec::MAX_PARITY_SIZE + crc32c::TRAILER_SIZE;     // Largest datagram read
+
+    /**
+     * Membership observations from 'peer' requests, accumulated by the listening thread while datagrams are
+     * queued on its socket and then applied to the shared state and logs at once.
+     */
+    struct peer_batch {
+        std::vector<net::address_v4> peers;                                   // Distinct peers seen
+        std::unordered_set<net::address_v4> senders;                          // ... of which heard from directly
+        std::unordered_map<net::address_v4, std::string> peer_names;
+        std::unordered_map<net::address_v4, std::string> subscriptions;      // Latest tag advertised per sender
+        std::vector<std::pair<net::address_v4, net::address_v4>> received;    // Every (sender, peer) request
+
+        void observe(const net::address_v4& peer) {
+            if(peer_names.try_emplace(peer, peer.to_string()).second)
+                peers.push_back(peer);
+        }
+
+        void observe_sender(const net::address_v4& sender) {
+            senders.insert(sender);
+            observe(sender);
+        }
+
+        [[nodiscard]] bool empty() const noexcept { return received.empty(); }
+
+        void clear() {
+            peers.clear();
+            senders.clear();
+            peer_names.clear();
+            subscriptions.clear();
+            received.clear();
+        }
+    };
 
 public:
     using address_type = net::address_v4;
     using peer_type    = net::address_v4;
     using time_type    = clocks::time_type;
 
-    explicit peer_manager(net::io_context& ioc, std::shared_ptr<shared_state> state, bool debug = false)
-            : m_socket(), m_ioc(ioc), m_state(std::move(state)), debug_mode(debug) {
+    static constexpr size_t MAX_SEGMENT = MAX_DATAGRAM;     // Largest fragment the receivers read whole
+
+    explicit basic_peer_manager(net::io_context& ioc, std::shared_ptr<shared_state> state, bool debug = false)
+            : m_socket(), m_ioc(ioc), m_state(std::move(state)), m_watchdog(watchdog::DEFAULT_THRESHOLD, debug), debug_mode(debug) {
         m_socket.bind(m_state->address());
+        m_watchdog.on_stall([](const stall_event& stall) {
+            flight::record(flight::kind::stall, static_cast<uint32_t>(stall.duration.count()));
+            flight::dump();
+        });
     }
 
-    explicit peer_manager(net::io_context& ioc, const net::address_v4& src, const std::unordered_set<peer_type>& peers, std::shared_ptr<shared_state> state, bool debug = false)
-            : peer_manager(ioc, std::move(state), debug) {
+    explicit basic_peer_manager(net::io_context& ioc, const net::address_v4& src, const std::unordered_set<peer_type>& peers, std::shared_ptr<shared_state> state, bool debug = false)
+            : basic_peer_manager(ioc, std::move(state), debug) {
         for(const auto& peer : peers) {
             m_state->join(peer);
-            log_peer(peer.to_string());
+            m_channels.add(peer);
+            log(log_event::peer, 1, [&](auto& sink) { sink.log_peer(peer.to_string()); });
         }
-        log_source(src.to_string(), peers);
+        log(log_event::source, 1, [&](auto& sink) { sink.log_source(src.to_string(), peers); });
     }
 
     /**
@@ -66,34 +186,332 @@ public:
      * The lifetime of the manager depends on the listening thread and will halt once the listening thread finishes.
      */
     void run() {
-        std::thread([self = shared_from_this()](net::udp::socket s) {
+        if(m_watching)
+            m_watchdog.start();
+        std::thread([self = this->shared_from_this()](net::udp::socket s) {
             self->update(s);
         }, std::move(m_socket.clone())).detach();
 
-        std::thread([self = shared_from_this()](net::udp::socket s) {
+        std::thread([self = this->shared_from_this()](net::udp::socket s) {
             self->broadcast(s);
         }, std::move(m_socket.clone())).detach();
 
-        auto listen_thread = std::thread([self = shared_from_this()](net::udp::socket s) {
+        if(m_discovery) {
+            std::thread([self = this->shared_from_this()](net::udp::socket s) {
+                self->discover(s);
+            }, std::move(m_socket.clone())).detach();
+        }
+
+        auto listen_thread = std::thread([self = this->shared_from_this()](net::udp::socket s) {
             self->listen(s);
         }, std::move(m_socket.clone()));
         listen_thread.join();
 
         m_state->halt();
+        m_watchdog.stop();
+        if constexpr(Log::keeps_events) {
+            if(m_snapshots)
+                m_snapshots->save(*m_state, *this);
+        }
+    }
+
+    /**
+     * Restores the peer table, clock and logs from a snapshot file.
+     * Must be called before run().
+     * @param path the path of the snapshot file.
+     * @return true if a snapshot was restored, false otherwise.
+     */
+    bool restore_snapshot(const std::string& path) {
+        static_assert(Log::keeps_events, "Snapshots need a logging policy that keeps events");
+        if(!snapshot::restore(path, *m_state, *this))
+            return false;
+        for(const auto& [peer, time] : m_state->copy_peers())
+            m_channels.add(peer);
+        return true;
+    }
+
+    /**
+     * Subscribes this node to a channel. Once subscribed to at least one channel, the node only receives snippets
+     * from its channels and the default channel, and advertises its subscriptions in its heartbeats.
+     * Must be called before run().
+     * @param channel the channel name.
+     */
+    void subscribe(const std::string& channel) {
+        m_channels.subscribe(channel);
+    }
+
+    /**
+     * Switches to a bounded partial view of the network, refreshed with periodic shuffles (Cyclon peer sampling).
+     * Heartbeats and snippets are then only sent to the peers of the view, and snippets are gossiped onwards by
+     * every node until their time to live runs out (see gossip in peer_sampling.hpp). The peer table only keeps
+     * the peers heard from recently, so every node keeps O(capacity) state and fan-out.
+     * Must be called before run().
+     * @param capacity the maximum number of peers in the view.
+     * @param shuffle_length the number of descriptors exchanged per shuffle.
+     */
+    void enable_sampling(size_t capacity = partial_view::DEFAULT_CAPACITY, size_t shuffle_length = partial_view::DEFAULT_SHUFFLE_LENGTH) {
+        m_view = std::make_unique<partial_view>(m_state->address(), capacity, shuffle_length);
+        for(const auto& [peer, time] : m_state->copy_peers())
+            m_view->add(peer);
+    }
+
+    /**
+     * Paces snippets to every peer that acknowledges them with an AIMD send window, and acknowledges the snippets
+     * this node receives. Peers that never acknowledge are sent to immediately.
+     * Must be called before run().
+     * @param opts the window configuration.
+     */
+    void enable_flow_control(flow_options opts = {}) {
+        m_flow = std::make_unique<flow_control>(opts);
+    }
+
+    /**
+     * Protects outgoing snippets with parity datagrams, so receivers can rebuild lost snippets without a round trip.
+     * Every block of k snippets on a channel is followed by r parity datagrams, and partial blocks are completed
+     * once no snippet has been sent for a second. Receiving protected snippets does not need this to be enabled.
+     * Must be called before run().
+     * @param k the number of snippets per block.
+     * @param r the number of parity datagrams per block.
+     */
+    void enable_fec(size_t k = fec_encoder::DEFAULT_BLOCK_SIZE, size_t r = fec_encoder::DEFAULT_REDUNDANCY) {
+        m_fec = std::make_unique<fec_encoder>(k, r);
+    }
+
+    /**
+     * Injects packet loss, duplication, reordering and delay into every datagram this node sends and receives,
+     * e.g. to test the node on a loopback network. The faults can be reconfigured through the injector at any time.
+     * Takes precedence over busy polling. Must be called before run().
+     * @param injector the injector drawing the faults.
+     */
+    void enable_fault_injection(std::shared_ptr<net::fault_injector> injector) {
+        m_faults = std::move(injector);
+        m_faulty_sender = std::make_unique<net::faulty_socket<net::udp::socket>>(m_socket, *m_faults);
+    }
+
+    /**
+     * Finds peers on the local network without the registry: beacons announce this node to a multicast group or
+     * broadcast address, and nodes hearing a beacon add its sender and answer with a heartbeat. See discovery.hpp.
+     * Must be called before run().
+     * @param opts the group and the beacon schedule.
+     */
+    void enable_discovery(discovery::options opts = {}) {
+        m_discovery = std::make_unique<discovery::beacon>(std::move(opts), m_state->address());
+        m_discovery->configure(m_socket);
+    }
+
+    /**
+     * Adds peers learned while the node runs, e.g. from a registry fetch running alongside discovery. Peers learned
+     * once the node has stopped are ignored, so they do not show up in its report.
+     * @param peers the peers.
+     */
+    void add_peers(const std::unordered_set<peer_type>& peers) {
+        if(!m_state->is_running()) return;
+        for(const auto& peer : peers) {
+            if(peer == m_state->address()) continue;
+            m_state->join(peer);
+            m_channels.add(peer);
+            log(log_event::peer, 1, [&](auto& sink) { sink.log_peer(peer.to_string()); });
+        }
+    }
+
+    /**
+     * Appends a CRC32C trailer to every datagram this node sends, and checks the trailer of every datagram it
+     * receives before handling it. Datagrams with a bad trailer are dropped and counted, see corrupt_frames().
+     * Must be called before run().
+     * @param required whether to also drop datagrams without a trailer, e.g. from nodes without integrity checks.
+     */
+    void enable_integrity(bool required = false) {
+        m_integrity = true;
+        m_require_integrity = required;
+    }
+
+    /**
+     * Sends messages larger than a datagram as trains of equal-size fragments, handed to the kernel in one
+     * segmented send (UDP GSO) where supported, instead of truncating them. Receiving fragments does not need this to
+     * be enabled, but nodes that predate bulk transfer ignore them.
+     * Must be called before run().
+     * @param segment_size the size of every fragment datagram, trailer included; larger messages are fragmented.
+     * Clamped to MAX_SEGMENT, since receivers would truncate larger fragments.
+     */
+    void enable_bulk_transfer(size_t segment_size = DEFAULT_SEGMENT) {
+        m_segment_size = std::clamp(segment_size, fragments::HEADER_SIZE + crc32c::TRAILER_SIZE + 1, MAX_SEGMENT);
+    }
+
+    /**
+     * Bounds the memory kept per peer under churn or a flood of 'peer' announcements. The peer table keeps at most
+     * capacity peers and evicts the least recently heard from (CLOCK) to admit new ones, and the peer log of the
+     * report keeps at most 4 times as many names.
+     * Must be called before run().
+     * @param capacity the largest number of peers kept at once.
+     * @param verify whether to only admit peers heard from directly, ignoring the addresses they announce.
+     */
+    void limit_peers(size_t capacity, bool verify = false) {
+        m_state->limit(capacity, verify);
+        m_verify_peers = verify;
+        if constexpr(Log::keeps_events)
+            this->limit_peer_log(4 * capacity);
+    }
+
+    /**
+     * Gets the number of received datagrams dropped by the integrity check.
+     */
+    [[nodiscard]] uint64_t corrupt_frames() const noexcept {
+        return m_corrupt.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Polls the socket for a while before blocking when waiting for the next datagram, trading CPU time for lower
+     * receive latency. The polling budget adapts to the arrival rate, so an idle node still blocks right away.
+     * Must be called before run().
+     * @param opts the polling configuration.
+     */
+    void enable_busy_poll(spin_options opts = {}) {
+        m_receiver = std::make_unique<adaptive_receiver>(opts);
+    }
+
+    /**
+     * Attaches a trace context to every snippet this node sends, and records the send and every receipt of a traced
+     * snippet, to follow the propagation of snippets across the mesh. See dump_trace().
+     * Must be called before run().
+     * @param capacity the number of hop records kept.
+     */
+    void enable_tracing(size_t capacity = trace::recorder::DEFAULT_CAPACITY) {
+        m_trace = std::make_unique<trace::recorder>(m_state->address(), capacity);
+    }
+
+    /**
+     * Writes the hop records of the traced snippets to a file, for the trace_collector tool.
+     * @param path the path of the file.
+     * @return true if the file was written, false if tracing is disabled or the file could not be written.
+     */
+    bool dump_trace(const std::string& path) const {
+        return m_trace && m_trace->dump(path);
+    }
+
+    /**
+     * Watches the listening, broadcast and update loops, and records a stall whenever one of them makes no
+     * progress for longer than the threshold while it is not waiting on purpose. See stalls().
+     * Must be called before run().
+     * @param threshold the shortest delay counted as a stall.
+     */
+    void enable_watchdog(std::chrono::milliseconds threshold = watchdog::DEFAULT_THRESHOLD) {
+        m_watchdog.set_threshold(threshold);
+        m_watching = true;
+    }
+
+    /**
+     * Periodically writes a snapshot of the node to the given file, and once more on shutdown.
+     * Must be called before run().
+     * @param path the path of the snapshot file.
+     */
+    void enable_snapshots(const std::string& path) {
+        static_assert(Log::keeps_events, "Snapshots need a logging policy that keeps events");
+        m_snapshots = std::make_unique<snapshot::writer>(path);
+    }
+
+    /**
+     * Gets the per-peer traffic statistics, e.g. to rank peers with peer_stats::top().
+     * @return the statistics table.
+     */
+    [[nodiscard]] const peer_stats& stats() const noexcept {
+        return m_state->stats();
+    }
+
+    /**
+     * Gets the stall histograms and event log of the loops, filled once the watchdog is enabled.
+     * @return the watchdog.
+     */
+    [[nodiscard]] const watchdog& stalls() const noexcept {
+        return m_watchdog;
+    }
+
+    /**
+     * Picks the k peers with the lowest measured round-trip time, among the partial view if sampling is enabled
+     * or among all active peers otherwise. Peers that have not answered a probe yet come last.
+     * @param k the number of peers.
+     * @return up to k peers, nearest first.
+     */
+    [[nodiscard]] std::vector<peer_type> nearest_peers(size_t k) const {
+        return m_latency.nearest(candidates(), k);
+    }
+
+    /**
+     * Draws k random peers, preferring peers with a low and stable round-trip time, among the partial view if
+     * sampling is enabled or among all active peers otherwise.
+     * @param k the number of peers.
+     * @return up to k peers.
+     */
+    [[nodiscard]] std::vector<peer_type> sample_peers(size_t k) {
+        return m_latency.weighted_sample(candidates(), k);
     }
 
 private:
     /**
      * Sends any outgoing messages from the snippet interface and broadcasts them to the other peers.
+     * A message is acknowledged to the journal once it has been sent to every recipient; with flow control, that is
+     * when it has left the queues of all of them. Acknowledgements are given in the order the messages were popped.
      * @param sock The UDP socket to send the message.
      */
     void broadcast(const net::udp::socket& sock) {
+        flight::name_thread("broadcast");
+        auto& heartbeat = m_watchdog.watch("broadcast");
+        auto last_snippet = steady_clock::now();
+        bool unflushed = false;
+        std::deque<std::weak_ptr<const std::string>> unacked;
+        const auto ack_sent = [&] {
+            while(!unacked.empty() && unacked.front().expired()) {
+                m_ioc.ack_outgoing();
+                unacked.pop_front();
+            }
+        };
         while(m_state->is_running()) {
-            if(m_ioc.has_outgoing()) {
+            while(m_ioc.has_outgoing()) {
+                heartbeat.beat("multicast_snippet");
                 const auto message = m_ioc.pop_outgoing();
-                multicast_snippet(sock, message);
+                unacked.push_back(multicast_snippet(sock, message));
+                ack_sent();
+                last_snippet = steady_clock::now();
+                unflushed = m_fec != nullptr;
+                if(!m_flow) break;      // Without flow control, the sleep below is the only rate limit
+            }
+            if(unflushed && steady_clock::now() - last_snippet >= FEC_FLUSH_DELAY) {
+                heartbeat.beat("fec_flush");
+                for(const auto& [channel, parity] : m_fec->flush())
+                    basic_multicast(sock, parity, channel);
+                unflushed = false;
+            }
+            auto wait = duration_cast<steady_clock::duration>(milliseconds(200));
+            if(m_flow) {
+                heartbeat.beat("flow_pump");
+                const auto next = m_flow->pump([&](const peer_type& addr, const std::string& snippet) {
+                    send(sock, snippet, addr);
+                });
+                flight::record(flight::kind::queue_depth, flight::queue::flow, m_flow->queued());
+                wait = std::clamp(next, duration_cast<steady_clock::duration>(microseconds(100)), wait);
+                ack_sent();
             }
-            std::this_thread::sleep_for(milliseconds(200));
+            heartbeat.idle();
+            std::this_thread::sleep_for(wait);
+        }
+    }
+
+    /**
+     * Sends the beacons of this node, and answers the beacons of other nodes on the local network: their senders
+     * are added as peers and sent a heartbeat, which adds this node on their side.
+     * @param sock The UDP socket to send the beacons and heartbeats.
+     */
+    void discover(const net::udp::socket& sock) {
+        flight::name_thread("discovery");
+        while(m_state->is_running()) {
+            m_discovery->send_if_due(sock);
+            const auto peer = m_discovery->receive(milliseconds(100));
+            if(!peer) continue;
+            if(debug_mode) std::cerr << "Discovered " << *peer << std::endl;
+            if(!m_state->contains(*peer))
+                add_peers({ *peer });
+            else
+                update_peer(*peer);
+            send(sock, heartbeat(sock), *peer);
         }
     }
 
@@ -104,13 +522,40 @@ private:
     void update(const net::udp::socket& sock) {
         if(debug_mode)
             std::cerr << "Scheduling keepalive updates..." << std::endl;
+        flight::name_thread("update");
+        auto& heartbeat = m_watchdog.watch("update");
+        auto last_snapshot = steady_clock::now();
         while(m_state->is_running()) {
+            if(m_view) {
+                heartbeat.beat("shuffle");
+                if(debug_mode)
+                    std::cerr << "Shuffling partial view" << std::endl;
+                shuffle(sock);
+            }
             if(debug_mode)
                 std::cerr << "Sending keepalive messages" << std::endl;
+            heartbeat.beat("multicast_update");
             multicast_update(sock);
             if(debug_mode)
                 std::cerr << "Removing old peers" << std::endl;
+            heartbeat.beat("clean_peer_list");
             clean_peer_list();
+            if(debug_mode) {
+                for(const auto& row : stats().top(peer_stats::counter::messages_in, 3))
+                    std::cerr << "Noisiest peer " << row.peer << ": " << row[peer_stats::counter::messages_in] << " messages" << std::endl;
+                for(const auto& row : stats().top(peer_stats::counter::rtt, 3))
+                    std::cerr << "Slowest peer " << row.peer << ": " << row[peer_stats::counter::rtt] << "us" << std::endl;
+            }
+            if constexpr(Log::keeps_events) {
+                heartbeat.beat("maintain_store");
+                this->maintain_store();
+                if(m_snapshots && steady_clock::now() - last_snapshot >= SNAPSHOT_INTERVAL) {
+                    heartbeat.beat("snapshot");
+                    m_snapshots->save(*m_state, *this);
+                    last_snapshot = steady_clock::now();
+                }
+            }
+            heartbeat.idle();
             std::this_thread::sleep_for(DEFAULT_KEEP_ALIVE);
         }
     }
@@ -122,62 +567,292 @@ private:
      */
     void listen(const net::udp::socket& sock) {
         address_type sender;
+        peer_batch batch;
+        std::optional<net::faulty_socket<net::udp::socket>> faulty;
+        if(m_faults)
+            faulty.emplace(sock, *m_faults);
+        flight::name_thread("listen");
+        auto& heartbeat = m_watchdog.watch("listen");
         if(debug_mode)
             std::cerr << "Listening for messages..." << std::endl;
         while(true) {
-            char data[2048] = {};
-            sock.recv_from(net::buffer(data), &sender);
-            auto [request, contents] = parse_request(data);
-            if(debug_mode) std::cerr << "Got '" << request << "' request from " << sender.to_string() << ": " << contents << std::endl;
-            if(request == "peer")
-                on_peer(sender, strings::trim(contents));
-            else if(request == "snip")
-                on_snip(sender, strings::trim(contents));
-            else if(request == "stop")
+            // Block only when there is nothing to flush; otherwise drain what is queued and flush once it is empty
+            char data[MAX_DATAGRAM + 1] = {};
+            const auto payload = net::buffer(data, sizeof(data) - 1);
+            const int flags = batch.empty() ? 0 : MSG_DONTWAIT;
+            if(flags == 0)
+                heartbeat.idle();
+            const auto len = faulty                     ? faulty->recv_from(payload, flags, &sender)
+                           : m_receiver && flags == 0   ? m_receiver->recv_from(sock, payload, &sender)
+                                                        : sock.recv_from(payload, flags, &sender);
+            if(len < 0) {
+                heartbeat.beat("flush_peers");
+                flush_peers(batch);
+                continue;
+            }
+            heartbeat.beat("dispatch");
+            const auto peer = flight::pack_peer(sender.address(), sender.port());
+            flight::record(flight::kind::datagram, static_cast<uint32_t>(len), peer, flight::pack_request(data, size_t(len)));
+            if(const auto slot = m_state->slot(sender)) {
+                m_state->stats().add(*slot, peer_stats::counter::messages_in);
+                m_state->stats().add(*slot, peer_stats::counter::bytes_in, len);
+            }
+            // Every handler below sees the payload without the integrity trailer, if there was one
+            auto size = size_t(len);
+            if(m_integrity && !check_integrity(sender, data, size))
+                continue;
+            if(size >= 4 && std::memcmp(data, fragments::REQUEST, 4) == 0) {
+                const auto message = m_fragments.add(sender, data + 4, size - 4);
+                if(message && !dispatch(sock, batch, sender, message->c_str(), message->size()))
+                    break;
+                continue;
+            }
+            if(!dispatch(sock, batch, sender, data, size))
                 break;
+            if(batch.received.size() >= MAX_PEER_BATCH)
+                flush_peers(batch);
+        }
+        flush_peers(batch);
+    }
+
+    /**
+     * Handles a request received in one datagram or reassembled from fragments.
+     * @param sock The UDP socket to send replies.
+     * @param batch The pending membership observations.
+     * @param sender The sender of the request.
+     * @param data The request, NUL-terminated.
+     * @param len The size of the request.
+     * @return false if the request was a "stop" command, true otherwise.
+     */
+    bool dispatch(const net::udp::socket& sock, peer_batch& batch, const address_type& sender, const char* data, size_t len) {
+        if(len >= 4 && std::memcmp(data, fec::PARITY_REQUEST, 4) == 0) {
+            on_parity(sock, sender, data + 4, len - 4);
+            return true;
         }
+        auto [request, contents] = parse_request(data);
+        flight::record(flight::kind::handler, flight::pack_request(data, len), flight::pack_peer(sender.address(), sender.port()));
+        if(debug_mode) std::cerr << "Got '" << request << "' request from " << sender.to_string() << ": " << contents << std::endl;
+        if(request == "peer")
+            on_peer(sock, batch, sender, strings::trim(contents));
+        else if(request == "snip")
+            on_protected_snip(sock, sender, std::string(data, len));
+        else if(request == "pong")
+            on_pong(sender, strings::trim(contents));
+        else if(request == "sack" && m_flow)
+            on_ack(sender, strings::trim(contents));
+        else if(request == "shuf" && m_view)
+            on_shuffle(sock, sender, strings::trim(contents));
+        else if(request == "shrp" && m_view)
+            m_view->on_reply(partial_view::decode(strings::trim(contents)));
+        else if(request == "stop")
+            return false;
+        return true;
     }
 
     /**
-     * Sends a 'heartbeat' message to all active peers.
+     * Sends a 'heartbeat' message to all active peers, or only to the peers of the partial view if sampling is enabled.
+     * Every heartbeat carries the id of a new RTT probe, which the receivers answer with a 'pong'.
      * @param sock The UDP socket to send the message.
      */
     void multicast_update(const net::udp::socket& sock)  {
-        const std::string message = "peer" + sock.address().to_string();
+        const auto message = heartbeat(sock);
+        if(m_view) {
+            for(const auto& addr : m_view->peers()) {
+                send(sock, message, addr);
+                log(log_event::sent_peer, 1, [&](auto& sink) { sink.log_sent_peer(addr.to_string(), sock.address().to_string()); });
+            }
+            return;
+        }
         basic_multicast(sock, message);
-        for(const auto& [addr, time] : m_state->peers())
-            log_sent_peer(addr.to_string(), sock.address().to_string());
+        log(log_event::sent_peer, m_state->peers().size(), [&](auto& sink) {
+            const auto from = sock.address().to_string();
+            for(const auto& [addr, time] : m_state->peers())
+                sink.log_sent_peer(addr.to_string(), from);
+        });
+    }
+
+    /**
+     * Builds a 'heartbeat' message carrying a new RTT probe and the channels this node subscribes to.
+     * @param sock The UDP socket the message is sent from.
+     */
+    std::string heartbeat(const net::udp::socket& sock) {
+        const auto probe = m_latency.probe();
+        return "peer" + sock.address().to_string() + '@' + std::to_string(probe) + m_channels.advertisement();
     }
 
     /**
-     * Sends a snippet message to all active peers.
+     * Starts a shuffle of the partial view with its oldest peer.
+     * @param sock The UDP socket to send the request.
+     */
+    void shuffle(const net::udp::socket& sock) {
+        if(const auto request = m_view->begin_shuffle()) {
+            const auto& [target, entries] = *request;
+            send(sock, "shuf" + partial_view::encode(entries), target);
+        }
+    }
+
+    /**
+     * Sends a snippet message to all active peers subscribed to its channel.
+     * A message starting with "#channel " is sent on that channel, any other message on the default channel.
      * @param sock The UDP socket to send the message.
      * @param message The snippet message to send.
+     * @return With flow control, the snippet shared by the queues of its recipients, which expires once it has left
+     * all of them; an expired pointer otherwise, since the snippet has already been sent.
      */
-    void multicast_snippet(const net::udp::socket& sock, const std::string& message) {
+    std::weak_ptr<const std::string> multicast_snippet(const net::udp::socket& sock, const std::string& message) {
+        const auto [channel, text] = channels::parse_outgoing(message);
         m_state->increment_timestamp();
-        const std::string snippet = "snip" + std::to_string(m_state->timestamp()) + " " + message;
-        basic_multicast(sock, snippet);
+        const auto timestamp = m_state->timestamp();
+        const std::string prefix = "snip" + std::to_string(timestamp) + (m_view ? gossip::tag({ gossip::DEFAULT_TTL, m_state->address() }) : "")
+                                 + (m_trace ? trace::tag(m_trace->start()) : "");
+        const std::string suffix = (channel.empty() ? "" : channels::TAG + channel) + " " + text;
+        // Snippets too large for the receivers to read with their parity are sent unprotected
+        const bool protect = m_fec && prefix.size() + fec::MAX_TAG_SIZE + suffix.size() <= fec::MAX_DATAGRAM_SIZE;
+        const std::string snippet = prefix + (protect ? fec::tag(m_fec->next(channel)) : "") + suffix;
+        if(m_view)
+            m_seen.insert(m_state->address(), timestamp);
+        flight::record(flight::kind::snippet_sent, static_cast<uint32_t>(timestamp), m_state->peers().size());
+        if(protect) {
+            // Parity is sent right away even with flow control; receivers drop snippets that arrive after being rebuilt
+            for(const auto& parity : m_fec->add(channel, snippet))
+                basic_multicast(sock, parity, channel);
+        }
+        if(!m_flow) {
+            basic_multicast(sock, snippet, channel);
+            return {};
+        }
+        const auto shared_snippet = std::make_shared<const std::string>(snippet);
+        for_each_recipient(channel, [&](const peer_type& addr) {
+            if(m_flow->enqueue(addr, timestamp, shared_snippet))
+                m_state->record(addr, peer_stats::counter::drops);
+        });
+        return shared_snippet;
     }
 
     /**
-     * Request handler to handle 'peer' requests.
+     * Request handler to handle 'peer' requests. The observation is added to the current batch and applied when
+     * the batch is flushed, while an RTT probe carried by the request is answered right away.
      * If an invalid net address has been received, the peer update will be ignored.
-     * @param sender
-     * @param content
+     * @param sock The UDP socket to answer the probe.
+     * @param batch The batch of the listening thread.
+     * @param sender The address of the sender of the request.
+     * @param content The address advertised in the request.
      */
-    void on_peer(const address_type& sender, const std::string& content) {
-        const auto& [host, port] = strings::split(content, ':');
+    void on_peer(const net::udp::socket& sock, peer_batch& batch, const address_type& sender, const std::string& content) {
+        auto [address, probe, subscriptions] = parse_heartbeat(content);
+        if(probe)
+            send(sock, "pong" + *probe, sender);
+        batch.observe_sender(sender);
         try {
-            const peer_type new_peer = { host, static_cast<in_port_t>(std::stoul(port)) };
-            update_peer(sender);
-            update_peer(new_peer);
-            log_peer(sender.to_string());
-            log_peer(new_peer.to_string());
-            log_recv_peer(sender.to_string(), new_peer.to_string());
+            // Heartbeats usually advertise their own sender, which spares resolving the address again
+            peer_type new_peer = sender;
+            if(address != batch.peer_names.at(sender)) {
+                const auto& [host, port] = strings::split(address, ':');
+                new_peer = { host, static_cast<in_port_t>(std::stoul(port)) };
+                batch.observe(new_peer);
+            }
+            batch.subscriptions[sender] = subscriptions;
+            batch.received.emplace_back(sender, new_peer);
             if(debug_mode) std::cerr << "Handled peer request" << std::endl;
         } catch(net::address_error& err) {
-            std::cerr << err.what() << std::endl;
+            diag::log(diag::severity::warning, err.what());
+        } catch(std::logic_error& err) {
+            diag::log(diag::severity::warning, "Invalid peer address '" + address + "' from " + sender.to_string());
+        }
+    }
+
+    /**
+     * Applies a batch of 'peer' requests: every distinct peer is refreshed once in the shared state and logged
+     * once, and all requests are recorded with a single acquisition of each lock.
+     * @param batch The batch to apply, which is cleared afterwards.
+     */
+    void flush_peers(peer_batch& batch) {
+        if(batch.empty()) return;
+        flight::record(flight::kind::queue_depth, flight::queue::peer_batch, batch.received.size());
+        // Senders were heard from directly; other advertised addresses are only announcements
+        std::vector<peer_type> announced;
+        batch.peers.erase(std::remove_if(batch.peers.begin(), batch.peers.end(), [&](const peer_type& peer) {
+            if(batch.senders.count(peer)) return false;
+            announced.push_back(peer);
+            return true;
+        }), batch.peers.end());
+        m_state->update(batch.peers);
+        m_state->announce(announced);
+        for(const auto& peer : m_state->take_evicted())
+            forget_peer(peer);
+        log(log_event::recv_peer, batch.received.size(), [&](auto& sink) {
+            std::vector<std::pair<std::string, std::string>> received;
+            received.reserve(batch.received.size());
+            for(const auto& [sender, peer] : batch.received)
+                received.emplace_back(batch.peer_names.at(sender), batch.peer_names.at(peer));
+            std::vector<std::string> names;
+            names.reserve(batch.peer_names.size());
+            for(auto& [peer, name] : batch.peer_names)
+                names.push_back(std::move(name));
+            sink.log_recv_peers(names, received);
+        });
+
+        for(const auto& [sender, subscriptions] : batch.subscriptions) {
+            m_channels.advertise(sender, subscriptions);
+            if(m_view)
+                m_view->add(sender);
+        }
+        for(const auto& peer : batch.peers)
+            m_channels.add(peer);
+        if(!m_verify_peers) {
+            for(const auto& peer : announced)
+                m_channels.add(peer);
+        }
+        batch.clear();
+    }
+
+    /**
+     * Request handler to handle 'shuf' requests: answers with descriptors of the partial view and merges the
+     * descriptors that were received.
+     * @param sock The UDP socket to send the reply.
+     * @param sender The peer that started the shuffle.
+     * @param content The encoded descriptors sent by the peer.
+     */
+    void on_shuffle(const net::udp::socket& sock, const address_type& sender, const std::string& content) {
+        const auto reply = m_view->on_request(sender, partial_view::decode(content));
+        send(sock, "shrp" + partial_view::encode(reply), sender);
+    }
+
+    /**
+     * Passes a 'snip' datagram through FEC recovery before handling it: a protected snippet that was already
+     * rebuilt from parity is dropped, and any snippet it allows to rebuild is handled as well.
+     * @param sock The UDP socket to send acknowledgements.
+     * @param sender The address of the sender of the snippet message.
+     * @param datagram The whole datagram as received.
+     */
+    void on_protected_snip(const net::udp::socket& sock, const address_type& sender, const std::string& datagram) {
+        const auto content = strings::trim(datagram.substr(4));
+        const auto [stamp, channel] = channels::untag(content.substr(0, content.find(' ')));
+        const auto frame = fec::untag(stamp).second;
+        if(!frame) {
+            on_snip(sock, sender, content);
+            return;
+        }
+        std::vector<std::string> recovered;
+        if(m_decoder.on_data(sender, *frame, datagram, recovered))
+            on_snip(sock, sender, content);
+        for(const auto& snippet : recovered)
+            on_snip(sock, sender, strings::trim(snippet.substr(4)));
+    }
+
+    /**
+     * Request handler to handle 'fecp' requests, which carry the parity of a block of snippets. Every snippet of the
+     * block that can be rebuilt is handled as if it had been received.
+     * @param sock The UDP socket to send acknowledgements.
+     * @param sender The address of the sender of the parity.
+     * @param data The parity datagram without its request prefix.
+     * @param size The size of the parity datagram without its request prefix.
+     */
+    void on_parity(const net::udp::socket& sock, const address_type& sender, const char* data, size_t size) {
+        for(const auto& snippet : m_decoder.on_parity(sender, data, size)) {
+            if(debug_mode) std::cerr << "Recovered snippet from " << sender << std::endl;
+            if(strings::starts_with(snippet, "snip"))
+                on_snip(sock, sender, strings::trim(snippet.substr(4)));
         }
     }
 
@@ -185,17 +860,89 @@ private:
      * Request handler to handle 'snip' requests.
      * To handle Lamport ordering, the timestamp of the manager will be updated to the maximum between
      * the current timestamp and the timestamp of the message.
+     * Snippets on channels this node is not subscribed to still advance the clock, but are not delivered.
+     * With flow control enabled, every snippet sent by its origin is acknowledged to it. Gossiped snippets are delivered once,
+     * on behalf of their origin, and forwarded to the partial view while their time to live lasts.
+     * @param sock The UDP socket to send the acknowledgement.
      * @param sender The address of the sender of the snippet message.
      * @param content The contents of the snippet message.
      */
-    void on_snip(const address_type& sender, const std::string& content) {
-        const auto message = strings::split(content, ' ');
-        const auto timestamp = std::stoul(message.first);
-        const auto snippet = message.second;
+    void on_snip(const net::udp::socket& sock, const address_type& sender, const std::string& content) {
+        const auto [stamp, timestamp, channel, context, route, snippet] = parse_snippet(content);
+        if(m_trace && context)
+            m_trace->on_receive(*context, sender);
+        // Relays send without flow control, and the stamp is the origin's, which could match a snippet of the relay
+        if(m_flow && (!route || route->origin == sender))
+            send(sock, "sack" + stamp, sender);
         m_state->update(sender);
+        m_channels.add(sender);     // Senders only heard from through snippets receive every channel until they advertise
         m_state->update_timestamp(timestamp);
-        m_ioc.put_incoming(sender, snippet, m_state->timestamp());
-        log_snippet(m_state->timestamp(), snippet, sender.to_string());
+        if(route) {
+            if(route->origin == m_state->address() || !m_seen.insert(route->origin, timestamp))
+                return;
+            if(m_view && route->ttl > 1)
+                relay(sock, sender, { route->ttl - 1, route->origin }, stamp, context, channel, snippet);
+        }
+        const peer_type author = route ? route->origin : sender;
+        if(!m_channels.is_subscribed(channel))
+            return;
+        if(const auto slot = m_state->slot(sender)) {
+            const auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+            m_state->stats().set(*slot, peer_stats::counter::last_snippet, now.count());
+        }
+        m_ioc.put_incoming(author, snippet, m_state->timestamp(), channel);
+        log(log_event::snippet, 1, [&, &text = snippet](auto& sink) { sink.log_snippet(m_state->timestamp(), text, author.to_string()); });
+    }
+
+    /**
+     * Forwards a gossiped snippet to the partial view, except to the peer it came from and to its origin.
+     * FEC tags are dropped, since parity only protects the datagrams sent by the origin itself.
+     * @param sock The UDP socket to send the snippet.
+     * @param sender The peer the snippet came from.
+     * @param route The route of the forwarded snippet, with its time to live already lowered.
+     * @param stamp The timestamp given by the origin.
+     * @param context The trace context of the snippet, if traced.
+     * @param channel The channel of the snippet.
+     * @param snippet The contents of the snippet.
+     */
+    void relay(const net::udp::socket& sock, const address_type& sender, const gossip::route& route, const std::string& stamp,
+               const std::optional<trace::context>& context, const std::string& channel, const std::string& snippet) {
+        std::string tag = gossip::tag(route);
+        if(context)
+            tag += trace::tag({ context->id, context->origin, context->hops + 1 });
+        if(!channel.empty())
+            tag += channels::TAG + channel;
+        const std::string message = "snip" + stamp + tag + " " + snippet;
+        for(const auto& peer : m_view->peers()) {
+            if(peer != sender && peer != route.origin)
+                send(sock, message, peer);
+        }
+    }
+
+    /**
+     * Request handler to handle 'sack' requests, which acknowledge a snippet sent by this node.
+     * @param sender The peer that received the snippet.
+     * @param content The timestamp of the acknowledged snippet.
+     */
+    void on_ack(const address_type& sender, const std::string& content) {
+        try {
+            m_flow->on_ack(sender, std::stoull(content));
+        } catch(std::logic_error&) {}
+    }
+
+    /**
+     * Request handler to handle 'pong' requests, which answer the RTT probe of a heartbeat.
+     * @param sender The peer that answered.
+     * @param content The id of the probe.
+     */
+    void on_pong(const address_type& sender, const std::string& content) {
+        try {
+            const auto estimate = m_latency.on_pong(sender, static_cast<uint32_t>(std::stoul(content)));
+            const auto slot = m_state->slot(sender);
+            if(!estimate || !slot) return;
+            m_state->stats().set(*slot, peer_stats::counter::rtt, estimate->rtt.count());
+            m_state->stats().set(*slot, peer_stats::counter::jitter, estimate->jitter.count());
+        } catch(std::logic_error&) {}
     }
 
     /**
@@ -216,23 +963,184 @@ private:
     }
 
     /**
-     * Sends a message to every peer in the network.
+     * Sends a message to every peer in the network subscribed to the given channel.
      * @param sock The UDP socket to send the message.
      * @param message The message to send.
+     * @param channel The channel of the message (empty for the default channel, which every peer receives).
      */
-    void basic_multicast(const net::udp::socket& sock, const std::string& message) const {
+    void basic_multicast(const net::udp::socket& sock, const std::string& message, const std::string& channel = "") const {
         if(debug_mode) std::cerr << "Sending '" << message << "' to " << m_state->peers().size() << " peers." << std::endl;
-        for(const auto& [addr, time] : m_state->peers()) {
-            sock.send_to(net::buffer(message), addr);
+        for_each_recipient(channel, [&](const peer_type& addr) {
+            send(sock, message, addr);
+        });
+    }
+
+    /**
+     * Sends a message to a single peer and records it in the peer's statistics.
+     * A failed send is counted as a drop.
+     * @param sock The UDP socket to send the message.
+     * @param message The message to send.
+     * @param addr The destination peer.
+     */
+    void send(const net::udp::socket& sock, const std::string& message, const peer_type& addr) const {
+        if(m_segment_size && message.size() + (m_integrity ? crc32c::TRAILER_SIZE : 0) > m_segment_size) {
+            send_bulk(sock, message, addr);
+            return;
+        }
+        const std::string sealed = m_integrity ? crc32c::seal(message) : std::string();
+        const auto& datagram = m_integrity ? sealed : message;
+        const auto len = m_faults ? m_faulty_sender->send_to(net::buffer(datagram), addr)
+                                  : sock.send_to(net::buffer(datagram), addr);
+        const auto slot = m_state->slot(addr);
+        if(!slot) return;
+        auto& stats = m_state->stats();
+        if(len < 0) {
+            stats.add(*slot, peer_stats::counter::drops);
+            return;
+        }
+        stats.add(*slot, peer_stats::counter::messages_out);
+        stats.add(*slot, peer_stats::counter::bytes_out, len);
+    }
+
+    /**
+     * Sends a message larger than a datagram as a train of fragments, in one segmented send unless faults are
+     * injected. The train counts as one message in the peer's statistics.
+     * @param sock The UDP socket to send the message.
+     * @param message The message to send.
+     * @param addr The destination peer.
+     */
+    void send_bulk(const net::udp::socket& sock, const std::string& message, const peer_type& addr) const {
+        const size_t trailer = m_integrity ? crc32c::TRAILER_SIZE : 0;
+        const auto parts = fragments::split(m_fragment_id.fetch_add(1, std::memory_order_relaxed), message,
+                                            m_segment_size - fragments::HEADER_SIZE - trailer);
+        ssize_t len = parts.empty() ? -1 : 0;
+        if(m_faults) {
+            for(size_t i = 0; i < parts.size() && len >= 0; i++) {
+                const std::string datagram = m_integrity ? crc32c::seal(parts[i]) : parts[i];
+                const auto sent = m_faulty_sender->send_to(net::buffer(datagram), addr);
+                len = sent < 0 ? sent : len + sent;
+            }
+        } else if(!parts.empty()) {
+            std::string train;
+            train.reserve(parts.size() * m_segment_size);
+            for(const auto& part : parts)
+                train += m_integrity ? crc32c::seal(part) : part;
+            len = sock.send_segments(net::buffer(std::as_const(train)), m_segment_size, addr);
+        }
+        const auto slot = m_state->slot(addr);
+        if(!slot) return;
+        auto& stats = m_state->stats();
+        if(len < 0) {
+            stats.add(*slot, peer_stats::counter::drops);
+            return;
+        }
+        stats.add(*slot, peer_stats::counter::messages_out);
+        stats.add(*slot, peer_stats::counter::bytes_out, len);
+    }
+
+    /**
+     * Checks and strips the integrity trailer of a received datagram. Datagrams that fail the check are counted,
+     * in total and in the statistics of their sender. Once a peer has sent a sealed datagram, its unsealed ones are
+     * treated as corrupt too, since a bit flip in the trailer magic turns a sealed datagram into an unsealed one;
+     * this lasts until the peer leaves the table.
+     * @param sender The sender of the datagram.
+     * @param data The datagram.
+     * @param size The size of the datagram, reduced by the size of the trailer if it had one.
+     * @return true if the datagram can be handled, false if it must be dropped.
+     */
+    bool check_integrity(const address_type& sender, char* data, size_t& size) {
+        const auto verdict = crc32c::open(data, size);
+        const uint64_t key = uint64_t(sender.address()) << 16 | sender.port();
+        bool sealed_before;
+        {
+            std::shared_lock lock(m_sealed_mutex);
+            sealed_before = m_sealed_peers.count(key) != 0;
+        }
+        if(verdict == crc32c::verdict::valid && !sealed_before) {
+            std::unique_lock lock(m_sealed_mutex);
+            m_sealed_peers.insert(key);
+        }
+        if(verdict == crc32c::verdict::corrupt
+                || (verdict == crc32c::verdict::unsealed && (m_require_integrity || sealed_before))) {
+            m_corrupt.fetch_add(1, std::memory_order_relaxed);
+            m_state->record(sender, peer_stats::counter::corrupt);
+            if(debug_mode) std::cerr << "Dropped corrupt datagram from " << sender << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Visits every peer that should receive a message on the given channel. With a partial view, every peer of the
+     * view receives every channel, since it also forwards the messages it is not subscribed to.
+     * @param channel The channel of the message (empty for the default channel, which every peer receives).
+     * @param fn A callable taking a const peer_type&.
+     */
+    template<typename Fn>
+    void for_each_recipient(const std::string& channel, Fn&& fn) const {
+        if(m_view) {
+            for(const auto& peer : m_view->peers())
+                fn(peer);
+            return;
         }
+        if(m_channels.for_each_recipient(channel, fn))
+            return;
+        for(const auto& [addr, time] : m_state->peers())
+            fn(addr);
+    }
+
+    /**
+     * Gets the peers to pick from for latency-aware selection.
+     */
+    [[nodiscard]] std::vector<peer_type> candidates() const {
+        if(m_view)
+            return m_view->peers();
+        std::vector<peer_type> ret;
+        for(const auto& [addr, time] : m_state->copy_peers())
+            ret.push_back(addr);
+        return ret;
     }
 
     void update_peer(const peer_type& peer) {
         m_state->update(peer);
     }
 
+    /**
+     * Logs an event through the policy. The entry is only built, by calling fn, when the policy keeps the event;
+     * otherwise the policy only counts it.
+     * @param kind the kind of event.
+     * @param n the number of events, for policies that count them.
+     * @param fn a generic callable logging the entry into the logger it is given; its body is only instantiated
+     *           for policies that keep events.
+     */
+    template<typename Fn>
+    void log(log_event kind, size_t n, Fn&& fn) {
+        if constexpr(Log::keeps_events) {
+            if(this->sample(kind))
+                fn(static_cast<logger&>(*this));
+        } else {
+            this->count(kind, n);
+        }
+    }
+
     void remove_peer(const peer_type& peer) {
         m_state->leave(peer);
+        forget_peer(peer);
+    }
+
+    /**
+     * Drops the state kept about a peer that is no longer in the peer table.
+     */
+    void forget_peer(const peer_type& peer) {
+        if(m_integrity) {
+            std::unique_lock lock(m_sealed_mutex);
+            m_sealed_peers.erase(uint64_t(peer.address()) << 16 | peer.port());
+        }
+        m_channels.forget(peer);
+        m_latency.forget(peer);
+        m_decoder.forget(peer);
+        if(m_flow)
+            m_flow->forget(peer);
     }
 
     net::io_context& m_ioc;
@@ -240,26 +1148,54 @@ private:
     std::shared_ptr<shared_state> m_state;
     net::udp::socket m_socket;
 
+    channel_index m_channels;
+    latency_tracker m_latency;
+    fec_decoder m_decoder;
+    std::unique_ptr<partial_view> m_view;
+    gossip::seen_filter m_seen;
+    std::unique_ptr<flow_control> m_flow;
+    std::unique_ptr<fec_encoder> m_fec;
+    std::unordered_set<uint64_t> m_sealed_peers;        // Peers that sent sealed datagrams, by address and port
+    std::shared_mutex m_sealed_mutex;
+    std::unique_ptr<snapshot::writer> m_snapshots;
+    std::unique_ptr<adaptive_receiver> m_receiver;
+    std::shared_ptr<net::fault_injector> m_faults;
+    std::unique_ptr<net::faulty_socket<net::udp::socket>> m_faulty_sender;     // Shared by the sending threads
+    std::unique_ptr<trace::recorder> m_trace;
+    std::unique_ptr<discovery::beacon> m_discovery;
+    watchdog m_watchdog;
+    bool m_watching = false;
+    bool m_integrity = false;
+    bool m_require_integrity = false;
+    std::atomic<uint64_t> m_corrupt = 0;
+    fragments::assembler m_fragments;
+    size_t m_segment_size = 0;
+    bool m_verify_peers = false;
+    mutable std::atomic<uint32_t> m_fragment_id = 0;
+
     const bool debug_mode;
 };
 
+using peer_manager = basic_peer_manager<>;
+
 
 /**
- * Takes the current state of a peer manager and generates a runtime report of the peer manager.
- * @param manager The peer manager to print.
+ * Generates a runtime report from the logs of a node and its per-peer statistics.
+ * @param log The logs of the node.
+ * @param rows The per-peer statistics of the node.
  * @return a string representing the peer server report.
  */
-std::string assemble_report(const peer_manager& manager) {
+std::string assemble_report(const logger& log, const std::vector<peer_stats::row>& rows) {
     std::stringstream report;
 
     // Report all peers
-    const auto& peers_log = manager.peer_log();
+    const auto& peers_log = log.peer_log();
     report << peers_log.size() << '\n';
     for(const auto& peer : peers_log)
         report << peer << '\n';
 
     // Report peers learned by sources
-    const auto& source_log = manager.source_log();
+    const auto& source_log = log.source_log();
     report << source_log.size() << '\n';
     for(const auto& [src, entry] : source_log) {
         report << src << '\n' << entry.date << '\n';
@@ -269,24 +1205,47 @@ std::string assemble_report(const peer_manager& manager) {
     }
 
     // Report peers acquired by 'peer' updates
-    const auto& recv_peers_log = manager.recv_peers_log();
+    const auto& recv_peers_log = log.recv_peers_log();
     report << recv_peers_log.size() << '\n';
     for(const auto& peer : recv_peers_log)
         report << peer.to << ' ' << peer.from << ' ' << peer.date << '\n';
 
     // Report sent 'peer' updates
-    const auto& send_peers_log = manager.sent_peers_log();
+    const auto& send_peers_log = log.sent_peers_log();
     report << send_peers_log.size() << '\n';
     for(const auto& peer : send_peers_log)
         report << peer.to << ' ' << peer.from << ' ' << peer.date << '\n';
 
     // Report all snippets
-    const auto& snippet_log = manager.snippet_log();
-    report << snippet_log.size() << '\n';
-    for(const auto& snippet : snippet_log)
-        report << snippet.timestamp << ' ' << snippet.message << ' ' << snippet.sender << '\n';
+    size_t num_snippets = 0;
+    std::stringstream snippets;
+    log.visit_snippets([&](size_t timestamp, std::string_view message, std::string_view sender) {
+        snippets << timestamp << ' ' << message << ' ' << sender << '\n';
+        num_snippets++;
+    });
+    report << num_snippets << '\n' << snippets.str();
+
+    // Report per-peer statistics
+    report << rows.size() << '\n';
+    for(const auto& row : rows) {
+        report << row.peer.to_string();
+        for(const auto val : row.values)
+            report << ' ' << val;
+        report << '\n';
+    }
 
     return report.str();
 }
 
+/**
+ * Takes the current state of a peer manager and generates a runtime report of the peer manager.
+ * @param manager The peer manager to print.
+ * @return a string representing the peer server report.
+ */
+template<typename Log>
+std::string assemble_report(const basic_peer_manager<Log>& manager) {
+    static_assert(Log::keeps_events, "Reports need a logging policy that keeps events");
+    return assemble_report(manager, manager.stats().rows());
+}
+
 #endif //PEER_MANAGER_HPP
@@ -0,0 +1,324 @@
+#ifndef PEER_SAMPLING_HPP
+#define PEER_SAMPLING_HPP
+
+#include "net/socket_address.hpp"
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ * A bounded, randomly refreshed partial view of the network (Cyclon peer sampling).
+ *
+ * Each node only knows up to `capacity` peers, each tagged with the age of the descriptor. Periodically the node
+ * shuffles with the oldest peer of its view: it sends a few random descriptors plus a fresh one for itself, the
+ * other side answers with a few random descriptors of its own, and both replace the descriptors they sent with
+ * the ones they received. Dead peers age out because they never answer, and the resulting overlay stays connected
+ * with a narrow in-degree distribution, so peers drawn from the view are close to a uniform sample of the network.
+ *
+ * The class only implements the protocol logic; the transport is left to the caller.
+ */
+class partial_view {
+public:
+    using peer_type = net::address_v4;
+
+    static constexpr size_t DEFAULT_CAPACITY       = 20;
+    static constexpr size_t DEFAULT_SHUFFLE_LENGTH = 8;
+
+    struct entry {
+        peer_type peer;
+        uint32_t age;
+    };
+
+    explicit partial_view(const peer_type& self, size_t capacity = DEFAULT_CAPACITY,
+                          size_t shuffle_length = DEFAULT_SHUFFLE_LENGTH, uint64_t seed = std::random_device{}())
+            : m_self(self), m_capacity(capacity), m_shuffle_length(std::min(shuffle_length, capacity)), m_rng(seed) {}
+
+    /**
+     * Adds a peer to the view if there is room for it, e.g. while bootstrapping from the registry.
+     * @param peer the peer.
+     */
+    void add(const peer_type& peer) {
+        std::scoped_lock lock(m_mutex);
+        if(peer != m_self && m_view.size() < m_capacity && find(peer) == m_view.end())
+            m_view.push_back({ peer, 0 });
+    }
+
+    /**
+     * Removes a peer from the view.
+     * @param peer the peer.
+     */
+    void remove(const peer_type& peer) {
+        std::scoped_lock lock(m_mutex);
+        const auto it = find(peer);
+        if(it != m_view.end())
+            m_view.erase(it);
+    }
+
+    /**
+     * Starts a shuffle: ages the view, removes its oldest peer and picks the descriptors to send to it.
+     * @return the peer to shuffle with and the descriptors to send, or nothing if the view is empty.
+     */
+    std::optional<std::pair<peer_type, std::vector<entry>>> begin_shuffle() {
+        std::scoped_lock lock(m_mutex);
+        if(m_view.empty()) return std::nullopt;
+        for(auto& e : m_view)
+            e.age += 1;
+        const auto oldest = std::max_element(m_view.begin(), m_view.end(), [](const entry& a, const entry& b) {
+            return a.age < b.age;
+        });
+        const peer_type target = oldest->peer;
+        m_view.erase(oldest);
+
+        m_sent = select(m_shuffle_length - 1);
+        auto entries = m_sent;
+        entries.push_back({ m_self, 0 });
+        return std::make_pair(target, std::move(entries));
+    }
+
+    /**
+     * Answers a shuffle request from another peer and merges the descriptors it sent.
+     * @param from the peer that started the shuffle.
+     * @param received the descriptors it sent.
+     * @return the descriptors to send back.
+     */
+    std::vector<entry> on_request(const peer_type& from, const std::vector<entry>& received) {
+        std::scoped_lock lock(m_mutex);
+        auto reply = select(m_shuffle_length);
+        reply.erase(std::remove_if(reply.begin(), reply.end(), [&](const entry& e) {
+            return e.peer == from;
+        }), reply.end());
+        merge(received, reply);
+        return reply;
+    }
+
+    /**
+     * Merges the descriptors sent back by the peer a shuffle was started with.
+     * @param received the descriptors it sent back.
+     */
+    void on_reply(const std::vector<entry>& received) {
+        std::scoped_lock lock(m_mutex);
+        merge(received, m_sent);
+        m_sent.clear();
+    }
+
+    /**
+     * Draws up to k distinct random peers from the view.
+     * @param k the number of peers.
+     * @return the sampled peers.
+     */
+    std::vector<peer_type> sample(size_t k) {
+        std::scoped_lock lock(m_mutex);
+        std::vector<peer_type> ret;
+        for(const auto& e : select(k))
+            ret.push_back(e.peer);
+        return ret;
+    }
+
+    /**
+     * Gets every peer in the view.
+     * @return the peers of the view.
+     */
+    std::vector<peer_type> peers() const {
+        std::scoped_lock lock(m_mutex);
+        std::vector<peer_type> ret;
+        for(const auto& e : m_view)
+            ret.push_back(e.peer);
+        return ret;
+    }
+
+    [[nodiscard]] size_t size() const {
+        std::scoped_lock lock(m_mutex);
+        return m_view.size();
+    }
+
+    [[nodiscard]] const peer_type& self() const noexcept { return m_self; }
+
+    /**
+     * Encodes descriptors for the wire as "host:port/age,host:port/age,...".
+     * @param entries the descriptors.
+     * @return the encoded descriptors.
+     */
+    static std::string encode(const std::vector<entry>& entries) {
+        std::string ret;
+        for(const auto& e : entries) {
+            if(!ret.empty()) ret += ',';
+            ret += e.peer.to_string() + '/' + std::to_string(e.age);
+        }
+        return ret;
+    }
+
+    /**
+     * Decodes descriptors encoded by partial_view::encode, skipping malformed ones.
+     * @param data the encoded descriptors.
+     * @return the descriptors.
+     */
+    static std::vector<entry> decode(const std::string& data) {
+        std::vector<entry> ret;
+        for(size_t begin = 0; begin < data.size();) {
+            const auto end = std::min(data.find(',', begin), data.size());
+            const auto item = data.substr(begin, end - begin);
+            begin = end + 1;
+            const auto& [address, age] = strings::split(item, '/');
+            const auto& [host, port] = strings::split(address, ':');
+            try {
+                ret.push_back({ { host, static_cast<in_port_t>(std::stoul(port)) }, static_cast<uint32_t>(std::stoul(age)) });
+            } catch(std::exception&) {}
+        }
+        return ret;
+    }
+
+private:
+    std::vector<entry>::iterator find(const peer_type& peer) {
+        return std::find_if(m_view.begin(), m_view.end(), [&](const entry& e) {
+            return e.peer == peer;
+        });
+    }
+
+    /**
+     * Picks up to n distinct random descriptors of the view.
+     */
+    std::vector<entry> select(size_t n) {
+        std::vector<entry> ret;
+        std::sample(m_view.begin(), m_view.end(), std::back_inserter(ret), n, m_rng);
+        return ret;
+    }
+
+    /**
+     * Adds received descriptors to the view, filling empty slots first and then replacing the descriptors that
+     * were sent to the other side.
+     */
+    void merge(const std::vector<entry>& received, std::vector<entry> sent) {
+        for(const auto& e : received) {
+            if(e.peer == m_self) continue;
+            const auto existing = find(e.peer);
+            if(existing != m_view.end()) {
+                existing->age = std::min(existing->age, e.age);
+                continue;
+            }
+            if(m_view.size() < m_capacity) {
+                m_view.push_back(e);
+                continue;
+            }
+            while(!sent.empty()) {
+                const auto victim = find(sent.back().peer);
+                sent.pop_back();
+                if(victim != m_view.end()) {
+                    *victim = e;
+                    break;
+                }
+            }
+        }
+    }
+
+    const peer_type m_self;
+    const size_t m_capacity;
+    const size_t m_shuffle_length;
+
+    std::vector<entry> m_view;
+    std::vector<entry> m_sent;
+    std::mt19937_64 m_rng;
+
+    mutable std::mutex m_mutex;
+};
+
+
+
+/**
+ * Epidemic dissemination of snippets over partial views.
+ *
+ * Once a node only knows the peers of its view, a snippet sent to the view alone would not reach the rest of the
+ * network. Snippets are therefore tagged with their origin and a time to live, e.g.
+ * "snip12%16@10.0.0.1:5000 text": every node delivers a snippet once, and forwards it to its own view with a lower
+ * time to live until it runs out. Nodes without sampling still read the timestamp as 12.
+ */
+namespace gossip {
+
+constexpr char TAG = '%';
+constexpr uint32_t DEFAULT_TTL = 16;      // Every node forwards a snippet once at most, so this only bounds long chains
+
+struct route {
+    uint32_t ttl;                   // Hops the snippet may still be forwarded
+    net::address_v4 origin;         // The node that sent the snippet first
+};
+
+/**
+ * Gets the tag attached to the timestamp of a gossiped snippet.
+ * @param r the route of the snippet.
+ * @return the tag, e.g. "%16@10.0.0.1:5000".
+ */
+std::string tag(const route& r) {
+    return TAG + std::to_string(r.ttl) + '@' + r.origin.to_string();
+}
+
+/**
+ * Splits a gossip tag off a timestamp token, e.g. "12%16@10.0.0.1:5000" becomes { "12", { 16, 10.0.0.1:5000 } }.
+ * @param token the token to split.
+ * @return a pair of the untagged token and the route, if the token had a valid tag.
+ */
+std::pair<std::string, std::optional<route>> untag(const std::string& token) {
+    const auto pos = token.find(TAG);
+    if(pos == std::string::npos) return { token, std::nullopt };
+    const auto at = token.find('@', pos);
+    try {
+        if(at != std::string::npos) {
+            const auto& [host, port] = strings::split(token.substr(at + 1), ':');
+            return { token.substr(0, pos), route { static_cast<uint32_t>(std::stoul(token.substr(pos + 1, at - pos - 1))),
+                                                   { host, static_cast<in_port_t>(std::stoul(port)) } } };
+        }
+    } catch(std::exception&) {}
+    return { token.substr(0, pos), std::nullopt };
+}
+
+/**
+ * Remembers the most recent snippets seen, identified by their origin and Lamport timestamp, so every snippet is
+ * delivered and forwarded once. The oldest ids are forgotten first.
+ */
+class seen_filter {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+    explicit seen_filter(size_t capacity = DEFAULT_CAPACITY)
+            : m_capacity(capacity) {}
+
+    /**
+     * Records a snippet.
+     * @param origin the node that sent the snippet first.
+     * @param timestamp the timestamp given by the origin.
+     * @return true if the snippet was not seen before, false otherwise.
+     */
+    bool insert(const net::address_v4& origin, uint64_t timestamp) {
+        const key_type key = { (uint64_t(origin.address()) << 16) | origin.port(), timestamp };
+        std::scoped_lock lock(m_mutex);
+        if(!m_seen.insert(key).second)
+            return false;
+        m_order.push_back(key);
+        if(m_order.size() > m_capacity) {
+            m_seen.erase(m_order.front());
+            m_order.pop_front();
+        }
+        return true;
+    }
+
+private:
+    using key_type = std::pair<uint64_t, uint64_t>;
+
+    const size_t m_capacity;
+    std::set<key_type> m_seen;
+    std::deque<key_type> m_order;
+    std::mutex m_mutex;
+};
+
+} // gossip
+
+#endif //PEER_SAMPLING_HPP
@@ -0,0 +1,152 @@
+#ifndef PEER_STATS_HPP
+#define PEER_STATS_HPP
+
+#include "net/socket_address.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+/**
+ * Per-peer traffic statistics in a structure-of-arrays layout.
+ *
+ * Every peer of the peer table owns a slot, and every statistic is its own array indexed by slot, so a scan for
+ * the noisiest or slowest peer only touches the one array it ranks by. All values are relaxed atomics: recording
+ * never takes a lock, and readers may see a slightly stale value.
+ *
+ * Each slot also stores the key (address and port) of the peer that owns it, so callers that cache a slot can
+ * check it still belongs to the same peer before recording.
+ */
+class peer_stats {
+public:
+    using peer_type = net::address_v4;
+
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+    static constexpr uint64_t NO_OWNER = 0;
+
+    enum class counter : size_t {
+        messages_in,
+        bytes_in,
+        messages_out,
+        bytes_out,
+        drops,
+        last_snippet,       // Unix time in milliseconds
+        rtt,                // Smoothed round-trip time in microseconds
+        jitter,             // Round-trip time deviation in microseconds
+        corrupt,            // Datagrams dropped by the integrity check
+        count
+    };
+
+    struct row {
+        peer_type peer;
+        std::array<uint64_t, size_t(counter::count)> values;
+
+        [[nodiscard]] uint64_t operator[](counter c) const noexcept { return values[size_t(c)]; }
+    };
+
+    explicit peer_stats(size_t capacity = DEFAULT_CAPACITY)
+            : m_capacity(capacity), m_owners(std::make_unique<std::atomic<uint64_t>[]>(capacity)) {
+        for(auto& column : m_columns)
+            column = std::make_unique<std::atomic<uint64_t>[]>(capacity);
+    }
+
+    /**
+     * Gets the key identifying a peer in the owner array.
+     * @param peer the peer.
+     * @return the address in the upper bits and the port in the lower 16 bits (never NO_OWNER for a set address).
+     */
+    static uint64_t key(const peer_type& peer) noexcept {
+        return (uint64_t(peer.address()) << 16 | peer.port()) + 1;
+    }
+
+    /**
+     * Hands a slot to a new peer and clears its statistics. Called by the owner of the peer table.
+     */
+    void assign(size_t slot, const peer_type& peer) noexcept {
+        for(auto& column : m_columns)
+            column[slot].store(0, std::memory_order_relaxed);
+        m_owners[slot].store(key(peer), std::memory_order_release);
+    }
+
+    /**
+     * Frees the slot of a peer that has left. Called by the owner of the peer table.
+     */
+    void release(size_t slot) noexcept {
+        m_owners[slot].store(NO_OWNER, std::memory_order_release);
+    }
+
+    [[nodiscard]] bool is_owner(size_t slot, const peer_type& peer) const noexcept {
+        return m_owners[slot].load(std::memory_order_acquire) == key(peer);
+    }
+
+    void add(size_t slot, counter c, uint64_t n = 1) noexcept {
+        column(c)[slot].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void set(size_t slot, counter c, uint64_t val) noexcept {
+        column(c)[slot].store(val, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t get(size_t slot, counter c) const noexcept {
+        return column(c)[slot].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Ranks the occupied slots by one statistic.
+     * @param c the statistic to rank by.
+     * @param n the number of peers to return.
+     * @return up to n rows, highest value first.
+     */
+    [[nodiscard]] std::vector<row> top(counter c, size_t n) const {
+        std::vector<std::pair<uint64_t, size_t>> ranked;
+        const auto* values = column(c);
+        for(size_t slot = 0; slot < m_capacity; slot++) {
+            if(m_owners[slot].load(std::memory_order_relaxed) != NO_OWNER)
+                ranked.emplace_back(values[slot].load(std::memory_order_relaxed), slot);
+        }
+        n = std::min(n, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(), std::greater<>());
+        std::vector<row> ret;
+        for(size_t i = 0; i < n; i++)
+            ret.push_back(read(ranked[i].second));
+        return ret;
+    }
+
+    /**
+     * Reads every occupied slot.
+     * @return one row per peer.
+     */
+    [[nodiscard]] std::vector<row> rows() const {
+        std::vector<row> ret;
+        for(size_t slot = 0; slot < m_capacity; slot++) {
+            if(m_owners[slot].load(std::memory_order_relaxed) != NO_OWNER)
+                ret.push_back(read(slot));
+        }
+        return ret;
+    }
+
+    [[nodiscard]] size_t capacity() const noexcept { return m_capacity; }
+
+private:
+    std::atomic<uint64_t>* column(counter c) noexcept { return m_columns[size_t(c)].get(); }
+    const std::atomic<uint64_t>* column(counter c) const noexcept { return m_columns[size_t(c)].get(); }
+
+    [[nodiscard]] row read(size_t slot) const {
+        row ret = {};
+        const uint64_t owner = m_owners[slot].load(std::memory_order_relaxed) - 1;
+        ret.peer = peer_type(htonl(in_addr_t(owner >> 16)), in_port_t(owner & 0xffff));
+        for(size_t i = 0; i < size_t(counter::count); i++)
+            ret.values[i] = m_columns[i][slot].load(std::memory_order_relaxed);
+        return ret;
+    }
+
+    const size_t m_capacity;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_owners;
+    std::array<std::unique_ptr<std::atomic<uint64_t>[]>, size_t(counter::count)> m_columns;
+};
+
+#endif //PEER_STATS_HPP
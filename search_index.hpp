@@ -0,0 +1,394 @@
+#ifndef SEARCH_INDEX_HPP
+#define SEARCH_INDEX_HPP
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * A search over the snippet history. A snippet matches if it contains every term and every phrase, and passes the
+ * sender, timestamp and arrival time filters.
+ */
+struct search_query {
+    std::vector<std::string> terms;
+    std::vector<std::vector<std::string>> phrases;
+    std::string sender;                                      // Empty matches any sender
+    uint64_t from = 0;                                       // Lamport timestamps
+    uint64_t to   = std::numeric_limits<uint64_t>::max();
+    clocks::time_type since = clocks::time_type::min();      // Wall-clock arrival times
+    clocks::time_type until = clocks::time_type::max();
+    size_t limit  = 20;
+
+    [[nodiscard]] bool has_time_filter() const noexcept {
+        return since != clocks::time_type::min() || until != clocks::time_type::max();
+    }
+};
+
+/**
+ * A snippet matched by a search.
+ */
+struct search_hit {
+    uint32_t document;
+    uint64_t timestamp;
+    std::string sender;
+    std::string message;
+};
+
+
+/**
+ * Varint helpers used to compress the posting lists.
+ */
+namespace varint {
+
+/**
+ * Appends an unsigned integer to a byte vector using 7 bits per byte (LEB128).
+ * @param out the byte vector.
+ * @param val the value to encode.
+ */
+inline void encode(std::vector<uint8_t>& out, uint32_t val) {
+    while(val >= 0x80) {
+        out.push_back(static_cast<uint8_t>(val | 0x80));
+        val >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(val));
+}
+
+/**
+ * Decodes an unsigned integer encoded by varint::encode and advances the pointer past it.
+ * @param p the pointer to the first byte of the value.
+ * @return the decoded value.
+ */
+inline uint32_t decode(const uint8_t*& p) {
+    uint32_t val = 0;
+    for(int shift = 0; ; shift += 7) {
+        const uint8_t byte = *p++;
+        val |= uint32_t(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return val;
+    }
+}
+
+} // varint
+
+
+/**
+ * An incremental inverted index over the snippet history.
+ *
+ * Every snippet becomes a document with a sequential id. For each term, the index keeps a posting list of the
+ * documents that contain it, where each posting is the delta from the previous document id followed by the
+ * delta-encoded positions of the term inside the document, all as varints. Positions make phrase queries possible
+ * without re-reading the text. The snippet text is kept in a single arena so hits can be printed directly.
+ */
+class search_index {
+    struct posting_list {
+        std::vector<uint8_t> bytes;
+        uint32_t last_document = 0;
+        uint32_t documents = 0;
+    };
+
+    struct document {
+        uint64_t timestamp;
+        clocks::time_type received;         // Epoch if unknown
+        uint32_t sender;
+        uint32_t size;
+        size_t offset;
+    };
+
+    /**
+     * Sequentially decodes a posting list.
+     */
+    class cursor {
+    public:
+        explicit cursor(const posting_list& list)
+                : m_pos(list.bytes.data()), m_end(list.bytes.data() + list.bytes.size()) {}
+
+        /**
+         * Advances to the first posting whose document is not less than the target.
+         * @return false once the list is exhausted.
+         */
+        bool seek(uint32_t target) {
+            while(!m_valid || m_document < target) {
+                if(m_pos == m_end) return false;
+                m_document += varint::decode(m_pos);
+                const uint32_t count = varint::decode(m_pos);
+                m_positions.clear();
+                for(uint32_t i = 0, pos = 0; i < count; i++)
+                    m_positions.push_back(pos += varint::decode(m_pos));
+                m_valid = true;
+            }
+            return true;
+        }
+
+        [[nodiscard]] uint32_t document() const noexcept { return m_document; }
+        [[nodiscard]] const std::vector<uint32_t>& positions() const noexcept { return m_positions; }
+
+    private:
+        const uint8_t* m_pos;
+        const uint8_t* m_end;
+        uint32_t m_document = 0;
+        bool m_valid = false;
+        std::vector<uint32_t> m_positions;
+    };
+
+public:
+    /**
+     * Splits text into lowercase alphanumeric terms.
+     * @param text the text to split.
+     * @return the terms in order of appearance.
+     */
+    static std::vector<std::string> tokenize(std::string_view text) {
+        std::vector<std::string> terms;
+        std::string term;
+        for(const char c : text) {
+            if(std::isalnum(static_cast<unsigned char>(c))) {
+                term += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            } else if(!term.empty()) {
+                terms.push_back(std::move(term));
+                term.clear();
+            }
+        }
+        if(!term.empty())
+            terms.push_back(std::move(term));
+        return terms;
+    }
+
+    /**
+     * Parses an age such as "90s", "30m", "2h" or "1d" (seconds without a unit) into the time that long ago.
+     * @param age the age.
+     * @param now the current time.
+     * @return the time point.
+     * @throws std::logic_error if the age is malformed.
+     */
+    static clocks::time_type parse_age(const std::string& age, clocks::time_type now) {
+        size_t end = 0;
+        const auto value = static_cast<int64_t>(std::stoull(age, &end));
+        const auto unit = age.substr(end);
+        if(unit.empty() || unit == "s") return now - std::chrono::seconds(value);
+        if(unit == "m")                 return now - std::chrono::minutes(value);
+        if(unit == "h")                 return now - std::chrono::hours(value);
+        if(unit == "d")                 return now - std::chrono::hours(24 * value);
+        throw std::invalid_argument("Unknown unit '" + unit + "'");
+    }
+
+    /**
+     * Parses a query of the form: words "a phrase" from:<host:port> after:<ts> before:<ts> since:<age> until:<age>
+     * limit:<n>, where after/before filter on Lamport timestamps and since/until on the arrival time, given as an
+     * age, e.g. "outage since:2h until:1h" for what was said about an outage between two and one hours ago.
+     * @param text the query string.
+     * @return the parsed query.
+     */
+    static search_query parse_query(std::string_view text) {
+        const auto now = clocks::get_current_time();
+        search_query query;
+        while(!text.empty()) {
+            const auto start = text.find_first_not_of(' ');
+            if(start == std::string_view::npos) break;
+            text.remove_prefix(start);
+            if(text.front() == '"') {
+                const auto close = text.find('"', 1);
+                auto phrase = tokenize(text.substr(1, close == std::string_view::npos ? text.npos : close - 1));
+                if(phrase.size() == 1)
+                    query.terms.push_back(std::move(phrase.front()));
+                else if(!phrase.empty())
+                    query.phrases.push_back(std::move(phrase));
+                text.remove_prefix(close == std::string_view::npos ? text.size() : close + 1);
+                continue;
+            }
+            const auto word = std::string(text.substr(0, text.find(' ')));
+            text.remove_prefix(word.size());
+            try {
+                if(strings::starts_with(word, "from:"))
+                    query.sender = word.substr(5);
+                else if(strings::starts_with(word, "after:"))
+                    query.from = std::stoull(word.substr(6));
+                else if(strings::starts_with(word, "before:"))
+                    query.to = std::stoull(word.substr(7));
+                else if(strings::starts_with(word, "since:"))
+                    query.since = parse_age(word.substr(6), now);
+                else if(strings::starts_with(word, "until:"))
+                    query.until = parse_age(word.substr(6), now);
+                else if(strings::starts_with(word, "limit:"))
+                    query.limit = std::stoul(word.substr(6));
+                else for(auto& term : tokenize(word))
+                    query.terms.push_back(std::move(term));
+            } catch(std::logic_error&) {
+                std::cerr << "Ignoring malformed filter '" << word << "'" << std::endl;
+            }
+        }
+        return query;
+    }
+
+    /**
+     * Adds a snippet to the index.
+     * @param timestamp the Lamport timestamp of the snippet.
+     * @param sender the address of the sender.
+     * @param message the snippet contents.
+     * @param received the wall-clock arrival time of the snippet; the epoch if unknown, in which case the snippet
+     * only matches queries without arrival time filters.
+     * @return the document id assigned to the snippet.
+     */
+    uint32_t add(uint64_t timestamp, std::string_view sender, std::string_view message,
+                 clocks::time_type received = clocks::get_current_time()) {
+        const auto terms = tokenize(message);
+        std::unique_lock lock(m_mutex);
+        const auto id = static_cast<uint32_t>(m_documents.size());
+        auto [it, inserted] = m_sender_ids.try_emplace(std::string(sender), static_cast<uint32_t>(m_senders.size()));
+        if(inserted)
+            m_senders.push_back(&it->first);
+        m_documents.push_back({ timestamp, received, it->second, static_cast<uint32_t>(message.size()), m_text.size() });
+        m_text.append(message);
+
+        // Group the positions of each distinct term so it gets a single posting for this document
+        std::unordered_map<std::string_view, std::vector<uint32_t>> positions;
+        for(uint32_t pos = 0; pos < terms.size(); pos++)
+            positions[terms[pos]].push_back(pos);
+        for(const auto& [term, list] : positions) {
+            auto& postings = m_postings[std::string(term)];
+            varint::encode(postings.bytes, id - postings.last_document);
+            varint::encode(postings.bytes, static_cast<uint32_t>(list.size()));
+            for(uint32_t i = 0, prev = 0; i < list.size(); prev = list[i++])
+                varint::encode(postings.bytes, list[i] - prev);
+            postings.last_document = id;
+            postings.documents += 1;
+        }
+        return id;
+    }
+
+    /**
+     * Runs a query against the index.
+     * @param query the query to run.
+     * @return up to query.limit matching snippets, newest first.
+     */
+    std::vector<search_hit> search(const search_query& query) const {
+        std::shared_lock lock(m_mutex);
+        uint32_t sender = std::numeric_limits<uint32_t>::max();
+        if(!query.sender.empty()) {
+            const auto it = m_sender_ids.find(query.sender);
+            if(it == m_sender_ids.end()) return {};
+            sender = it->second;
+        }
+        const bool timed = query.has_time_filter();
+        const auto accept = [&](uint32_t doc) {
+            const auto& entry = m_documents[doc];
+            return entry.timestamp >= query.from && entry.timestamp <= query.to &&
+                   (query.sender.empty() || entry.sender == sender) &&
+                   (!timed || (entry.received != clocks::time_type() && entry.received >= query.since && entry.received <= query.until));
+        };
+
+        // Every term that must appear, with the rarest list first so it drives the intersection
+        std::vector<std::string> required = query.terms;
+        for(const auto& phrase : query.phrases)
+            required.insert(required.end(), phrase.begin(), phrase.end());
+        std::sort(required.begin(), required.end());
+        required.erase(std::unique(required.begin(), required.end()), required.end());
+        std::vector<const posting_list*> lists;
+        for(const auto& term : required) {
+            const auto it = m_postings.find(term);
+            if(it == m_postings.end()) return {};
+            lists.push_back(&it->second);
+        }
+
+        std::vector<uint32_t> matches;
+        if(lists.empty()) {
+            for(uint32_t doc = 0; doc < m_documents.size(); doc++)
+                if(accept(doc)) matches.push_back(doc);
+        } else {
+            std::vector<size_t> order(lists.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return lists[a]->documents < lists[b]->documents;
+            });
+            std::vector<cursor> cursors;
+            for(const auto* list : lists)
+                cursors.emplace_back(*list);
+            auto& lead = cursors[order.front()];
+            for(uint32_t target = 0; lead.seek(target); target = lead.document() + 1) {
+                const uint32_t doc = lead.document();
+                bool all = true;
+                for(size_t i = 1; i < order.size() && all; i++) {
+                    auto& other = cursors[order[i]];
+                    if(!other.seek(doc)) return collect(matches, query.limit);
+                    all = other.document() == doc;
+                }
+                if(all && accept(doc) && match_phrases(query, required, cursors))
+                    matches.push_back(doc);
+            }
+        }
+        return collect(matches, query.limit);
+    }
+
+    [[nodiscard]] size_t size() const {
+        std::shared_lock lock(m_mutex);
+        return m_documents.size();
+    }
+
+    [[nodiscard]] size_t term_count() const {
+        std::shared_lock lock(m_mutex);
+        return m_postings.size();
+    }
+
+    [[nodiscard]] size_t posting_bytes() const {
+        std::shared_lock lock(m_mutex);
+        size_t total = 0;
+        for(const auto& [term, list] : m_postings)
+            total += list.bytes.size();
+        return total;
+    }
+
+private:
+    /**
+     * Checks that the phrases of a query appear contiguously in the document all cursors currently point to.
+     */
+    static bool match_phrases(const search_query& query, const std::vector<std::string>& required, const std::vector<cursor>& cursors) {
+        const auto positions_of = [&](const std::string& term) -> const std::vector<uint32_t>& {
+            return cursors[std::lower_bound(required.begin(), required.end(), term) - required.begin()].positions();
+        };
+        for(const auto& phrase : query.phrases) {
+            const auto& first = positions_of(phrase.front());
+            const bool found = std::any_of(first.begin(), first.end(), [&](uint32_t start) {
+                for(size_t i = 1; i < phrase.size(); i++) {
+                    const auto& next = positions_of(phrase[i]);
+                    if(!std::binary_search(next.begin(), next.end(), start + static_cast<uint32_t>(i)))
+                        return false;
+                }
+                return true;
+            });
+            if(!found) return false;
+        }
+        return true;
+    }
+
+    /**
+     * Turns the newest matching documents into hits.
+     */
+    std::vector<search_hit> collect(const std::vector<uint32_t>& matches, size_t limit) const {
+        std::vector<search_hit> hits;
+        for(auto it = matches.rbegin(); it != matches.rend() && hits.size() < limit; ++it) {
+            const auto& entry = m_documents[*it];
+            hits.push_back({ *it, entry.timestamp, *m_senders[entry.sender], m_text.substr(entry.offset, entry.size) });
+        }
+        return hits;
+    }
+
+    std::unordered_map<std::string, posting_list> m_postings;
+    std::vector<document> m_documents;
+    std::unordered_map<std::string, uint32_t> m_sender_ids;
+    std::vector<const std::string*> m_senders;
+    std::string m_text;
+
+    mutable std::shared_mutex m_mutex;
+};
+
+#endif //SEARCH_INDEX_HPP
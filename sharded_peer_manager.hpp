@@ -0,0 +1,452 @@
+#ifndef SHARDED_PEER_MANAGER_HPP
+#define SHARDED_PEER_MANAGER_HPP
+
+#include "net/buffer.hpp"
+#include "net/udp.hpp"
+
+#include "channels.hpp"
+#include "io_context.hpp"
+#include "logger.hpp"
+#include "peer_manager.hpp"
+#include "spsc_queue.hpp"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+/**
+ * A shared-nothing, thread-per-core variant of peer_manager.
+ *
+ * The node runs one shard per core. Each shard has its own thread pinned to its core, its own socket bound to the
+ * node address with SO_REUSEPORT (the kernel spreads incoming datagrams over the sockets by source), its own
+ * logger, and owns the slice of the peer table whose endpoints hash to it. A shard never touches the state of
+ * another one: when it learns something about a peer owned by another shard, or when a snippet has to be fanned
+ * out, it sends a message over a single-producer/single-consumer queue to that shard and wakes it up with an
+ * eventfd. The only state shared by the shards is the Lamport clock, an atomic.
+ *
+ * Snippets typed by the user are picked up by shard 0 and fanned out by every shard to its own slice. Only the base
+ * protocol and the outgoing journal are available in this mode (see UNSUPPORTED_OPTIONS in main.cpp); the logs of
+ * all shards are merged for the report once the node has stopped.
+ *
+ * Every shard also counts the traffic it exchanges with each peer, whichever shard owns it, and the report sums the
+ * counts of all shards for every peer of the table. Round-trip times are not measured in this mode.
+ */
+class sharded_peer_manager : public std::enable_shared_from_this<sharded_peer_manager> {
+    static constexpr auto DEFAULT_KEEP_ALIVE = std::chrono::seconds(5);
+    static constexpr auto DEFAULT_TIMEOUT    = std::chrono::seconds(20);
+    static constexpr auto OUTGOING_POLL      = std::chrono::milliseconds(200);
+    static constexpr size_t QUEUE_CAPACITY   = 4096;
+    static constexpr size_t MAX_RECV_BATCH   = 64;
+
+public:
+    using address_type = net::address_v4;
+    using peer_type    = net::address_v4;
+    using time_type    = clocks::time_type;
+
+    /**
+     * Per-shard counters, e.g. to check the load is spread evenly.
+     */
+    struct shard_statistics {
+        uint64_t datagrams = 0;     // Datagrams received by the shard's socket
+        uint64_t forwarded = 0;     // Messages sent to other shards
+        uint64_t dropped   = 0;     // Messages lost to a full queue
+        size_t peers = 0;           // Size of the shard's slice of the peer table
+    };
+
+    /**
+     * @param ioc the context shared with the snippet interface.
+     * @param src the address of the registry the initial peers were received from.
+     * @param peers the initial peers.
+     * @param address the address of this node.
+     * @param shards the number of shards; defaults to one per core.
+     * @param debug enables debug output.
+     */
+    sharded_peer_manager(net::io_context& ioc, const net::address_v4& src, const std::unordered_set<peer_type>& peers,
+                         const address_type& address, size_t shards = std::max(1u, std::thread::hardware_concurrency()), bool debug = false)
+            : m_ioc(ioc), m_address(address), m_timestamp(0), debug_mode(debug) {
+        shards = std::max<size_t>(shards, 1);
+        for(size_t id = 0; id < shards; id++)
+            m_shards.push_back(std::make_unique<shard>(id, shards, address));
+        const auto now = clocks::get_current_time();
+        for(const auto& peer : peers) {
+            std::cerr << peer << " has joined." << std::endl;
+            m_shards[owner(peer)]->peers[peer] = now;
+            m_shards[0]->log.log_peer(peer.to_string());
+        }
+        m_shards[0]->log.log_source(src.to_string(), peers);
+    }
+
+    /**
+     * Runs every shard on its own core. Blocks until the node receives 'stop'.
+     */
+    void run() {
+        std::vector<std::thread> threads;
+        const auto cores = std::max(1u, std::thread::hardware_concurrency());
+        for(auto& s : m_shards) {
+            threads.emplace_back([self = shared_from_this(), &s] {
+                self->run_shard(*s);
+            });
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(s->id % cores, &cpus);
+            ::pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpus), &cpus);
+        }
+        for(auto& thread : threads)
+            thread.join();
+    }
+
+    /**
+     * Gets the shard owning a peer.
+     * @param peer the peer.
+     * @return the index of the shard.
+     */
+    [[nodiscard]] size_t owner(const peer_type& peer) const noexcept {
+        uint64_t h = key(peer);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return static_cast<size_t>(h % m_shards.size());
+    }
+
+    [[nodiscard]] size_t shard_count() const noexcept { return m_shards.size(); }
+
+    /**
+     * Gets the counters of a shard. Exact once the node has stopped.
+     * @param id the index of the shard.
+     */
+    [[nodiscard]] shard_statistics stats(size_t id) const {
+        const auto& s = *m_shards[id];
+        return { s.datagrams.load(std::memory_order_relaxed), s.forwarded.load(std::memory_order_relaxed),
+                 s.dropped.load(std::memory_order_relaxed), s.slice_size.load(std::memory_order_relaxed) };
+    }
+
+    /**
+     * Generates the runtime report of the node from the merged logs of every shard.
+     * Must only be called once the node has stopped.
+     * @return a string representing the peer server report.
+     */
+    [[nodiscard]] std::string report() const {
+        logger merged;
+        for(const auto& s : m_shards) {
+            log_snapshot logs;
+            s->log.copy_logs(logs);
+            merged.restore_logs(std::move(logs));
+        }
+        return assemble_report(merged, stats_rows());
+    }
+
+    /**
+     * Gets the statistics of every peer of the table, summed over the shards that exchanged traffic with it.
+     * Must only be called once the node has stopped.
+     * @return one row per peer.
+     */
+    [[nodiscard]] std::vector<peer_stats::row> stats_rows() const {
+        std::unordered_map<peer_type, peer_stats::row> merged;
+        for(const auto& s : m_shards) {
+            for(const auto& [peer, time] : s->peers)
+                merged[peer] = { peer, {} };
+        }
+        for(const auto& s : m_shards) {
+            for(const auto& [id, entry] : s->traffic) {
+                const auto it = merged.find(entry.row.peer);
+                if(it == merged.end()) continue;
+                for(size_t i = 0; i < size_t(peer_stats::counter::count); i++) {
+                    auto& val = it->second.values[i];
+                    val = i == size_t(peer_stats::counter::last_snippet) ? std::max(val, entry.row.values[i]) : val + entry.row.values[i];
+                }
+            }
+        }
+        std::vector<peer_stats::row> ret;
+        ret.reserve(merged.size());
+        for(auto& [peer, row] : merged)
+            ret.push_back(row);
+        return ret;
+    }
+
+private:
+    /**
+     * The traffic a shard exchanged with a peer, and the keep-alive round in which it last did.
+     */
+    struct traffic_entry {
+        peer_stats::row row;
+        uint64_t round;
+    };
+
+    struct message {
+        enum class kind { seen, fanout } type;
+        peer_type peer;
+        std::shared_ptr<const std::string> data;
+    };
+
+    struct shard {
+        shard(size_t id, size_t shards, const address_type& address)
+                : id(id), wakeup(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+            socket.set_option(SOL_SOCKET, SO_REUSEPORT, 1);
+            if(!socket.bind(address))
+                std::cerr << "Shard " << id << " failed to bind " << address << ": " << socket.last_error_str() << std::endl;
+            for(size_t from = 0; from < shards; from++)
+                inbox.push_back(from == id ? nullptr : std::make_unique<spsc_queue<message>>(QUEUE_CAPACITY));
+        }
+
+        ~shard() {
+            ::close(wakeup);
+        }
+
+        const size_t id;
+        net::udp::socket socket;
+        const int wakeup;
+        std::vector<std::unique_ptr<spsc_queue<message>>> inbox;   // One queue per sending shard
+
+        // Only touched by the shard's own thread (or before run())
+        std::unordered_map<peer_type, time_type> peers;
+        std::unordered_map<uint64_t, traffic_entry> traffic;      // By key(), cheaper to hash than the address
+        uint64_t round = 0;
+        logger log;
+        bool running = true;
+
+        std::atomic<uint64_t> datagrams = 0;
+        std::atomic<uint64_t> forwarded = 0;
+        std::atomic<uint64_t> dropped = 0;
+        std::atomic<size_t> slice_size = 0;
+    };
+
+    void run_shard(shard& s) {
+        if(debug_mode)
+            std::cerr << "Shard " << s.id << " listening..." << std::endl;
+        const std::string heartbeat = "peer" + m_address.to_string();
+        auto next_keep_alive = steady_clock::now();
+        pollfd fds[2] = { { s.socket.handle(), POLLIN, 0 }, { s.wakeup, POLLIN, 0 } };
+        while(s.running && !m_stopping.load(std::memory_order_acquire)) {
+            const auto now = steady_clock::now();
+            if(now >= next_keep_alive) {
+                send_to_slice(s, heartbeat);
+                clean_slice(s);
+                next_keep_alive = now + DEFAULT_KEEP_ALIVE;
+            }
+            auto wait = next_keep_alive - now;
+            if(s.id == 0)
+                wait = std::min<steady_clock::duration>(wait, OUTGOING_POLL);
+            ::poll(fds, 2, static_cast<int>(ceil<milliseconds>(wait).count()));
+
+            if(fds[1].revents & POLLIN) {
+                uint64_t count;
+                [[maybe_unused]] const auto ret = ::read(s.wakeup, &count, sizeof(count));
+            }
+            for(auto& queue : s.inbox) {
+                if(!queue) continue;
+                while(auto msg = queue->pop())
+                    handle_message(s, *msg);
+            }
+            if(fds[0].revents & POLLIN)
+                drain_socket(s);
+            if(s.id == 0)
+                fan_out_outgoing(s);
+            s.slice_size.store(s.peers.size(), std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Handles every datagram queued on the shard's socket, up to a batch.
+     */
+    void drain_socket(shard& s) {
+        address_type sender;
+        for(size_t i = 0; i < MAX_RECV_BATCH && s.running; i++) {
+            char data[2048] = {};
+            const auto len = s.socket.recv_from(net::buffer(data, sizeof(data) - 1), MSG_DONTWAIT, &sender);
+            if(len < 0) break;
+            s.datagrams.fetch_add(1, std::memory_order_relaxed);
+            auto& stats = traffic(s, sender);
+            stats.values[size_t(peer_stats::counter::messages_in)]++;
+            stats.values[size_t(peer_stats::counter::bytes_in)] += size_t(len);
+            auto [request, contents] = parse_request(data);
+            if(request == "peer")
+                on_peer(s, sender, strings::trim(contents));
+            else if(request == "snip")
+                on_snip(s, sender, strings::trim(contents));
+            else if(request == "stop")
+                stop(s);
+        }
+    }
+
+    void on_peer(shard& s, const address_type& sender, const std::string& content) {
+        auto address = channels::untag(content).first;
+        address = address.substr(0, address.find('@'));
+        try {
+            const auto& [host, port] = strings::split(address, ':');
+            const peer_type peer = { host, static_cast<in_port_t>(std::stoul(port)) };
+            s.log.log_recv_peer(sender.to_string(), peer.to_string());
+            s.log.log_peer(sender.to_string());
+            s.log.log_peer(peer.to_string());
+            touch(s, sender);
+            if(peer != sender)
+                touch(s, peer);
+        } catch(net::address_error& err) {
+            std::cerr << err.what() << std::endl;
+        } catch(std::logic_error& err) {
+            std::cerr << "Invalid peer address '" << address << "'" << std::endl;
+        }
+    }
+
+    void on_snip(shard& s, const address_type& sender, const std::string& content) {
+        const auto message = strings::split(content, ' ');
+        try {
+            const auto timestamp = std::stoul(channels::untag(message.first).first);
+            size_t current = m_timestamp.load();
+            while(current < timestamp && !m_timestamp.compare_exchange_weak(current, timestamp)) {}
+        } catch(std::logic_error&) {
+            return;
+        }
+        touch(s, sender);
+        const auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+        traffic(s, sender).values[size_t(peer_stats::counter::last_snippet)] = now.count();
+        const auto timestamp = m_timestamp.load();
+        m_ioc.put_incoming(sender, message.second, timestamp);
+        s.log.log_snippet(timestamp, message.second, sender.to_string());
+    }
+
+    /**
+     * Picks up the snippets typed by the user and fans them out: each shard sends them to its own slice.
+     */
+    void fan_out_outgoing(shard& s) {
+        while(m_ioc.has_outgoing()) {
+            const auto text = m_ioc.pop_outgoing();
+            const auto timestamp = ++m_timestamp;
+            const auto snippet = std::make_shared<const std::string>("snip" + std::to_string(timestamp) + " " + text);
+            for(size_t to = 0; to < m_shards.size(); to++) {
+                if(to != s.id)
+                    forward(s, to, { message::kind::fanout, {}, snippet });
+            }
+            send_to_slice(s, *snippet);
+            m_ioc.ack_outgoing();
+        }
+    }
+
+    /**
+     * Stops every shard. The flag is shared rather than queued, so a full or stopped inbox cannot hold up shutdown.
+     */
+    void stop(shard& s) {
+        s.running = false;
+        m_stopping.store(true, std::memory_order_release);
+        for(size_t to = 0; to < m_shards.size(); to++) {
+            if(to != s.id)
+                signal(to);
+        }
+    }
+
+    static uint64_t key(const peer_type& peer) noexcept {
+        return uint64_t(peer.address()) << 16 | peer.port();
+    }
+
+    void handle_message(shard& s, const message& msg) {
+        switch(msg.type) {
+            case message::kind::seen:
+                refresh(s, msg.peer);
+                break;
+            case message::kind::fanout:
+                send_to_slice(s, *msg.data);
+                break;
+        }
+    }
+
+    /**
+     * Records that a peer is alive, in this shard's slice if it owns the peer, or by telling the owner otherwise.
+     */
+    void touch(shard& s, const peer_type& peer) {
+        const auto to = owner(peer);
+        if(to == s.id)
+            refresh(s, peer);
+        else
+            forward(s, to, { message::kind::seen, peer, nullptr });
+    }
+
+    static void refresh(shard& s, const peer_type& peer) {
+        const auto [it, inserted] = s.peers.try_emplace(peer);
+        if(inserted)
+            std::cerr << peer << " has joined." << std::endl;
+        it->second = clocks::get_current_time();
+    }
+
+    void forward(shard& s, size_t to, message msg) {
+        if(!m_shards[to]->inbox[s.id]->push(std::move(msg))) {
+            s.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        s.forwarded.fetch_add(1, std::memory_order_relaxed);
+        signal(to);
+    }
+
+    void signal(size_t to) const {
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto ret = ::write(m_shards[to]->wakeup, &one, sizeof(one));
+    }
+
+    void send_to_slice(shard& s, const std::string& message) {
+        const auto from = m_address.to_string();
+        const bool heartbeat = strings::starts_with(message, "peer");
+        for(const auto& [addr, time] : s.peers) {
+            const auto len = s.socket.send_to(net::buffer(message), addr);
+            auto& stats = traffic(s, addr);
+            if(len < 0) {
+                stats.values[size_t(peer_stats::counter::drops)]++;
+            } else {
+                stats.values[size_t(peer_stats::counter::messages_out)]++;
+                stats.values[size_t(peer_stats::counter::bytes_out)] += size_t(len);
+            }
+            if(heartbeat)
+                s.log.log_sent_peer(addr.to_string(), from);
+        }
+    }
+
+    static void clean_slice(shard& s) {
+        const auto now = clocks::get_current_time();
+        for(auto it = s.peers.begin(); it != s.peers.end();) {
+            if(now - it->second > DEFAULT_TIMEOUT) {
+                std::cerr << it->first << " has left." << std::endl;
+                it = s.peers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        // Statistics of peers this shard stopped exchanging traffic with are dropped, whether it owns them or not
+        s.round++;
+        for(auto it = s.traffic.begin(); it != s.traffic.end();) {
+            if(s.round - it->second.round > DEFAULT_TIMEOUT / DEFAULT_KEEP_ALIVE)
+                it = s.traffic.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    /**
+     * Gets the statistics of the traffic a shard exchanges with a peer, and marks the peer as active in this round.
+     */
+    static peer_stats::row& traffic(shard& s, const peer_type& peer) {
+        auto& entry = s.traffic[key(peer)];
+        entry.row.peer = peer;
+        entry.round = s.round;
+        return entry.row;
+    }
+
+    net::io_context& m_ioc;
+    const address_type m_address;
+    std::vector<std::unique_ptr<shard>> m_shards;
+    std::atomic<size_t> m_timestamp;
+    std::atomic<bool> m_stopping = false;
+
+    const bool debug_mode;
+};
+
+#endif //SHARDED_PEER_MANAGER_HPP
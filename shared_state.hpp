@@ -3,15 +3,26 @@
 
 #include "net/socket_address.hpp"
 
+#include "diag.hpp"
+#include "flight_recorder.hpp"
+#include "peer_stats.hpp"
 #include "utils.hpp"
 
 #include <atomic>
 #include <mutex>
+#include <optional>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 
 /**
  * This class manages all shared data passed along the threads in peer_manager.
+ *
+ * The peer table can be bounded (see limit()): once it is full, a new peer evicts the peer chosen by the CLOCK
+ * algorithm, i.e. the first peer the clock hand finds that has not been heard from since the hand last passed it.
+ * The table can also refuse peers only announced by others until they are heard from directly, so that spoofed
+ * announcements cannot fill it.
  */
 class shared_state {
 public:
@@ -21,29 +32,165 @@ public:
 
     using peer_map = std::unordered_map<peer_type, time_type>;
 
-    explicit shared_state(const address_type& address)
-            : m_address(address), m_running(true), m_timestamp(0) {}
+    explicit shared_state(const address_type& address, size_t stats_capacity = peer_stats::DEFAULT_CAPACITY)
+            : m_address(address), m_stats(stats_capacity), m_running(true), m_timestamp(0) {}
 
     const address_type& address() const noexcept { return m_address; }
     const peer_map& peers() const noexcept { return m_peers; }
     size_t timestamp() const noexcept { return m_timestamp; }
     bool is_running() const noexcept { return m_running; }
+    peer_stats& stats() noexcept { return m_stats; }
+    const peer_stats& stats() const noexcept { return m_stats; }
 
     void join(const peer_type& peer) {
         std::scoped_lock lock(m_mutex);
-        std::cerr << peer << " has joined." << std::endl;
-        m_peers[peer] = clocks::get_current_time();
+        diag::log(diag::severity::info, diag::kind::peer_joined, peer);
+        admit(peer, clocks::get_current_time());
     }
     void leave(const peer_type& peer) {
         std::scoped_lock lock(m_mutex);
-        std::cerr << peer << " has left." << std::endl;
-        m_peers.erase(peer);
+        diag::log(diag::severity::info, diag::kind::peer_left, peer);
+        if(m_peers.erase(peer) != 0) {
+            release_slot(peer);
+            release_clock(peer);
+            flight::record(flight::kind::peer_expired, 0, flight::pack_peer(peer.address(), peer.port()));
+        }
     }
     void update(const peer_type& peer) {
         std::scoped_lock lock(m_mutex);
         if(m_peers.find(peer) == m_peers.end())
-            std::cerr << peer << " has joined." << std::endl;
-        m_peers[peer] = clocks::get_current_time();
+            diag::log(diag::severity::info, diag::kind::peer_joined, peer);
+        admit(peer, clocks::get_current_time());
+    }
+    void update(const std::vector<peer_type>& peers) {
+        const auto now = clocks::get_current_time();
+        std::scoped_lock lock(m_mutex);
+        for(const auto& peer : peers) {
+            if(m_peers.find(peer) == m_peers.end())
+                diag::log(diag::severity::info, diag::kind::peer_joined, peer);
+            admit(peer, now);
+        }
+    }
+
+    /**
+     * Refreshes peers announced by other peers rather than heard from directly. Without admission control this is
+     * the same as update(); with it, announced peers are neither added nor kept alive, only counted.
+     * @param peers the announced peers.
+     */
+    void announce(const std::vector<peer_type>& peers) {
+        if(!m_verify) {
+            update(peers);
+            return;
+        }
+        std::scoped_lock lock(m_mutex);
+        for(const auto& peer : peers) {
+            if(m_peers.find(peer) == m_peers.end())
+                m_rejected++;
+        }
+    }
+
+    /**
+     * Bounds the peer table. Must be called before the state is shared between threads.
+     * @param capacity the largest number of peers kept at once, or 0 for no bound.
+     * @param verify whether peers must be heard from directly before they are admitted, see announce().
+     */
+    void limit(size_t capacity, bool verify) {
+        std::scoped_lock lock(m_mutex);
+        m_capacity = capacity;
+        m_verify = verify;
+        for(const auto& [peer, time] : m_peers)
+            track_clock(peer);
+        while(m_capacity && m_peers.size() > m_capacity)
+            evict();
+    }
+
+    /**
+     * Takes the peers evicted from the table since the previous call, so that their other state can be dropped.
+     * @return the evicted peers.
+     */
+    std::vector<peer_type> take_evicted() {
+        std::scoped_lock lock(m_mutex);
+        return std::exchange(m_evicted, {});
+    }
+
+    /**
+     * Gets the number of peers evicted to make room for new ones.
+     */
+    uint64_t evictions() const {
+        std::scoped_lock lock(m_mutex);
+        return m_evictions;
+    }
+
+    /**
+     * Gets the number of announcements of unknown peers refused by admission control.
+     */
+    uint64_t rejected() const {
+        std::scoped_lock lock(m_mutex);
+        return m_rejected;
+    }
+
+    /**
+     * Gets the slot of a peer in the statistics table.
+     * Slots are cached per thread and checked against the owner recorded in the table, so the lock is only taken
+     * the first time a thread sees a peer, or after the slot was handed to another peer.
+     * @param peer the peer.
+     * @return the slot, or nothing if the peer is not in the peer table or the statistics table is full.
+     */
+    std::optional<size_t> slot(const peer_type& peer) const {
+        thread_local std::unordered_map<const shared_state*, std::unordered_map<peer_type, size_t>> cache;
+        auto& slots = cache[this];
+        if(slots.size() > 2 * m_stats.capacity())
+            slots.clear();      // Peers come and go; do not remember every peer ever seen
+        const auto it = slots.find(peer);
+        if(it != slots.end() && m_stats.is_owner(it->second, peer))
+            return it->second;
+        std::scoped_lock lock(m_mutex);
+        const auto found = m_slots.find(peer);
+        if(found == m_slots.end()) {
+            slots.erase(peer);
+            return std::nullopt;
+        }
+        slots[peer] = found->second;
+        return found->second;
+    }
+
+    /**
+     * Adds to a statistic of a peer. Does nothing if the peer has no slot.
+     * @param peer the peer.
+     * @param c the statistic.
+     * @param n the amount to add.
+     */
+    void record(const peer_type& peer, peer_stats::counter c, uint64_t n = 1) {
+        if(const auto s = slot(peer))
+            m_stats.add(*s, c, n);
+    }
+
+    /**
+     * Checks if a peer is in the peer table while holding its lock.
+     */
+    bool contains(const peer_type& peer) const {
+        std::scoped_lock lock(m_mutex);
+        return m_peers.count(peer) != 0;
+    }
+
+    /**
+     * Copies the peer table while holding its lock.
+     * @return a copy of the peer table.
+     */
+    peer_map copy_peers() const {
+        std::scoped_lock lock(m_mutex);
+        return m_peers;
+    }
+
+    /**
+     * Adds a peer restored from a snapshot, keeping the most recent of the two last-seen times.
+     * @param peer the restored peer.
+     * @param time the time the peer was last seen.
+     */
+    void restore(const peer_type& peer, time_type time) {
+        std::scoped_lock lock(m_mutex);
+        const auto found = m_peers.find(peer);
+        admit(peer, found == m_peers.end() ? time : std::max(found->second, time));
     }
 
     void increment_timestamp() {
@@ -58,10 +205,130 @@ public:
     }
 
 private:
+    struct clock_entry {
+        peer_type peer;
+        bool referenced;
+        bool live;
+    };
+
+    /**
+     * Adds a peer or refreshes its last-seen time, evicting another peer first if the table is full.
+     * Must be called with the lock held.
+     */
+    void admit(const peer_type& peer, time_type time) {
+        const auto found = m_peers.find(peer);
+        if(found != m_peers.end()) {
+            found->second = time;
+            if(m_capacity)
+                m_clock[m_clock_index.at(peer)].referenced = true;
+            return;
+        }
+        if(m_capacity && m_peers.size() >= m_capacity)
+            evict();
+        m_peers.emplace(peer, time);
+        assign_slot(peer);
+        if(m_capacity)
+            track_clock(peer);
+        flight::record(flight::kind::peer_joined, 0, flight::pack_peer(peer.address(), peer.port()));
+    }
+
+    /**
+     * Evicts the next unreferenced peer under the clock hand, clearing the references it passes on the way.
+     * Must be called with the lock held.
+     */
+    void evict() {
+        while(true) {
+            m_hand = (m_hand + 1) % m_clock.size();
+            auto& entry = m_clock[m_hand];
+            if(!entry.live) continue;
+            if(entry.referenced) {
+                entry.referenced = false;
+                continue;
+            }
+            const auto peer = entry.peer;
+            m_peers.erase(peer);
+            release_slot(peer);
+            release_clock(peer);
+            m_evicted.push_back(peer);
+            m_evictions++;
+            flight::record(flight::kind::peer_expired, 0, flight::pack_peer(peer.address(), peer.port()));
+            return;
+        }
+    }
+
+    /**
+     * Gives a peer an entry on the clock. Must be called with the lock held.
+     */
+    void track_clock(const peer_type& peer) {
+        if(m_clock_index.count(peer)) return;
+        size_t index = m_clock.size();
+        if(!m_free_clock.empty()) {
+            index = m_free_clock.back();
+            m_free_clock.pop_back();
+            m_clock[index] = { peer, false, true };
+        } else {
+            m_clock.push_back({ peer, false, true });
+        }
+        m_clock_index[peer] = index;
+    }
+
+    /**
+     * Frees the clock entry of a peer that has left. Must be called with the lock held.
+     */
+    void release_clock(const peer_type& peer) {
+        const auto it = m_clock_index.find(peer);
+        if(it == m_clock_index.end()) return;
+        m_clock[it->second].live = false;
+        m_free_clock.push_back(it->second);
+        m_clock_index.erase(it);
+    }
+
+    /**
+     * Hands a free statistics slot to a new peer. Must be called with the lock held.
+     */
+    void assign_slot(const peer_type& peer) {
+        size_t slot;
+        if(!m_free_slots.empty()) {
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+        } else if(m_next_slot < m_stats.capacity()) {
+            slot = m_next_slot++;
+        } else {
+            return;
+        }
+        m_slots[peer] = slot;
+        m_stats.assign(slot, peer);
+    }
+
+    /**
+     * Returns the statistics slot of a peer that has left. Must be called with the lock held.
+     */
+    void release_slot(const peer_type& peer) {
+        const auto it = m_slots.find(peer);
+        if(it == m_slots.end()) return;
+        m_stats.release(it->second);
+        m_free_slots.push_back(it->second);
+        m_slots.erase(it);
+    }
+
     const net::address_v4 m_address;
 
     std::unordered_map<peer_type, time_type> m_peers;
-    std::mutex m_mutex;
+    std::unordered_map<peer_type, size_t> m_slots;
+    std::vector<size_t> m_free_slots;
+    size_t m_next_slot = 0;
+    peer_stats m_stats;
+    mutable std::mutex m_mutex;
+
+    size_t m_capacity = 0;
+    bool m_verify = false;
+    std::vector<clock_entry> m_clock;                   // Only kept when the table is bounded
+    std::unordered_map<peer_type, size_t> m_clock_index;
+    std::vector<size_t> m_free_clock;
+    size_t m_hand = 0;
+    std::vector<peer_type> m_evicted;
+    uint64_t m_evictions = 0;
+    uint64_t m_rejected = 0;
 
     std::atomic<size_t> m_timestamp;
     std::atomic<bool> m_running;
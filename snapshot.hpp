@@ -0,0 +1,350 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "logger.hpp"
+#include "shared_state.hpp"
+#include "utils.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+
+/**
+ * Whole-node snapshots: the peer table, the Lamport clock and the event logs, stored in a versioned binary file.
+ *
+ * File layout (all integers in host byte order):
+ *     magic "P2PSNAP\0", u32 version, u32 section count,
+ *     then for each section: u32 tag, u64 payload size, payload.
+ * Strings are stored as a u32 size followed by their bytes. Readers skip sections with unknown tags.
+ */
+namespace snapshot {
+
+constexpr char MAGIC[8] = { 'P', '2', 'P', 'S', 'N', 'A', 'P', '\0' };
+constexpr uint32_t VERSION = 1;
+
+enum class section : uint32_t {
+    clock      = 1,
+    peers      = 2,
+    peer_log   = 3,
+    source_log = 4,
+    sent_log   = 5,
+    recv_log   = 6,
+    snippets   = 7
+};
+
+
+/**
+ * Serializes values into a growing byte buffer.
+ */
+class encoder {
+public:
+    template<typename T>
+    void put(const T& val) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values can be encoded.");
+        m_data.append(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+
+    void put(std::string_view str) {
+        put(static_cast<uint32_t>(str.size()));
+        m_data.append(str);
+    }
+
+    void put(const std::string& str) {
+        put(std::string_view(str));
+    }
+
+    void put(const net::address_v4& addr) {
+        put(static_cast<uint32_t>(addr.address()));
+        put(static_cast<uint16_t>(addr.port()));
+    }
+
+    void put(const peer_entry& entry) {
+        put(entry.to);
+        put(entry.from);
+        put(entry.date);
+    }
+
+    /**
+     * Starts a section. Must be followed by end_section() once its payload has been written.
+     */
+    void begin_section(section tag) {
+        put(static_cast<uint32_t>(tag));
+        m_section = m_data.size();
+        put(uint64_t(0));
+        m_sections += 1;
+    }
+
+    void end_section() {
+        const uint64_t size = m_data.size() - m_section - sizeof(uint64_t);
+        std::memcpy(m_data.data() + m_section, &size, sizeof(size));
+    }
+
+    [[nodiscard]] const std::string& data() const noexcept { return m_data; }
+    [[nodiscard]] uint32_t sections() const noexcept { return m_sections; }
+
+private:
+    std::string m_data;
+    size_t m_section = 0;
+    uint32_t m_sections = 0;
+};
+
+
+/**
+ * Reads values back from a block of bytes, throwing if the block is too short.
+ */
+class decoder {
+public:
+    decoder(const char* data, size_t size)
+            : m_pos(data), m_end(data + size) {}
+
+    template<typename T>
+    T get() {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values can be decoded.");
+        T val;
+        std::memcpy(&val, take(sizeof(T)), sizeof(T));
+        return val;
+    }
+
+    std::string get_string() {
+        const auto size = get<uint32_t>();
+        return { take(size), size };
+    }
+
+    const char* get_bytes(size_t n) {
+        return take(n);
+    }
+
+    net::address_v4 get_address() {
+        const auto addr = get<uint32_t>();
+        const auto port = get<uint16_t>();
+        return { htonl(addr), port };
+    }
+
+    peer_entry get_peer_entry() {
+        auto to = get_string();
+        auto from = get_string();
+        return { std::move(to), std::move(from), get_string() };
+    }
+
+    /**
+     * Splits off the next n bytes into their own decoder.
+     */
+    decoder sub(size_t n) {
+        return { take(n), n };
+    }
+
+    [[nodiscard]] bool empty() const noexcept { return m_pos == m_end; }
+
+private:
+    const char* take(size_t n) {
+        if(static_cast<size_t>(m_end - m_pos) < n)
+            throw std::runtime_error("Truncated snapshot");
+        const char* ret = m_pos;
+        m_pos += n;
+        return ret;
+    }
+
+    const char* m_pos;
+    const char* m_end;
+};
+
+
+/**
+ * Takes consistent snapshots of a running node without stopping it.
+ *
+ * A snapshot is an epoch cut: the event logs are copied first, then the clock is read, then the peer table is
+ * copied, each under its own lock. The Lamport clock never goes backwards, so it is at least as large as any
+ * timestamp in the captured logs. Since the logs are append-only, the writer keeps its own copy and only copies
+ * what was appended since the last cut, so the locks are held for a short time. Encoding and file I/O happen
+ * afterwards without any lock of the node held, and the file is replaced atomically. Snippets kept in an attached
+ * snippet store are not part of the snapshot, since the store already persists them.
+ */
+class writer {
+public:
+    explicit writer(std::string path)
+            : m_path(std::move(path)) {}
+
+    /**
+     * Writes a snapshot of the node. Concurrent calls, e.g. a periodic save and the save on shutdown, are serialized.
+     * @param state the shared state of the node.
+     * @param log the event logs of the node.
+     * @return true if the snapshot was written, false otherwise.
+     */
+    bool save(const shared_state& state, const logger& log) {
+        std::scoped_lock lock(m_mutex);
+        log.copy_logs(m_logs);
+        const uint64_t timestamp = state.timestamp();
+        const auto peers = state.copy_peers();
+
+        encoder enc;
+        enc.begin_section(section::clock);
+        enc.put(timestamp);
+        enc.end_section();
+
+        enc.begin_section(section::peers);
+        enc.put(static_cast<uint32_t>(peers.size()));
+        for(const auto& [peer, time] : peers) {
+            enc.put(peer);
+            enc.put(static_cast<int64_t>(time.time_since_epoch().count()));
+        }
+        enc.end_section();
+
+        enc.begin_section(section::peer_log);
+        enc.put(static_cast<uint32_t>(m_logs.peers.size()));
+        for(const auto& peer : m_logs.peers)
+            enc.put(peer);
+        enc.end_section();
+
+        enc.begin_section(section::source_log);
+        enc.put(static_cast<uint32_t>(m_logs.sources.size()));
+        for(const auto& [src, entry] : m_logs.sources) {
+            enc.put(src);
+            enc.put(entry.date);
+            enc.put(static_cast<uint32_t>(entry.peers.size()));
+            for(const auto& peer : entry.peers)
+                enc.put(peer);
+        }
+        enc.end_section();
+
+        for(const auto& [tag, entries] : { std::make_pair(section::sent_log, &m_logs.sent_peers),
+                                           std::make_pair(section::recv_log, &m_logs.recv_peers) }) {
+            enc.begin_section(tag);
+            enc.put(static_cast<uint32_t>(entries->size()));
+            for(const auto& entry : *entries)
+                enc.put(entry);
+            enc.end_section();
+        }
+
+        enc.begin_section(section::snippets);
+        enc.put(static_cast<uint32_t>(m_logs.snippets.size()));
+        for(const auto& snippet : m_logs.snippets) {
+            enc.put(static_cast<uint64_t>(snippet.timestamp));
+            enc.put(snippet.message);
+            enc.put(snippet.sender);
+        }
+        enc.end_section();
+
+        return write_file(enc);
+    }
+
+    [[nodiscard]] const std::string& path() const noexcept { return m_path; }
+
+private:
+    bool write_file(const encoder& enc) const {
+        const auto tmp_path = m_path + ".tmp";
+        const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0) {
+            std::cerr << "Failed to open snapshot " << tmp_path << std::endl;
+            return false;
+        }
+        const uint32_t sections = enc.sections();
+        iovec iov[4] = {
+                { const_cast<char*>(MAGIC), sizeof(MAGIC) },
+                { const_cast<uint32_t*>(&VERSION), sizeof(VERSION) },
+                { const_cast<uint32_t*>(&sections), sizeof(sections) },
+                { const_cast<char*>(enc.data().data()), enc.data().size() } };
+        const size_t length = sizeof(MAGIC) + sizeof(VERSION) + sizeof(sections) + enc.data().size();
+        bool ok = ::writev(fd, iov, 4) == static_cast<ssize_t>(length);
+        ok = ::fdatasync(fd) == 0 && ok;
+        ::close(fd);
+        if(!ok || ::rename(tmp_path.c_str(), m_path.c_str()) != 0) {
+            std::cerr << "Failed to write snapshot " << m_path << std::endl;
+            ::unlink(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    const std::string m_path;
+    log_snapshot m_logs;
+    std::mutex m_mutex;
+};
+
+
+/**
+ * Restores a node from a snapshot file. The file is memory-mapped and decoded in place.
+ * Restored peers keep their last-seen times, so stale ones are evicted by the usual timeout.
+ * @param path the path of the snapshot file.
+ * @param state the shared state to restore into.
+ * @param log the logger to restore into; must be called before any snapshot is taken of it.
+ * @return true if a snapshot was restored, false if there was none or it could not be read.
+ */
+bool restore(const std::string& path, shared_state& state, logger& log) {
+    const files::mapped_file map(path);
+    if(!map.is_open()) return false;
+    try {
+        decoder dec(map.data(), map.size());
+        if(std::memcmp(dec.get_bytes(sizeof(MAGIC)), MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("Not a snapshot");
+        if(const auto version = dec.get<uint32_t>(); version != VERSION)
+            throw std::runtime_error("Unsupported snapshot version " + std::to_string(version));
+
+        log_snapshot logs;
+        uint64_t timestamp = 0;
+        std::vector<std::pair<net::address_v4, clocks::time_type>> peers;
+        for(auto n = dec.get<uint32_t>(); n > 0; n--) {
+            const auto tag = static_cast<section>(dec.get<uint32_t>());
+            auto body = dec.sub(dec.get<uint64_t>());
+            switch(tag) {
+                case section::clock:
+                    timestamp = body.get<uint64_t>();
+                    break;
+                case section::peers:
+                    for(auto i = body.get<uint32_t>(); i > 0; i--) {
+                        const auto peer = body.get_address();
+                        peers.emplace_back(peer, clocks::time_type(std::chrono::seconds(body.get<int64_t>())));
+                    }
+                    break;
+                case section::peer_log:
+                    for(auto i = body.get<uint32_t>(); i > 0; i--)
+                        logs.peers.insert(body.get_string());
+                    break;
+                case section::source_log:
+                    for(auto i = body.get<uint32_t>(); i > 0; i--) {
+                        const auto src = body.get_string();
+                        auto& entry = logs.sources[src];
+                        entry.date = body.get_string();
+                        for(auto j = body.get<uint32_t>(); j > 0; j--)
+                            entry.peers.insert(body.get_address());
+                    }
+                    break;
+                case section::sent_log:
+                case section::recv_log: {
+                    auto& entries = tag == section::sent_log ? logs.sent_peers : logs.recv_peers;
+                    for(auto i = body.get<uint32_t>(); i > 0; i--)
+                        entries.push_back(body.get_peer_entry());
+                    break;
+                }
+                case section::snippets:
+                    for(auto i = body.get<uint32_t>(); i > 0; i--) {
+                        const auto ts = body.get<uint64_t>();
+                        auto message = body.get_string();
+                        logs.snippets.push_back({ static_cast<size_t>(ts), std::move(message), body.get_string() });
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        state.update_timestamp(timestamp);
+        for(const auto& [peer, time] : peers)
+            state.restore(peer, time);
+        log.restore_logs(std::move(logs));
+        return true;
+    } catch(std::exception& err) {
+        std::cerr << "Failed to restore snapshot " << path << ": " << err.what() << std::endl;
+        return false;
+    }
+}
+
+} // snapshot
+
+#endif //SNAPSHOT_HPP
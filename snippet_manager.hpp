@@ -2,6 +2,7 @@
 #define SNIPPET_MANAGER_HPP
 
 #include "io_context.hpp"
+#include "search_index.hpp"
 
 #include <iostream>
 #include <memory>
@@ -14,11 +15,16 @@
  * as well as takes any incoming messages from the server and print them to the given output stream.
  *
  * By default the streams are stdin and stdout.
+ *
+ * If a search index is given, lines starting with '/search ' are run as queries against the snippet history and
+ * answered locally instead of being sent.
  */
 class snippet_manager : public std::enable_shared_from_this<snippet_manager> {
+    static constexpr std::string_view SEARCH_COMMAND = "/search ";
+
 public:
-    explicit snippet_manager(net::io_context& ioc)
-            : m_ioc(ioc), m_running(false) {}
+    explicit snippet_manager(net::io_context& ioc, std::shared_ptr<search_index> index = nullptr)
+            : m_ioc(ioc), m_index(std::move(index)), m_running(false) {}
 
     /**
      * Starts the snippet interface.
@@ -29,8 +35,8 @@ public:
      */
     void run(std::istream& in = std::cin, std::ostream& out = std::cout) {
         m_running = true;
-        std::thread([self = shared_from_this(), &in](){
-            self->read(in);
+        std::thread([self = shared_from_this(), &in, &out](){
+            self->read(in, out);
         }).detach();
         std::thread([self = shared_from_this(), &out](){
             self->write(out);
@@ -57,16 +63,32 @@ private:
     /**
      * Reads input from the input stream (delimited by a newline), and queues it in outgoing messages.
      * @param in the input stream.
+     * @param out the output stream for local command results.
      */
-    void read(std::istream& in) {
+    void read(std::istream& in, std::ostream& out) {
         std::string message;
         while(this->is_running()) {
             std::getline(in, message);
-            m_ioc.put_outgoing(message);
+            if(m_index && strings::starts_with(message, std::string(SEARCH_COMMAND)))
+                search(message.substr(SEARCH_COMMAND.size()), out);
+            else
+                m_ioc.put_outgoing(message);
             message.clear();
         }
     }
 
+    /**
+     * Runs a search query against the snippet history and prints the matching snippets, newest first.
+     * @param query the query string.
+     * @param out the output stream.
+     */
+    void search(const std::string& query, std::ostream& out) const {
+        const auto hits = m_index->search(search_index::parse_query(query));
+        for(const auto& hit : hits)
+            out << net::message{ hit.sender, hit.message, hit.timestamp, "" } << '\n';
+        out << hits.size() << " result(s)" << std::endl;
+    }
+
     /**
      * Takes any incoming messages and prints them to the output stream.
      * @param out the output stream.
@@ -79,6 +101,7 @@ private:
     }
 
     net::io_context& m_ioc;
+    std::shared_ptr<search_index> m_index;
 
     std::atomic<bool> m_running;
 };
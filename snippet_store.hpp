@@ -0,0 +1,416 @@
+#ifndef SNIPPET_STORE_HPP
+#define SNIPPET_STORE_HPP
+
+#include "utils.hpp"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+
+/**
+ * Configuration of a snippet store.
+ */
+struct store_options {
+    std::string directory = "snippets";                     // Directory holding the segment files
+    size_t segment_bytes  = 4 << 20;                        // A segment is sealed once it grows past this size
+    std::chrono::seconds segment_age = std::chrono::hours(1);    // ... or once its first record is this old
+    size_t index_interval = 4 << 10;                        // Bytes between two entries of the sparse index
+    size_t retention_bytes = 256 << 20;                     // Oldest segments are dropped past this size (0 = off)
+    std::chrono::seconds retention_age = std::chrono::hours(24 * 7); // ... or once they are this old (0 = off)
+};
+
+/**
+ * A snippet read back from the store. The views point into a mapped segment and are only valid for the duration
+ * of the scan callback.
+ */
+struct snippet_view {
+    uint64_t timestamp;
+    std::string_view sender;
+    std::string_view message;
+};
+
+
+/**
+ * A log-structured, append-only store of snippets.
+ *
+ * Snippets are appended to the active segment file of the store directory. Once the active segment is large or old
+ * enough it is sealed and a new one is started. Every segment keeps a sparse index of (timestamp, offset) pairs and
+ * the set of senders it contains, so range scans by Lamport timestamp or by sender only map and walk the segments
+ * that can contain a match. Old segments are dropped by age or total size, and small sealed segments are merged
+ * together during compaction.
+ */
+class snippet_store {
+    static constexpr uint16_t RECORD_MAGIC = 0x5350;    // "SP"
+    static constexpr const char* SEGMENT_EXTENSION = ".seg";
+
+    /**
+     * On-disk header that precedes the sender and message bytes of every record.
+     */
+    struct record_header {
+        uint64_t timestamp;
+        uint32_t message_size;
+        uint16_t sender_size;
+        uint16_t magic;
+    };
+    static_assert(sizeof(record_header) == 16, "Record header must not contain padding.");
+
+    struct segment {
+        uint64_t id = 0;
+        std::string path;
+        size_t bytes   = 0;
+        size_t records = 0;
+        uint64_t min_timestamp = std::numeric_limits<uint64_t>::max();
+        uint64_t max_timestamp = 0;
+        // Each entry holds the largest timestamp stored before the offset, so everything before it can be skipped.
+        std::vector<std::pair<uint64_t, size_t>> index;
+        std::unordered_set<size_t> senders;
+        clocks::time_type created;
+        clocks::time_type last_write;
+    };
+
+public:
+    using time_type = clocks::time_type;
+
+    /**
+     * Opens (or creates) the store in the configured directory. Existing segments are re-indexed, any torn record
+     * at the end of a segment is truncated, and a fresh active segment is started.
+     * @param opts the store configuration.
+     */
+    explicit snippet_store(store_options opts = {})
+            : m_options(std::move(opts)) {
+        std::filesystem::create_directories(m_options.directory);
+        std::vector<uint64_t> ids;
+        for(const auto& file : std::filesystem::directory_iterator(m_options.directory)) {
+            if(file.path().extension() != SEGMENT_EXTENSION) continue;
+            try {
+                ids.push_back(std::stoull(file.path().stem().string()));
+            } catch(std::exception&) {}
+        }
+        std::sort(ids.begin(), ids.end());
+        for(const auto id : ids)
+            m_segments.push_back(load_segment(id));
+        open_segment(ids.empty() ? 0 : ids.back() + 1);
+    }
+
+    snippet_store(const snippet_store&) = delete;
+    snippet_store& operator=(const snippet_store&) = delete;
+
+    ~snippet_store() {
+        if(m_fd >= 0) ::close(m_fd);
+    }
+
+    /**
+     * Appends a snippet to the active segment, sealing it first if it has grown too large or too old.
+     * @param timestamp the Lamport timestamp of the snippet.
+     * @param sender the address of the sender.
+     * @param message the snippet contents.
+     * @return true if the snippet was written, false otherwise.
+     */
+    bool append(uint64_t timestamp, std::string_view sender, std::string_view message) {
+        std::scoped_lock lock(m_mutex);
+        const auto now = clocks::get_current_time();
+        if(active().bytes >= m_options.segment_bytes ||
+                (active().records > 0 && now - active().created > m_options.segment_age))
+            open_segment(active().id + 1);
+
+        sender = sender.substr(0, std::numeric_limits<uint16_t>::max());
+        const record_header header = {
+                timestamp, static_cast<uint32_t>(message.size()), static_cast<uint16_t>(sender.size()), RECORD_MAGIC };
+        iovec iov[3] = {
+                { const_cast<record_header*>(&header), sizeof(header) },
+                { const_cast<char*>(sender.data()), sender.size() },
+                { const_cast<char*>(message.data()), message.size() } };
+        const size_t length = sizeof(header) + sender.size() + message.size();
+        const auto written = ::writev(m_fd, iov, 3);
+        if(written != static_cast<ssize_t>(length)) {
+            std::cerr << "Failed to append snippet to " << active().path << std::endl;
+            if(written > 0 && ::ftruncate(m_fd, static_cast<off_t>(active().bytes)) != 0)
+                std::cerr << "Failed to truncate " << active().path << std::endl;
+            return false;
+        }
+        if(active().records == 0)
+            active().created = now;
+        observe(active(), active().bytes, { timestamp, sender, message }, length);
+        active().last_write = now;
+        m_records += 1;
+        return true;
+    }
+
+    /**
+     * Visits every stored snippet whose timestamp lies in [from, to], in storage order.
+     * @param from the lowest timestamp to visit.
+     * @param to the highest timestamp to visit.
+     * @param fn a callable taking a const snippet_view&.
+     */
+    template<typename Fn>
+    void scan(uint64_t from, uint64_t to, Fn&& fn) const {
+        for(const auto& [map, begin] : open_range(from, to, nullptr)) {
+            for_each_record(map.data(), begin, map.size(), [&](size_t, const snippet_view& view) {
+                if(view.timestamp >= from && view.timestamp <= to)
+                    fn(view);
+            });
+        }
+    }
+
+    /**
+     * Visits every stored snippet from the given sender whose timestamp lies in [from, to], in storage order.
+     * @param sender the address of the sender.
+     * @param from the lowest timestamp to visit.
+     * @param to the highest timestamp to visit.
+     * @param fn a callable taking a const snippet_view&.
+     */
+    template<typename Fn>
+    void scan_sender(std::string_view sender, uint64_t from, uint64_t to, Fn&& fn) const {
+        const size_t hash = std::hash<std::string_view>{}(sender);
+        for(const auto& [map, begin] : open_range(from, to, &hash)) {
+            for_each_record(map.data(), begin, map.size(), [&](size_t, const snippet_view& view) {
+                if(view.timestamp >= from && view.timestamp <= to && view.sender == sender)
+                    fn(view);
+            });
+        }
+    }
+
+    /**
+     * Drops the oldest sealed segments while the store exceeds its retention age or size.
+     * @return the number of segments dropped.
+     */
+    size_t enforce_retention() {
+        std::scoped_lock lock(m_mutex);
+        const auto now = clocks::get_current_time();
+        size_t total = 0, dropped = 0;
+        for(const auto& seg : m_segments)
+            total += seg.bytes;
+        while(m_segments.size() > 1) {
+            const auto& oldest = m_segments.front();
+            const bool too_old = m_options.retention_age.count() > 0 && now - oldest.last_write > m_options.retention_age;
+            const bool too_big = m_options.retention_bytes > 0 && total > m_options.retention_bytes;
+            if(!too_old && !too_big) break;
+            total -= oldest.bytes;
+            m_records -= oldest.records;
+            ::unlink(oldest.path.c_str());
+            m_segments.erase(m_segments.begin());
+            dropped += 1;
+        }
+        return dropped;
+    }
+
+    /**
+     * Merges runs of adjacent sealed segments whose combined size fits within a single segment.
+     * Readers that already mapped a merged segment keep reading the old file until they are done.
+     * @return the number of segments removed by merging.
+     */
+    size_t compact() {
+        std::scoped_lock lock(m_mutex);
+        size_t merged = 0;
+        std::vector<segment> result;
+        for(size_t i = 0; i + 1 < m_segments.size();) {
+            size_t j = i + 1, bytes = m_segments[i].bytes;
+            while(j + 1 < m_segments.size() && bytes + m_segments[j].bytes <= m_options.segment_bytes)
+                bytes += m_segments[j++].bytes;
+            if(j - i == 1) {
+                result.push_back(std::move(m_segments[i]));
+            } else if(auto seg = merge_segments(i, j)) {
+                result.push_back(std::move(*seg));
+                merged += j - i - 1;
+            } else {
+                std::move(m_segments.begin() + i, m_segments.begin() + j, std::back_inserter(result));
+            }
+            i = j;
+        }
+        result.push_back(std::move(m_segments.back()));
+        m_segments = std::move(result);
+        return merged;
+    }
+
+    /**
+     * Runs the periodic store maintenance (retention followed by compaction).
+     */
+    void maintain() {
+        enforce_retention();
+        compact();
+    }
+
+    [[nodiscard]] size_t size() const noexcept {
+        std::scoped_lock lock(m_mutex);
+        return m_records;
+    }
+
+    [[nodiscard]] size_t bytes() const noexcept {
+        std::scoped_lock lock(m_mutex);
+        size_t total = 0;
+        for(const auto& seg : m_segments)
+            total += seg.bytes;
+        return total;
+    }
+
+    [[nodiscard]] size_t segment_count() const noexcept {
+        std::scoped_lock lock(m_mutex);
+        return m_segments.size();
+    }
+
+    [[nodiscard]] const store_options& options() const noexcept {
+        return m_options;
+    }
+
+private:
+    /**
+     * Walks the complete records of a mapped segment between two offsets.
+     * @return the offset following the last complete record.
+     */
+    template<typename Fn>
+    static size_t for_each_record(const char* data, size_t begin, size_t end, Fn&& fn) {
+        size_t pos = begin;
+        while(pos + sizeof(record_header) <= end) {
+            record_header header = {};
+            std::memcpy(&header, data + pos, sizeof(header));
+            const char* body = data + pos + sizeof(header);
+            const size_t length = sizeof(header) + header.sender_size + header.message_size;
+            if(header.magic != RECORD_MAGIC || pos + length > end) break;
+            fn(pos, snippet_view{ header.timestamp, { body, header.sender_size },
+                                  { body + header.sender_size, header.message_size } });
+            pos += length;
+        }
+        return pos;
+    }
+
+    /**
+     * Updates the metadata of a segment with a record written at the given offset.
+     */
+    void observe(segment& seg, size_t offset, const snippet_view& view, size_t length) const {
+        if(seg.index.empty() || offset - seg.index.back().second >= m_options.index_interval)
+            seg.index.emplace_back(seg.records == 0 ? 0 : seg.max_timestamp, offset);
+        seg.min_timestamp = std::min(seg.min_timestamp, view.timestamp);
+        seg.max_timestamp = std::max(seg.max_timestamp, view.timestamp);
+        seg.senders.insert(std::hash<std::string_view>{}(view.sender));
+        seg.bytes = offset + length;
+        seg.records += 1;
+    }
+
+    /**
+     * Maps every segment that may hold records in [from, to] (and from the sender, if given), and finds the offset
+     * from which each of them has to be walked. Mapping happens under the lock; walking does not.
+     */
+    std::vector<std::pair<files::mapped_file, size_t>> open_range(uint64_t from, uint64_t to, const size_t* sender) const {
+        std::vector<std::pair<files::mapped_file, size_t>> ret;
+        std::scoped_lock lock(m_mutex);
+        for(const auto& seg : m_segments) {
+            if(seg.records == 0 || seg.max_timestamp < from || seg.min_timestamp > to) continue;
+            if(sender && seg.senders.count(*sender) == 0) continue;
+            auto it = std::lower_bound(seg.index.begin(), seg.index.end(), from, [](const auto& entry, uint64_t ts) {
+                return entry.first < ts;
+            });
+            const size_t begin = it == seg.index.begin() ? 0 : std::prev(it)->second;
+            files::mapped_file map(seg.path, seg.bytes);
+            if(map.is_open())
+                ret.emplace_back(std::move(map), begin);
+        }
+        return ret;
+    }
+
+    /**
+     * Rebuilds the metadata of an existing segment file, truncating any incomplete record at its tail.
+     */
+    segment load_segment(uint64_t id) {
+        segment seg;
+        seg.id = id;
+        seg.path = segment_path(id);
+        struct stat st = {};
+        if(::stat(seg.path.c_str(), &st) == 0)
+            seg.created = seg.last_write = time_type(std::chrono::seconds(st.st_mtime));
+        const files::mapped_file map(seg.path);
+        const size_t end = for_each_record(map.data(), 0, map.size(), [&](size_t offset, const snippet_view& view) {
+            observe(seg, offset, view, sizeof(record_header) + view.sender.size() + view.message.size());
+        });
+        if(end < map.size() && ::truncate(seg.path.c_str(), static_cast<off_t>(end)) != 0)
+            std::cerr << "Failed to truncate " << seg.path << std::endl;
+        m_records += seg.records;
+        return seg;
+    }
+
+    /**
+     * Seals the active segment (if any) and starts a new one with the given id.
+     */
+    void open_segment(uint64_t id) {
+        const auto path = segment_path(id);
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(fd < 0)
+            throw std::system_error(errno, std::generic_category(), "Failed to open segment " + path);
+        if(m_fd >= 0) ::close(m_fd);
+        m_fd = fd;
+        segment seg;
+        seg.id = id;
+        seg.path = path;
+        seg.created = seg.last_write = clocks::get_current_time();
+        m_segments.push_back(std::move(seg));
+    }
+
+    /**
+     * Copies segments [first, last) into a single file that replaces the first of them.
+     * @return the merged segment, or nothing if the segments were left untouched.
+     */
+    std::optional<segment> merge_segments(size_t first, size_t last) {
+        const auto& target = m_segments[first];
+        const auto tmp_path = target.path + ".tmp";
+        const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0;
+        for(size_t i = first; ok && i < last; i++) {
+            const files::mapped_file map(m_segments[i].path, m_segments[i].bytes);
+            ok = map.size() == m_segments[i].bytes && ::write(fd, map.data(), map.size()) == ssize_t(map.size());
+        }
+        if(fd >= 0) {
+            ok = ok && ::fdatasync(fd) == 0;
+            ::close(fd);
+        }
+        if(!ok || ::rename(tmp_path.c_str(), target.path.c_str()) != 0) {
+            std::cerr << "Failed to compact segments into " << target.path << std::endl;
+            ::unlink(tmp_path.c_str());
+            return std::nullopt;
+        }
+
+        segment merged;
+        merged.id = target.id;
+        merged.path = target.path;
+        merged.created = target.created;
+        merged.last_write = m_segments[last - 1].last_write;
+        const files::mapped_file map(merged.path);
+        for_each_record(map.data(), 0, map.size(), [&](size_t offset, const snippet_view& view) {
+            observe(merged, offset, view, sizeof(record_header) + view.sender.size() + view.message.size());
+        });
+        for(size_t i = first + 1; i < last; i++)
+            ::unlink(m_segments[i].path.c_str());
+        return merged;
+    }
+
+    [[nodiscard]] std::string segment_path(uint64_t id) const {
+        char name[32] = {};
+        std::snprintf(name, sizeof(name), "%020llu%s", static_cast<unsigned long long>(id), SEGMENT_EXTENSION);
+        return (std::filesystem::path(m_options.directory) / name).string();
+    }
+
+    segment& active() noexcept { return m_segments.back(); }
+
+    const store_options m_options;
+
+    std::vector<segment> m_segments;
+    size_t m_records = 0;
+    int m_fd = -1;
+
+    mutable std::mutex m_mutex;
+};
+
+#endif //SNIPPET_STORE_HPP
@@ -0,0 +1,90 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+
+/**
+ * A bounded, lock-free queue for exactly one producer thread and one consumer thread.
+ *
+ * The ring holds a power-of-two number of slots. The producer only writes the tail and the consumer only writes the
+ * head, and each side keeps a cached copy of the other's index, so the shared cache lines are only touched when
+ * the cached index says the queue looks full (or empty).
+ */
+template<typename T>
+class spsc_queue {
+    static constexpr size_t CACHE_LINE = 64;
+
+public:
+    /**
+     * @param capacity the minimum number of elements the queue can hold; rounded up to a power of two.
+     */
+    explicit spsc_queue(size_t capacity = 1024)
+            : m_mask(round_up(capacity) - 1), m_slots(std::make_unique<std::optional<T>[]>(m_mask + 1)) {}
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    /**
+     * Adds an element. Must only be called by the producer thread.
+     * @param val the element.
+     * @return true if the element was added, false if the queue is full.
+     */
+    bool push(T val) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_cached_head > m_mask) {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if(tail - m_cached_head > m_mask) return false;
+        }
+        m_slots[tail & m_mask].emplace(std::move(val));
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Removes the oldest element. Must only be called by the consumer thread.
+     * @return the element, or nothing if the queue is empty.
+     */
+    std::optional<T> pop() {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if(head == m_cached_tail) {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if(head == m_cached_tail) return std::nullopt;
+        }
+        auto& slot = m_slots[head & m_mask];
+        std::optional<T> ret = std::move(slot);
+        slot.reset();
+        m_head.store(head + 1, std::memory_order_release);
+        return ret;
+    }
+
+    /**
+     * Checks if the queue is empty. Exact only when called by the consumer thread.
+     */
+    [[nodiscard]] bool empty() const noexcept {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] size_t capacity() const noexcept { return m_mask + 1; }
+
+private:
+    static size_t round_up(size_t n) {
+        size_t ret = 2;
+        while(ret < n) ret <<= 1;
+        return ret;
+    }
+
+    const size_t m_mask;
+    std::unique_ptr<std::optional<T>[]> m_slots;
+
+    alignas(CACHE_LINE) std::atomic<size_t> m_head = 0;     // Written by the consumer
+    size_t m_cached_tail = 0;
+    alignas(CACHE_LINE) std::atomic<size_t> m_tail = 0;     // Written by the producer
+    size_t m_cached_head = 0;
+};
+
+#endif //SPSC_QUEUE_HPP
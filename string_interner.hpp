@@ -0,0 +1,66 @@
+#ifndef STRING_INTERNER_HPP
+#define STRING_INTERNER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+
+/**
+ * A table of distinct strings, each identified by a 32-bit id.
+ *
+ * Many logs repeat the same few strings (peer addresses above all); storing an id instead of a copy makes each
+ * entry a few bytes. Strings are never removed, and their storage never moves, so references returned by str()
+ * stay valid for the lifetime of the table. Lookups of known strings only take a shared lock.
+ */
+class string_interner {
+public:
+    using id_type = uint32_t;
+
+    /**
+     * Gets the id of a string, adding it to the table if needed.
+     * @param str the string.
+     * @return the id of the string.
+     */
+    id_type intern(std::string_view str) {
+        {
+            std::shared_lock lock(m_mutex);
+            const auto it = m_ids.find(str);
+            if(it != m_ids.end()) return it->second;
+        }
+        std::unique_lock lock(m_mutex);
+        const auto it = m_ids.find(str);
+        if(it != m_ids.end()) return it->second;
+        const auto id = static_cast<id_type>(m_strings.size());
+        m_strings.emplace_back(str);
+        m_ids.emplace(m_strings.back(), id);
+        return id;
+    }
+
+    /**
+     * Gets the string of an id.
+     * @param id an id returned by intern().
+     * @return the string.
+     */
+    [[nodiscard]] const std::string& str(id_type id) const {
+        std::shared_lock lock(m_mutex);
+        return m_strings[id];
+    }
+
+    [[nodiscard]] size_t size() const {
+        std::shared_lock lock(m_mutex);
+        return m_strings.size();
+    }
+
+private:
+    std::deque<std::string> m_strings;
+    std::unordered_map<std::string_view, id_type> m_ids;
+
+    mutable std::shared_mutex m_mutex;
+};
+
+#endif //STRING_INTERNER_HPP
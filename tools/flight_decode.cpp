@@ -0,0 +1,27 @@
+#include "../flight_recorder.hpp"
+
+#include <cstdio>
+#include <string>
+
+/**
+ * Prints the events of flight recorder dumps, written on SIGUSR1, on a fatal signal or on a watchdog stall.
+ *
+ * Usage: flight_decode <dump file>...
+ */
+int main(int argc, const char* argv[]) {
+    if(argc < 2) {
+        std::fprintf(stderr, "Usage: %s <dump file>...\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for(int i = 1; i < argc; i++) {
+        const auto text = flight::decode(argv[i]);
+        if(text.empty()) {
+            std::fprintf(stderr, "%s is not a flight recorder dump\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        std::printf("%s: %s", argv[i], text.c_str());
+    }
+    return ret;
+}
@@ -0,0 +1,115 @@
+#include "../trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Merges the trace files dumped by the nodes of a cluster (--trace=<path>) into per-snippet propagation timelines,
+ * and prints the latency CDFs of single deliveries and of whole-mesh propagation (the time until the last node
+ * received the snippet). Latencies compare the physical part of HLC stamps, so they are only meaningful between
+ * nodes with synchronized clocks, e.g. on one host.
+ *
+ * Usage: trace_collector [--timelines] <trace file>...
+ */
+struct receipt {
+    std::string node;
+    std::string sender;
+    uint64_t stamp;
+    uint32_t hops;
+};
+
+struct timeline {
+    std::string origin_node;        // Empty if the origin's trace file is missing
+    uint64_t origin = 0;
+    std::vector<receipt> receipts;
+};
+
+/**
+ * Reads one trace file into the timelines.
+ * @return the number of records read, or -1 if the file could not be read.
+ */
+long read_trace(const std::string& path, std::map<uint64_t, timeline>& timelines) {
+    std::ifstream in(path);
+    std::string word, node;
+    if(!(in >> word >> node) || word != "node")
+        return -1;
+    long count = 0;
+    for(std::string line; std::getline(in, line);) {
+        std::stringstream fields(line);
+        uint64_t id, origin, stamp;
+        uint32_t hops;
+        std::string sender;
+        if(!(fields >> std::hex >> id >> origin >> stamp >> std::dec >> hops >> sender))
+            continue;
+        auto& t = timelines[id];
+        t.origin = origin;
+        if(hops == 0)
+            t.origin_node = node;
+        else
+            t.receipts.push_back({ node, sender, stamp, hops });
+        count++;
+    }
+    return count;
+}
+
+long latency_us(uint64_t origin, uint64_t stamp) {
+    return static_cast<long>((trace::hlc::physical(stamp) - trace::hlc::physical(origin)).count());
+}
+
+void print_cdf(const char* name, std::vector<long> samples) {
+    std::printf("\n%s latency CDF (%zu samples)\n", name, samples.size());
+    if(samples.empty()) return;
+    std::sort(samples.begin(), samples.end());
+    std::printf("%10s %14s\n", "fraction", "latency (us)");
+    for(const double q : { 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 0.999, 1.0 }) {
+        const auto index = std::min(samples.size() - 1, static_cast<size_t>(q * double(samples.size() - 1) + 0.5));
+        std::printf("%10.3f %14ld\n", q, samples[index]);
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    bool timelines_wanted = false;
+    std::map<uint64_t, timeline> timelines;
+    size_t files = 0;
+    for(int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if(arg == "--timelines") {
+            timelines_wanted = true;
+            continue;
+        }
+        if(read_trace(arg, timelines) < 0) {
+            std::fprintf(stderr, "Could not read trace file %s\n", arg.c_str());
+            continue;
+        }
+        files++;
+    }
+    if(files == 0) {
+        std::fprintf(stderr, "Usage: %s [--timelines] <trace file>...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<long> deliveries, mesh;
+    size_t receipts = 0;
+    for(auto& [id, t] : timelines) {
+        std::sort(t.receipts.begin(), t.receipts.end(), [](const receipt& a, const receipt& b) { return a.stamp < b.stamp; });
+        receipts += t.receipts.size();
+        for(const auto& r : t.receipts)
+            deliveries.push_back(latency_us(t.origin, r.stamp));
+        if(!t.receipts.empty())
+            mesh.push_back(latency_us(t.origin, t.receipts.back().stamp));
+        if(!timelines_wanted) continue;
+        std::printf("trace %016llx from %s\n", static_cast<unsigned long long>(id), t.origin_node.empty() ? "?" : t.origin_node.c_str());
+        for(const auto& r : t.receipts)
+            std::printf("  +%8ld us  %-21s via %-21s %u hops\n", latency_us(t.origin, r.stamp), r.node.c_str(), r.sender.c_str(), r.hops);
+    }
+
+    std::printf("%zu trace files, %zu snippets, %zu receipts\n", files, timelines.size(), receipts);
+    print_cdf("Delivery", deliveries);
+    print_cdf("Whole-mesh", mesh);
+    return 0;
+}
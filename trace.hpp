@@ -0,0 +1,216 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "net/socket_address.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Mesh-wide trace ids for snippets, to measure how long a snippet takes to reach every node and along which path.
+ *
+ * A traced snippet tags its timestamp with a trace context: a random trace id, the hybrid logical clock (HLC) stamp
+ * of its origin and the number of hops it has taken, e.g. "snip12^3f2a9c.5e1d0b8c4000.1 text"; nodes without
+ * tracing still read the timestamp as 12. Every tracing node records one compact record per traced snippet it sends
+ * or receives in a ring buffer, dumped to a text file that the trace_collector tool merges across nodes.
+ */
+namespace trace {
+
+constexpr char TAG = '^';
+
+/**
+ * A hybrid logical clock. A stamp holds microseconds since the epoch in its upper bits and a logical counter in
+ * its lower 12 bits, so stamps follow physical time closely, yet never go backwards and always order a receive
+ * after its send, even across nodes whose clocks drift slightly.
+ */
+class hlc {
+    static constexpr unsigned LOGICAL_BITS = 12;
+
+public:
+    /**
+     * Stamps a local or send event.
+     * @return the stamp.
+     */
+    uint64_t now() noexcept {
+        return advance(0);
+    }
+
+    /**
+     * Stamps the receipt of a remote stamp.
+     * @param remote the stamp carried by the received message.
+     * @return the stamp, greater than both remote and every previous stamp.
+     */
+    uint64_t update(uint64_t remote) noexcept {
+        return advance(remote);
+    }
+
+    /**
+     * Gets the physical part of a stamp.
+     * @param stamp the stamp.
+     * @return microseconds since the epoch.
+     */
+    [[nodiscard]] static std::chrono::microseconds physical(uint64_t stamp) noexcept {
+        return std::chrono::microseconds(stamp >> LOGICAL_BITS);
+    }
+
+private:
+    uint64_t advance(uint64_t remote) noexcept {
+        const auto wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch());
+        const uint64_t physical = uint64_t(wall.count()) << LOGICAL_BITS;
+        uint64_t last = m_last.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            next = std::max({ physical, last + 1, remote + 1 });
+        } while(!m_last.compare_exchange_weak(last, next, std::memory_order_relaxed));
+        return next;
+    }
+
+    std::atomic<uint64_t> m_last = 0;
+};
+
+struct context {
+    uint64_t id;
+    uint64_t origin;        // HLC stamp of the send at the origin
+    uint32_t hops;          // Hops taken to reach the node holding the context
+};
+
+/**
+ * Gets the tag attached to the timestamp of a traced snippet.
+ * @param ctx the trace context.
+ * @return the tag, e.g. "^3f2a9c.5e1d0b8c4000.1".
+ */
+std::string tag(const context& ctx) {
+    std::stringstream ret;
+    ret << TAG << std::hex << ctx.id << '.' << ctx.origin << '.' << std::dec << ctx.hops;
+    return ret.str();
+}
+
+/**
+ * Splits a trace tag off a timestamp token, e.g. "12^3f.5e1d.1" becomes { "12", { 0x3f, 0x5e1d, 1 } }.
+ * @param token the token to split.
+ * @return a pair of the untagged token and the trace context, if the token had a valid tag.
+ */
+std::pair<std::string, std::optional<context>> untag(const std::string& token) {
+    const auto pos = token.find(TAG);
+    if(pos == std::string::npos) return { token, std::nullopt };
+    const auto first = token.find('.', pos);
+    const auto second = first == std::string::npos ? first : token.find('.', first + 1);
+    try {
+        if(second != std::string::npos)
+            return { token.substr(0, pos), context { std::stoull(token.substr(pos + 1, first - pos - 1), nullptr, 16),
+                                                     std::stoull(token.substr(first + 1, second - first - 1), nullptr, 16),
+                                                     static_cast<uint32_t>(std::stoul(token.substr(second + 1))) } };
+    } catch(std::logic_error&) {}
+    return { token.substr(0, pos), std::nullopt };
+}
+
+/**
+ * What one node saw of one traced snippet: its send at the origin (hops 0) or one receipt.
+ */
+struct hop_record {
+    uint64_t id;
+    uint64_t origin;
+    uint64_t stamp;             // HLC stamp of the send or receipt on this node
+    net::address_v4 sender;     // The node itself for a send
+    uint32_t hops;
+};
+
+/**
+ * Starts traces and records the hops of the traced snippets a node sends and receives, keeping the most recent
+ * records in a ring buffer.
+ */
+class recorder {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+    explicit recorder(const net::address_v4& node, size_t capacity = DEFAULT_CAPACITY, uint64_t seed = std::random_device{}())
+            : m_node(node), m_records(std::max<size_t>(capacity, 1)), m_rng(seed) {}
+
+    /**
+     * Starts the trace of a snippet sent by this node.
+     * @return the context to attach to the snippet.
+     */
+    context start() {
+        std::scoped_lock lock(m_mutex);
+        const context ctx = { m_rng(), m_clock.now(), 0 };
+        append({ ctx.id, ctx.origin, ctx.origin, m_node, 0 });
+        return { ctx.id, ctx.origin, 1 };
+    }
+
+    /**
+     * Records the receipt of a traced snippet.
+     * @param ctx the trace context of the snippet.
+     * @param sender the peer the snippet was received from.
+     */
+    void on_receive(const context& ctx, const net::address_v4& sender) {
+        std::scoped_lock lock(m_mutex);
+        append({ ctx.id, ctx.origin, m_clock.update(ctx.origin), sender, ctx.hops });
+    }
+
+    /**
+     * Gets the recorded hops.
+     * @return the records, oldest first.
+     */
+    [[nodiscard]] std::vector<hop_record> records() const {
+        std::scoped_lock lock(m_mutex);
+        std::vector<hop_record> ret;
+        const size_t size = std::min(m_count, m_records.size());
+        for(size_t i = m_count - size; i < m_count; i++)
+            ret.push_back(m_records[i % m_records.size()]);
+        return ret;
+    }
+
+    /**
+     * Gets the number of records overwritten because the ring buffer was full.
+     */
+    [[nodiscard]] size_t dropped() const {
+        std::scoped_lock lock(m_mutex);
+        return m_count - std::min(m_count, m_records.size());
+    }
+
+    /**
+     * Writes the recorded hops to a text file: a "node <address>" line, then one
+     * "<id> <origin> <stamp> <hops> <sender>" line per record, with the id and stamps in hexadecimal.
+     * @param path the path of the file.
+     * @return true if the file was written, false otherwise.
+     */
+    bool dump(const std::string& path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if(!out) {
+            std::cerr << "Could not write trace file " << path << std::endl;
+            return false;
+        }
+        out << "node " << m_node.to_string() << '\n';
+        for(const auto& r : records())
+            out << std::hex << r.id << ' ' << r.origin << ' ' << r.stamp << ' ' << std::dec << r.hops << ' ' << r.sender.to_string() << '\n';
+        return bool(out);
+    }
+
+private:
+    void append(const hop_record& record) {
+        m_records[m_count++ % m_records.size()] = record;
+    }
+
+    const net::address_v4 m_node;
+    hlc m_clock;
+    std::vector<hop_record> m_records;
+    size_t m_count = 0;
+    std::mt19937_64 m_rng;
+    mutable std::mutex m_mutex;
+};
+
+} // trace
+
+#endif //TRACE_HPP
@@ -1,11 +1,18 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <numeric>
+#include <string>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 
@@ -45,17 +52,26 @@ time_type get_current_time() noexcept {
     return time_point_cast<seconds>(system_clock::now());
 }
 
+/**
+ * Gets a string of the date and time of a time_point.
+ * @param point the time_point.
+ * @return a string of the date and time.
+ */
+std::string to_time_str(time_type point) noexcept {
+    const auto time = system_clock::to_time_t(point);
+    std::tm tm = {};
+    ::localtime_r(&time, &tm);
+    char strtime[32] = {};
+    std::strftime(strtime, sizeof(strtime), "%Y-%m-%d %H:%M:%S", &tm);
+    return strtime;
+}
+
 /**
  * Gets a string of the current date and time.
  * @return a string of the current date and time.
  */
 std::string get_current_time_str() noexcept {
-    const auto now  = system_clock::now();
-    const auto time = system_clock::to_time_t(now);
-    const auto tm   = std::localtime(&time);
-    char strtime[32] = {};
-    std::strftime(strtime, sizeof(strtime), "%Y-%m-%d %H:%M:%S", tm);
-    return strtime;
+    return to_time_str(get_current_time());
 }
 
 } // clocks
@@ -158,4 +174,69 @@ std::string trim(const std::string& s) {
 
 } // strings
 
+
+/**
+ * File helper methods
+ */
+namespace files {
+
+/**
+ * A read-only memory mapping of a file. The mapping remains valid even if the file is unlinked or renamed after
+ * it has been opened, which lets readers scan files without holding the lock of their writer.
+ */
+class mapped_file {
+public:
+    mapped_file() = default;
+
+    /**
+     * Maps the first n bytes of the given file. If n is zero, the whole file is mapped.
+     * @param path the path of the file to map.
+     * @param n the number of bytes to map.
+     */
+    explicit mapped_file(const std::string& path, size_t n = 0) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) return;
+        if(n == 0) {
+            struct stat st = {};
+            if(::fstat(fd, &st) == 0)
+                n = static_cast<size_t>(st.st_size);
+        }
+        if(n > 0) {
+            void* data = ::mmap(nullptr, n, PROT_READ, MAP_SHARED, fd, 0);
+            if(data != MAP_FAILED) {
+                ::madvise(data, n, MADV_SEQUENTIAL);
+                m_data = static_cast<const char*>(data);
+                m_size = n;
+            }
+        }
+        ::close(fd);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    mapped_file(mapped_file&& other) noexcept
+            : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)) {}
+
+    mapped_file& operator=(mapped_file&& other) noexcept {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    ~mapped_file() {
+        if(m_data) ::munmap(const_cast<char*>(m_data), m_size);
+    }
+
+    [[nodiscard]] const char* data() const noexcept { return m_data; }
+    [[nodiscard]] size_t size() const noexcept { return m_size; }
+    [[nodiscard]] bool is_open() const noexcept { return m_data != nullptr; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+} // files
+
 #endif //UTILS_HPP
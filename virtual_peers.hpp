@@ -0,0 +1,456 @@
+#ifndef VIRTUAL_PEERS_HPP
+#define VIRTUAL_PEERS_HPP
+
+#include "net/buffer.hpp"
+#include "net/udp.hpp"
+
+#include "channels.hpp"
+#include "logger.hpp"
+#include "peer_manager.hpp"
+#include "string_interner.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+class virtual_host;
+
+
+/**
+ * A pool of fixed-size receive buffers shared by the threads of a virtual_host, so memory for buffers scales with
+ * the number of threads rather than the number of hosted peers.
+ */
+class buffer_pool {
+public:
+    static constexpr size_t BUFFER_SIZE = 2048;
+
+    /**
+     * A buffer borrowed from the pool, returned to it when destroyed.
+     */
+    class lease {
+    public:
+        lease(buffer_pool& pool, std::unique_ptr<char[]> data)
+                : m_pool(pool), m_data(std::move(data)) {}
+        lease(const lease&) = delete;
+        lease& operator=(const lease&) = delete;
+        ~lease() { m_pool.release(std::move(m_data)); }
+
+        [[nodiscard]] char* data() const noexcept { return m_data.get(); }
+        [[nodiscard]] static constexpr size_t size() noexcept { return BUFFER_SIZE; }
+
+    private:
+        buffer_pool& m_pool;
+        std::unique_ptr<char[]> m_data;
+    };
+
+    lease acquire() {
+        std::scoped_lock lock(m_mutex);
+        if(m_free.empty())
+            return { *this, std::make_unique<char[]>(BUFFER_SIZE) };
+        auto data = std::move(m_free.back());
+        m_free.pop_back();
+        return { *this, std::move(data) };
+    }
+
+private:
+    void release(std::unique_ptr<char[]> data) {
+        std::scoped_lock lock(m_mutex);
+        m_free.push_back(std::move(data));
+    }
+
+    std::vector<std::unique_ptr<char[]>> m_free;
+    std::mutex m_mutex;
+};
+
+
+/**
+ * One logical peer hosted by a virtual_host: its own address, socket, peer table, clock and logs, but no thread.
+ *
+ * An identity is not a peer_manager, which would cost three threads and every optional subsystem per identity; it
+ * speaks the base protocol only, with the request parsing shared with peer_manager (parse_heartbeat and
+ * parse_snippet). It answers the RTT probes of heartbeats with 'pong', acknowledges snippets from their origin with
+ * 'sack', and delivers gossiped snippets once on behalf of their origin. It does not forward gossip, take part in
+ * view shuffles, reassemble fragments or recover snippets from parity, so to other nodes it looks like a node that
+ * predates those features.
+ *
+ * The event logs only store ids from the host's interning table and raw times, and are expanded into the usual
+ * report format on demand, so an idle identity costs a few hundred bytes plus its peer table. Snippet texts are kept
+ * by the identity that received them rather than interned, so the host does not grow with the traffic.
+ */
+class virtual_peer {
+public:
+    using address_type = net::address_v4;
+    using peer_type    = net::address_v4;
+    using time_type    = clocks::time_type;
+    using id_type      = string_interner::id_type;
+
+    virtual_peer(virtual_host& host, const address_type& address);
+
+    [[nodiscard]] const address_type& address() const noexcept { return m_address; }
+    [[nodiscard]] bool is_running() const noexcept { return m_running; }
+
+    [[nodiscard]] size_t peer_count() const {
+        std::scoped_lock lock(m_mutex);
+        return m_peers.size();
+    }
+
+    /**
+     * Sends a snippet from this identity to all of its peers.
+     * @param text the snippet message.
+     */
+    void send_snippet(const std::string& text);
+
+    /**
+     * Generates the runtime report of this identity, in the same format as assemble_report().
+     * @return a string representing the peer server report.
+     */
+    [[nodiscard]] std::string report() const;
+
+private:
+    friend class virtual_host;
+
+    struct event {
+        id_type to;
+        id_type from;
+        time_type time;
+    };
+
+    struct snippet {
+        size_t timestamp;
+        std::string message;
+        id_type sender;
+    };
+
+    static constexpr size_t SEEN_CAPACITY = 256;
+
+    void handle(const char* data, const address_type& sender);
+    void on_snip(const snippet_request& snip, const address_type& sender, time_type now);
+    void keep_alive(std::chrono::seconds timeout);
+    void touch(const peer_type& peer, time_type now);
+    void log_peer(id_type peer);
+
+    virtual_host& m_host;
+    const address_type m_address;
+    const id_type m_name;
+    net::udp::socket m_socket;
+    std::atomic<bool> m_running = true;
+
+    // Guarded by m_mutex
+    std::unordered_map<peer_type, time_type> m_peers;
+    size_t m_timestamp = 0;
+    std::vector<id_type> m_peer_log;
+    std::vector<std::pair<id_type, std::pair<time_type, std::vector<peer_type>>>> m_sources;
+    std::vector<event> m_sent;
+    std::vector<event> m_recv;
+    std::vector<snippet> m_snippets;
+    std::unique_ptr<gossip::seen_filter> m_seen;        // Created with the first gossiped snippet
+
+    mutable std::mutex m_mutex;
+};
+
+
+/**
+ * Hosts many virtual_peer identities in one process on a shared reactor.
+ *
+ * A fixed pool of threads waits on a single epoll instance watching the sockets of every identity. A socket is
+ * armed one-shot, so an identity is only ever handled by one thread at a time, and is re-armed once its queued
+ * datagrams have been handled. Keep-alive and cleanup run as one periodic sweep over all identities, done by
+ * whichever thread wakes up first once it is due. Receive buffers come from a shared pool and peer addresses from a
+ * shared interning table.
+ */
+class virtual_host {
+    static constexpr auto DEFAULT_KEEP_ALIVE = std::chrono::seconds(5);
+    static constexpr auto DEFAULT_TIMEOUT    = std::chrono::seconds(20);
+    static constexpr size_t MAX_RECV_BATCH   = 32;
+
+public:
+    using address_type = net::address_v4;
+    using peer_type    = net::address_v4;
+    using snippet_handler = std::function<void(virtual_peer&, const address_type& sender, size_t timestamp, const std::string& message)>;
+
+    /**
+     * @param threads the number of threads of the reactor, including the one calling run().
+     */
+    explicit virtual_host(size_t threads = 1)
+            : m_threads(std::max<size_t>(threads, 1)), m_epoll(::epoll_create1(EPOLL_CLOEXEC)),
+              m_wakeup(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+    }
+
+    virtual_host(const virtual_host&) = delete;
+    virtual_host& operator=(const virtual_host&) = delete;
+
+    ~virtual_host() {
+        ::close(m_wakeup);
+        ::close(m_epoll);
+    }
+
+    /**
+     * Adds an identity. Can be called before or during run().
+     * @param address the address of the identity.
+     * @param src the address of the registry the initial peers were received from.
+     * @param peers the initial peers of the identity.
+     * @return the identity.
+     */
+    std::shared_ptr<virtual_peer> add(const address_type& address, const address_type& src, const std::unordered_set<peer_type>& peers) {
+        auto peer = std::make_shared<virtual_peer>(*this, address);
+        {
+            std::scoped_lock lock(peer->m_mutex);
+            const auto now = clocks::get_current_time();
+            for(const auto& p : peers) {
+                peer->m_peers[p] = now;
+                peer->log_peer(m_names.intern(p.to_string()));
+            }
+            peer->m_sources.push_back({ m_names.intern(src.to_string()), { now, { peers.begin(), peers.end() } } });
+        }
+        {
+            std::scoped_lock lock(m_mutex);
+            m_peers.push_back(peer);
+        }
+        m_active++;
+        arm(*peer, EPOLL_CTL_ADD);
+        return peer;
+    }
+
+    /**
+     * Sets the callable invoked for every snippet delivered to any identity. Must be called before run().
+     */
+    void on_snippet(snippet_handler handler) {
+        m_handler = std::move(handler);
+    }
+
+    /**
+     * Runs the reactor on the pool of threads. Blocks until stop() is called or every identity has received 'stop'.
+     */
+    void run() {
+        std::vector<std::thread> pool;
+        for(size_t i = 1; i < m_threads; i++)
+            pool.emplace_back([this] { run_thread(); });
+        run_thread();
+        for(auto& thread : pool)
+            thread.join();
+    }
+
+    void stop() {
+        m_stopping = true;
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto ret = ::write(m_wakeup, &one, sizeof(one));
+    }
+
+    [[nodiscard]] size_t size() const {
+        std::scoped_lock lock(m_mutex);
+        return m_peers.size();
+    }
+
+    [[nodiscard]] size_t threads() const noexcept { return m_threads; }
+    [[nodiscard]] string_interner& names() noexcept { return m_names; }
+
+private:
+    friend class virtual_peer;
+
+    void arm(virtual_peer& peer, int op) const {
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = &peer;
+        ::epoll_ctl(m_epoll, op, peer.m_socket.handle(), &ev);
+    }
+
+    void run_thread() {
+        epoll_event events[16];
+        while(!m_stopping) {
+            const auto now = steady_clock::now().time_since_epoch();
+            auto due = m_next_sweep.load();
+            if(now.count() >= due && m_next_sweep.compare_exchange_strong(due, (now + DEFAULT_KEEP_ALIVE).count()))
+                sweep();
+            const auto wait = duration_cast<milliseconds>(steady_clock::duration(m_next_sweep.load()) - now);
+            const int n = ::epoll_wait(m_epoll, events, 16, static_cast<int>(std::max<int64_t>(wait.count(), 1)));
+            for(int i = 0; i < n; i++) {
+                if(events[i].data.ptr == nullptr) continue;      // Wakeup from stop()
+                handle(*static_cast<virtual_peer*>(events[i].data.ptr));
+            }
+        }
+    }
+
+    /**
+     * Handles the datagrams queued on the socket of an identity, then re-arms it unless it has stopped.
+     */
+    void handle(virtual_peer& peer) {
+        const auto buffer = m_buffers.acquire();
+        address_type sender;
+        for(size_t i = 0; i < MAX_RECV_BATCH && peer.m_running; i++) {
+            const auto len = peer.m_socket.recv_from(net::buffer(buffer.data(), buffer.size() - 1), MSG_DONTWAIT, &sender);
+            if(len < 0) break;
+            buffer.data()[len] = '\0';
+            peer.handle(buffer.data(), sender);
+        }
+        if(peer.m_running) {
+            arm(peer, EPOLL_CTL_MOD);
+            return;
+        }
+        ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, peer.m_socket.handle(), nullptr);
+        if(--m_active == 0)
+            stop();
+    }
+
+    void sweep() {
+        std::vector<std::shared_ptr<virtual_peer>> peers;
+        {
+            std::scoped_lock lock(m_mutex);
+            peers = m_peers;
+        }
+        for(const auto& peer : peers) {
+            if(peer->m_running)
+                peer->keep_alive(DEFAULT_TIMEOUT);
+        }
+    }
+
+    const size_t m_threads;
+    const int m_epoll;
+    const int m_wakeup;
+
+    std::vector<std::shared_ptr<virtual_peer>> m_peers;
+    std::atomic<size_t> m_active = 0;
+    std::atomic<bool> m_stopping = false;
+    std::atomic<steady_clock::rep> m_next_sweep = 0;
+
+    string_interner m_names;
+    buffer_pool m_buffers;
+    snippet_handler m_handler;
+
+    mutable std::mutex m_mutex;
+};
+
+
+virtual_peer::virtual_peer(virtual_host& host, const address_type& address)
+        : m_host(host), m_address(address), m_name(host.m_names.intern(address.to_string())), m_socket(address) {
+    if(!m_socket)
+        std::cerr << "Failed to bind " << address << ": " << m_socket.last_error_str() << std::endl;
+}
+
+void virtual_peer::send_snippet(const std::string& text) {
+    std::scoped_lock lock(m_mutex);
+    const std::string snippet = "snip" + std::to_string(++m_timestamp) + " " + text;
+    for(const auto& [addr, time] : m_peers)
+        m_socket.send_to(net::buffer(snippet), addr);
+}
+
+void virtual_peer::handle(const char* data, const address_type& sender) {
+    auto [request, contents] = parse_request(data);
+    contents = strings::trim(contents);
+    const auto now = clocks::get_current_time();
+    if(request == "peer") {
+        const auto heartbeat = parse_heartbeat(contents);
+        if(heartbeat.probe)
+            m_socket.send_to(net::buffer("pong" + *heartbeat.probe), sender);
+        try {
+            const auto& [host, port] = strings::split(heartbeat.address, ':');
+            const peer_type peer = { host, static_cast<in_port_t>(std::stoul(port)) };
+            const auto sender_name = m_host.m_names.intern(sender.to_string());
+            const auto peer_name = peer == sender ? sender_name : m_host.m_names.intern(peer.to_string());
+            std::scoped_lock lock(m_mutex);
+            m_recv.push_back({ sender_name, peer_name, now });
+            log_peer(sender_name);
+            log_peer(peer_name);
+            touch(sender, now);
+            touch(peer, now);
+        } catch(std::exception&) {}
+    } else if(request == "snip") {
+        std::optional<snippet_request> snip;
+        try {
+            snip = parse_snippet(contents);
+        } catch(std::logic_error&) {
+            return;
+        }
+        on_snip(*snip, sender, now);
+    } else if(request == "stop") {
+        m_running = false;
+    }
+}
+
+void virtual_peer::on_snip(const snippet_request& snip, const address_type& sender, time_type now) {
+    if(!snip.route || snip.route->origin == sender)
+        m_socket.send_to(net::buffer("sack" + snip.stamp), sender);
+    const peer_type author = snip.route ? snip.route->origin : sender;
+    size_t timestamp;
+    {
+        std::scoped_lock lock(m_mutex);
+        m_timestamp = std::max(m_timestamp, snip.timestamp);
+        touch(sender, now);
+        if(snip.route) {
+            if(!m_seen)
+                m_seen = std::make_unique<gossip::seen_filter>(SEEN_CAPACITY);
+            if(author == m_address || !m_seen->insert(author, snip.timestamp))
+                return;
+        }
+        timestamp = m_timestamp;
+        m_snippets.push_back({ timestamp, snip.text, m_host.m_names.intern(author.to_string()) });
+    }
+    if(m_host.m_handler)
+        m_host.m_handler(*this, author, timestamp, snip.text);
+}
+
+void virtual_peer::keep_alive(std::chrono::seconds timeout) {
+    const auto now = clocks::get_current_time();
+    const std::string heartbeat = "peer" + m_address.to_string();
+    std::scoped_lock lock(m_mutex);
+    for(auto it = m_peers.begin(); it != m_peers.end();) {
+        if(now - it->second > timeout) {
+            it = m_peers.erase(it);
+            continue;
+        }
+        m_socket.send_to(net::buffer(heartbeat), it->first);
+        m_sent.push_back({ m_host.m_names.intern(it->first.to_string()), m_name, now });
+        ++it;
+    }
+}
+
+void virtual_peer::touch(const peer_type& peer, time_type now) {
+    if(peer != m_address)
+        m_peers[peer] = now;
+}
+
+void virtual_peer::log_peer(id_type peer) {
+    if(std::find(m_peer_log.begin(), m_peer_log.end(), peer) == m_peer_log.end())
+        m_peer_log.push_back(peer);
+}
+
+std::string virtual_peer::report() const {
+    const auto& names = m_host.m_names;
+    log_snapshot logs;
+    {
+        std::scoped_lock lock(m_mutex);
+        for(const auto id : m_peer_log)
+            logs.peers.insert(names.str(id));
+        for(const auto& [src, entry] : m_sources)
+            logs.sources[names.str(src)] = { { entry.second.begin(), entry.second.end() }, clocks::to_time_str(entry.first) };
+        for(const auto& e : m_sent)
+            logs.sent_peers.push_back({ names.str(e.to), names.str(e.from), clocks::to_time_str(e.time) });
+        for(const auto& e : m_recv)
+            logs.recv_peers.push_back({ names.str(e.to), names.str(e.from), clocks::to_time_str(e.time) });
+        for(const auto& s : m_snippets)
+            logs.snippets.push_back({ s.timestamp, s.message, names.str(s.sender) });
+    }
+    logger log;
+    log.restore_logs(std::move(logs));
+    return assemble_report(log, {});
+}
+
+#endif //VIRTUAL_PEERS_HPP
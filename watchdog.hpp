@@ -0,0 +1,365 @@
+#ifndef WATCHDOG_HPP
+#define WATCHDOG_HPP
+
+#include "utils.hpp"
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <csignal>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ * A histogram of stall durations with power-of-two millisecond buckets: [0, 1), [1, 2), [2, 4), ... up to the
+ * last bucket which holds everything longer.
+ */
+struct stall_histogram {
+    static constexpr size_t BUCKETS = 16;
+
+    std::array<uint64_t, BUCKETS> counts = {};
+    uint64_t total = 0;
+    std::chrono::milliseconds sum = {};
+    std::chrono::milliseconds max = {};
+
+    void add(std::chrono::milliseconds duration) {
+        size_t bucket = 0;
+        while(bucket + 1 < BUCKETS && duration.count() >= (int64_t(1) << bucket))
+            bucket++;
+        counts[bucket]++;
+        total++;
+        sum += duration;
+        max = std::max(max, duration);
+    }
+
+    /**
+     * Gets the exclusive upper bound of a bucket.
+     * @param bucket the index of the bucket.
+     * @return the bound, or milliseconds::max() for the last bucket.
+     */
+    [[nodiscard]] static std::chrono::milliseconds bound(size_t bucket) noexcept {
+        return bucket + 1 < BUCKETS ? std::chrono::milliseconds(int64_t(1) << bucket) : std::chrono::milliseconds::max();
+    }
+};
+
+
+/**
+ * A stall of a watched loop, as recorded in the event log of the watchdog.
+ */
+struct stall_event {
+    std::string loop;
+    std::string span;                   // What the loop was doing when the stall was detected
+    std::vector<std::string> stack;     // Stack of the loop thread when the stall was detected, if it could be sampled
+    std::chrono::milliseconds duration;
+    std::string date;
+};
+
+
+/**
+ * Detects stalls of the event loops of a node.
+ *
+ * Every watched loop bumps a heartbeat counter each time it makes progress, naming what it is about to do, and
+ * marks itself idle before blocking on purpose (waiting for a datagram or sleeping until its next round). A
+ * separate thread checks the counters several times per threshold; a loop which is not idle and whose counter has
+ * not moved for longer than the threshold is stalled. On detection the watchdog samples the stack of the loop
+ * thread by signalling it, and once the loop moves again it adds the stall duration to the loop's histogram and
+ * appends an entry to the event log.
+ */
+class watchdog {
+    static constexpr size_t MAX_EVENTS = 256;
+    static constexpr int MAX_FRAMES    = 32;
+
+public:
+    static constexpr auto DEFAULT_THRESHOLD = std::chrono::milliseconds(100);
+
+    using clock_type = std::chrono::steady_clock;
+
+    /**
+     * The heartbeat of one watched loop. Only the loop thread calls beat() and idle().
+     */
+    class loop {
+    public:
+        /**
+         * Records progress of the loop.
+         * @param span what the loop is about to do; must be a string literal.
+         */
+        void beat(const char* span) noexcept {
+            m_span.store(span, std::memory_order_relaxed);
+            m_beats.fetch_add(1, std::memory_order_release);
+            m_idle.store(false, std::memory_order_release);
+        }
+
+        /**
+         * Marks the loop as waiting on purpose until its next beat.
+         */
+        void idle() noexcept {
+            m_beats.fetch_add(1, std::memory_order_relaxed);
+            m_idle.store(true, std::memory_order_release);
+        }
+
+    private:
+        friend class watchdog;
+
+        explicit loop(std::string name) : m_name(std::move(name)), m_thread(pthread_self()) {}
+
+        const std::string m_name;
+        const pthread_t m_thread;
+        std::atomic<uint64_t> m_beats = 0;
+        std::atomic<bool> m_idle = true;
+        std::atomic<const char*> m_span = "";
+
+        // Only used by the watchdog thread
+        uint64_t m_seen = 0;
+        clock_type::time_point m_progress = clock_type::now();
+        std::unique_ptr<stall_event> m_stall;
+
+        // Guarded by the watchdog mutex
+        stall_histogram m_histogram;
+    };
+
+    explicit watchdog(std::chrono::milliseconds threshold = DEFAULT_THRESHOLD, bool verbose = false)
+            : m_threshold(threshold), m_verbose(verbose) {}
+
+    watchdog(const watchdog&) = delete;
+    watchdog& operator=(const watchdog&) = delete;
+
+    ~watchdog() {
+        stop();
+    }
+
+    /**
+     * Starts watching the calling thread's loop. The handle stays valid for the lifetime of the watchdog.
+     * @param name the name of the loop.
+     * @return the heartbeat of the loop.
+     */
+    loop& watch(const std::string& name) {
+        std::scoped_lock lock(m_mutex);
+        m_loops.emplace_back(new loop(name));
+        return *m_loops.back();
+    }
+
+    /**
+     * Starts the watchdog thread.
+     */
+    void start() {
+        if(m_thread.joinable()) return;
+        install_sampler();
+        m_running = true;
+        m_thread = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        {
+            std::scoped_lock lock(m_mutex);
+            m_running = false;
+        }
+        m_cv.notify_all();
+        if(m_thread.joinable())
+            m_thread.join();
+    }
+
+    /**
+     * Sets a callable invoked from the watchdog thread as soon as a stall is detected, while the loop is still
+     * stalled. Must be called before start().
+     * @param handler the callable, given the stall with its duration so far.
+     */
+    void on_stall(std::function<void(const stall_event&)> handler) {
+        m_handler = std::move(handler);
+    }
+
+    void set_threshold(std::chrono::milliseconds threshold) noexcept {
+        m_threshold = threshold;
+    }
+
+    [[nodiscard]] std::chrono::milliseconds threshold() const noexcept { return m_threshold; }
+
+    /**
+     * Gets the stall histogram of a loop.
+     * @param name the name of the loop.
+     * @return a copy of the histogram, empty if no such loop is watched.
+     */
+    [[nodiscard]] stall_histogram histogram(const std::string& name) const {
+        std::scoped_lock lock(m_mutex);
+        stall_histogram ret;
+        for(const auto& l : m_loops) {
+            if(l->m_name != name) continue;
+            for(size_t i = 0; i < stall_histogram::BUCKETS; i++)
+                ret.counts[i] += l->m_histogram.counts[i];
+            ret.total += l->m_histogram.total;
+            ret.sum += l->m_histogram.sum;
+            ret.max = std::max(ret.max, l->m_histogram.max);
+        }
+        return ret;
+    }
+
+    /**
+     * Gets the most recent stalls, oldest first.
+     * @return a copy of the event log.
+     */
+    [[nodiscard]] std::vector<stall_event> events() const {
+        std::scoped_lock lock(m_mutex);
+        return { m_events.begin(), m_events.end() };
+    }
+
+    /**
+     * Formats the stall histograms of every loop, one line per non-empty bucket.
+     * @return the histograms.
+     */
+    [[nodiscard]] std::string report() const {
+        std::vector<std::string> names;
+        {
+            std::scoped_lock lock(m_mutex);
+            for(const auto& l : m_loops)
+                names.push_back(l->m_name);
+        }
+        std::stringstream ret;
+        for(const auto& name : names) {
+            const auto h = histogram(name);
+            ret << name << ": " << h.total << " stalls, max " << h.max.count() << "ms\n";
+            for(size_t i = 0; i < stall_histogram::BUCKETS; i++) {
+                if(h.counts[i] == 0) continue;
+                ret << "  < ";
+                if(i + 1 < stall_histogram::BUCKETS)
+                    ret << stall_histogram::bound(i).count() << "ms";
+                else
+                    ret << "inf";
+                ret << ": " << h.counts[i] << '\n';
+            }
+        }
+        return ret.str();
+    }
+
+private:
+    void run() {
+        std::unique_lock lock(m_mutex);
+        while(m_running) {
+            m_cv.wait_for(lock, std::max(m_threshold.load() / 4, std::chrono::milliseconds(1)));
+            const auto now = clock_type::now();
+            for(size_t i = 0; i < m_loops.size(); i++)     // check() may unlock, and watch() may add loops meanwhile
+                check(*m_loops[i], now, lock);
+        }
+    }
+
+    /**
+     * Checks one loop, starting or ending its current stall.
+     * Called with the mutex held; releases it while sampling the stack of the loop.
+     */
+    void check(loop& l, clock_type::time_point now, std::unique_lock<std::mutex>& lock) {
+        const auto beats = l.m_beats.load(std::memory_order_acquire);
+        if(beats != l.m_seen || l.m_idle.load(std::memory_order_acquire)) {
+            if(l.m_stall) {
+                l.m_stall->duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - l.m_progress);
+                l.m_histogram.add(l.m_stall->duration);
+                if(m_verbose)
+                    std::cerr << "Loop '" << l.m_name << "' stalled for " << l.m_stall->duration.count() << "ms in " << l.m_stall->span << std::endl;
+                m_events.push_back(std::move(*l.m_stall));
+                if(m_events.size() > MAX_EVENTS)
+                    m_events.pop_front();
+                l.m_stall.reset();
+            }
+            l.m_seen = beats;
+            l.m_progress = now;
+            return;
+        }
+        if(l.m_stall || now - l.m_progress <= m_threshold.load())
+            return;
+
+        auto stall = std::make_unique<stall_event>();
+        stall->loop = l.m_name;
+        stall->span = l.m_span.load(std::memory_order_relaxed);
+        stall->date = clocks::get_current_time_str();
+        stall->duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - l.m_progress);
+        lock.unlock();
+        stall->stack = sample_stack(l.m_thread);
+        if(m_handler)
+            m_handler(*stall);
+        lock.lock();
+        l.m_stall = std::move(stall);
+    }
+
+    /**
+     * Where the sampling signal handler stores the stack of the interrupted thread. One sample at a time.
+     */
+    struct sample_slot {
+        void* frames[MAX_FRAMES];
+        std::atomic<int> depth = -1;
+    };
+
+    static sample_slot& slot() {
+        static sample_slot s;
+        return s;
+    }
+
+    static int sample_signal() {
+        return SIGRTMIN + 1;
+    }
+
+    static void install_sampler() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            void* warmup[1];
+            backtrace(warmup, 1);     // Loads the unwinder now rather than in the signal handler
+            struct sigaction action = {};
+            action.sa_handler = [](int) {
+                auto& s = slot();
+                s.depth.store(backtrace(s.frames, MAX_FRAMES), std::memory_order_release);
+            };
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            sigaction(sample_signal(), &action, nullptr);
+        });
+    }
+
+    /**
+     * Samples the stack of a thread by interrupting it with a signal.
+     * @param thread the thread.
+     * @return the symbolized frames, empty if the thread did not answer in time.
+     */
+    static std::vector<std::string> sample_stack(pthread_t thread) {
+        static std::mutex sampling;
+        std::scoped_lock lock(sampling);
+        auto& s = slot();
+        s.depth.store(-1, std::memory_order_relaxed);
+        if(pthread_kill(thread, sample_signal()) != 0)
+            return {};
+        const auto deadline = clock_type::now() + std::chrono::milliseconds(50);
+        while(s.depth.load(std::memory_order_acquire) < 0 && clock_type::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        const int depth = s.depth.load(std::memory_order_acquire);
+        if(depth <= 0)
+            return {};
+        std::vector<std::string> ret;
+        const std::unique_ptr<char*, decltype(&std::free)> symbols(backtrace_symbols(s.frames, depth), &std::free);
+        for(int i = 0; i < depth; i++)
+            ret.emplace_back(symbols ? symbols.get()[i] : "?");
+        return ret;
+    }
+
+    std::atomic<std::chrono::milliseconds> m_threshold;
+    const bool m_verbose;
+    std::function<void(const stall_event&)> m_handler;
+
+    std::vector<std::unique_ptr<loop>> m_loops;
+    std::deque<stall_event> m_events;
+    bool m_running = false;
+
+    std::thread m_thread;
+    std::condition_variable m_cv;
+    mutable std::mutex m_mutex;
+};
+
+#endif //WATCHDOG_HPP